@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# throughput and cpu time of every copy strategy of cp, for files
+# of several sizes. each class is about TOTAL bytes in files of its
+# size, copied by one cp -r -j 1
+#
+# usage: bench/strategy.sh [sizes...]    (run from commands/cp)
+#        DROP=1 drops the page cache before every copy (root only)
+
+SIZES=${*:-"4K 64K 1M 16M 256M"}
+TOTAL=${TOTAL:-256M}
+STRATEGIES=${STRATEGIES:-"read4k read mmap range sendfile auto"}
+CP=${CP:-./cp}
+DIR=${TMPDIR:-/tmp}/cp-strategy-bench.$$
+TIMES=$DIR/times
+
+[ -x "$CP" ] || ${CC:-cc} -O2 -pthread -o "$CP" cp.c || exit 1
+
+trap 'rm -rf "$DIR"' EXIT
+mkdir -p "$DIR"
+
+bytes() {
+    case $1 in
+        *K) echo $(( ${1%K} * 1024 )) ;;
+        *M) echo $(( ${1%M} * 1024 * 1024 )) ;;
+        *G) echo $(( ${1%G} * 1024 * 1024 * 1024 )) ;;
+        *)  echo "$1" ;;
+    esac
+}
+
+now() {
+    date +%s%N
+}
+
+# user + system time of the finished children, in ms, from the
+# output of times run in this shell (not in a $(...) subshell)
+cpu_ms() {
+    awk 'NR == 2 {
+        for (i = 1; i <= 2; i++) {
+            split($i, t, "m")
+            sub("s", "", t[2])
+            ms += t[1] * 60000 + t[2] * 1000
+        }
+        printf "%d\n", ms
+    }' "$TIMES"
+}
+
+total=$(bytes "$TOTAL")
+for size in $SIZES; do
+    len=$(bytes "$size")
+    count=$(( total / len ))
+    [ "$count" -gt 0 ] || count=1
+    rm -rf "$DIR/src"
+    mkdir -p "$DIR/src"
+    # a file of its own per name, so DROP=1 leaves every one of them cold
+    i=0
+    while [ "$i" -lt "$count" ]; do
+        head -c "$len" /dev/urandom > "$DIR/src/f$i"
+        i=$((i + 1))
+    done
+
+    for strategy in $STRATEGIES; do
+        rm -rf "$DIR/dst"
+        sync
+        [ -n "$DROP" ] && echo 3 > /proc/sys/vm/drop_caches
+        times > "$TIMES"
+        cpu=$(cpu_ms)
+        start=$(now)
+        "$CP" -r -j 1 -s "$strategy" "$DIR/src" "$DIR/dst" 2>/dev/null || {
+            printf '%-6s %-9s failed\n' "$size" "$strategy"
+            continue
+        }
+        end=$(now)
+        times > "$TIMES"
+        cpu=$(( $(cpu_ms) - cpu ))
+        ms=$(( (end - start) / 1000000 ))
+        [ "$ms" -gt 0 ] || ms=1
+        printf '%-6s %-9s %7d files %8d ms %8d MB/s %8d ms cpu\n' \
+            "$size" "$strategy" "$count" "$ms" \
+            $(( len * count / 1048576 * 1000 / ms )) "$cpu"
+    done
+done
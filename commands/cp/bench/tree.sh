@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# cp -r of a tree of small files with 1 up to N threads, on tmpfs
+# and on a disk-backed directory
+#
+# usage: bench/tree.sh [files] [threads...]    (run from commands/cp)
+
+FILES=${1:-100000}
+[ $# -gt 0 ] && shift
+THREADS=${*:-"1 2 4 8 16"}
+CP=${CP:-./cp}
+SHM=${SHM:-/dev/shm}
+DISK=${DISK:-${TMPDIR:-/tmp}}
+
+[ -x "$CP" ] || ${CC:-cc} -O2 -pthread -o "$CP" cp.c || exit 1
+
+now() {
+    date +%s%N
+}
+
+# FILES files of 1 to 4 KiB, 100 per directory, in a tree two levels
+# deep: d<n>/e<0-9>/f<0-99>, 10 leaf directories under each d<n>
+mktree() {
+    dir=$1
+    mkdir -p "$dir"
+    head -c 4096 /dev/urandom > "$dir/.blob"
+    i=0
+    while [ "$i" -lt "$FILES" ]; do
+        d="$dir/d$((i / 1000))/e$((i / 100 % 10))"
+        mkdir -p "$d"
+        j=0
+        while [ "$j" -lt 100 ] && [ "$i" -lt "$FILES" ]; do
+            head -c $((1024 + (i * 7919) % 3072)) "$dir/.blob" > "$d/f$j"
+            i=$((i + 1))
+            j=$((j + 1))
+        done
+    done
+}
+
+run() {
+    where=$1
+    base=$where/cp-tree-bench.$$
+    trap 'rm -rf "$base"' EXIT
+    mktree "$base/src" || return
+    for n in $THREADS; do
+        rm -rf "$base/dst"
+        sync
+        start=$(now)
+        "$CP" -r -j "$n" "$base/src" "$base/dst" || return
+        end=$(now)
+        ms=$(( (end - start) / 1000000 ))
+        [ "$ms" -gt 0 ] || ms=1
+        printf '%-12s %8d files %3d threads %8d ms %10d files/sec\n' \
+            "$where" "$FILES" "$n" "$ms" $(( FILES * 1000 / ms ))
+    done
+    rm -rf "$base"
+}
+
+[ -d "$SHM" ] && run "$SHM"
+run "$DISK"
@@ -1,22 +1,835 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-#define RDBUFLEN 4096
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define RDBUFLEN (1 << 20)  /* bytes per read, a multiple of any block */
+#define RANGELEN (1 << 30)  /* bytes per copy_file_range call */
+#define MAXTHREADS 256      /* workers of cp -r */
+#define MAXCHUNKTHREADS 32  /* workers of one file */
+#define CHUNKLEN (64 << 20) /* bytes of one file per worker at a time */
+#define MAPLEN (256 << 20)  /* bytes of the source mapped at a time */
+#define DIRECTLEN (8 << 20) /* bytes per O_DIRECT read, two in flight */
+#define DIRECTALIGN 4096    /* O_DIRECT offset, length and memory alignment */
+#define CRCXATTR "user.crc32c"  /* where --verify=xattr leaves the checksum */
+#define DELTABLK (64 << 10) /* --sync rewrites what differs in blocks of this */
 
 void usage() {
-    fprintf(stderr, "usage: cp <src-file> <dst-file>|<dst-dir>\n");
+    fprintf(stderr, "usage: cp [-r] [-j threads] [-c chunk-size] "
+                    "[-s auto|read4k|read|mmap|range|sendfile] [--direct] [--verify[=xattr]] "
+                    "[--update|--sync] "
+                    "<src> <dst-file>|<dst-dir>\n");
     exit(1);
 }
 
+int rflag;      /* recursive */
+int directflag; /* bypass the page cache */
+int verifyflag; /* 1: read the copy back, 2: store the checksum in CRCXATTR */
+int updateflag; /* skip a file when the copy has its size and mtime */
+int syncflag;   /* --update, and rewrite only the changed blocks of a file */
+int nthreads;   /* workers of cp -r or one file, 0 to pick */
+off_t chunklen = CHUNKLEN;
+
+/*
+ * how the data is copied, COPY_AUTO tries reflink, then
+ * copy_file_range, then read/write. the others are for measuring
+ */
+enum copy_strategy {
+    COPY_AUTO,
+    COPY_READ4K,    /* read/write of 4 KiB */
+    COPY_READ,      /* read/write of RDBUFLEN */
+    COPY_MMAP,      /* write from a mapping of the source */
+    COPY_RANGE,     /* copy_file_range */
+    COPY_SENDFILE,  /* sendfile, at the file offset so one thread */
+};
+const char* strategy_names[] = { "auto", "read4k", "read", "mmap", "range", "sendfile" };
+int strategy = COPY_AUTO;
+size_t rdbuflen = RDBUFLEN;
+int status;     /* exit status, 1 after a file is not copied */
+mode_t cmask;   /* umask, for the modes of the directories made by cp -r */
+
+/* per thread, cp -r copies files in several at once */
+__thread int norange;       /* copy_file_range is not supported between the files */
+__thread size_t blksize;    /* "file hole" granularity of the destination */
+__thread char* rdbuf;
+__thread uint32_t crc;      /* crc32c of the data copied so far, --verify */
+
+/*
+ * is p[0, len) all zero bytes
+ */
+int iszero_word(const char* p, size_t len) {
+    size_t i = 0;
+    for (; i + sizeof(long) <= len; i += sizeof(long)) {
+        long w;
+        memcpy(&w, p + i, sizeof(w));
+        if (w) return 0;
+    }
+    for (; i < len; i++) {
+        if (p[i]) return 0;
+    }
+    return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+int iszero_sse2(const char* p, size_t len) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i v = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i)),
+                         _mm_loadu_si128((const __m128i*)(p + i + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i + 32)),
+                         _mm_loadu_si128((const __m128i*)(p + i + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff) return 0;
+    }
+    return iszero_word(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+int iszero_avx2(const char* p, size_t len) {
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i v = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i)),
+                            _mm256_loadu_si256((const __m256i*)(p + i + 32))),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i + 64)),
+                            _mm256_loadu_si256((const __m256i*)(p + i + 96))));
+        if (!_mm256_testz_si256(v, v)) return 0;
+    }
+    return iszero_word(p + i, len - i);
+}
+#endif
+
+int (*iszero)(const char* p, size_t len) = iszero_word;
+
+void init_iszero() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) iszero = iszero_avx2;
+    else if (__builtin_cpu_supports("sse2")) iszero = iszero_sse2;
+#endif
+}
+
+/*
+ * crc32c (Castagnoli), without the inversion before and after
+ */
+uint32_t crc32c_table[256];
+
+uint32_t crc32c_table_update(uint32_t crc, const char* p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32c_table[(crc ^ (unsigned char)p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const char* p, size_t len) {
+    size_t i = 0;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        crc64 = _mm_crc32_u64(crc64, w);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; i + 4 <= len; i += 4) {
+        uint32_t w;
+        memcpy(&w, p + i, sizeof(w));
+        crc = _mm_crc32_u32(crc, w);
+    }
+    for (; i < len; i++) {
+        crc = _mm_crc32_u8(crc, (unsigned char)p[i]);
+    }
+    return crc;
+}
+#endif
+
+uint32_t (*crc32c_update)(uint32_t crc, const char* p, size_t len) = crc32c_table_update;
+
+void init_crc32c() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        crc32c_table[i] = c;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse4.2")) crc32c_update = crc32c_sse42;
+#endif
+}
+
+/* the read buffer of this thread, made on first use */
+void alloc_rdbuf() {
+    if (rdbuf == NULL && posix_memalign((void**)&rdbuf, 4096, RDBUFLEN) != 0) {
+        fprintf(stderr, "cp: malloc error for buffer\n");
+        exit(1);
+    }
+}
+
+/*
+ * copy [off, off + len) with read/write. a whole block of zero bytes
+ * becomes "file hole", the data between two holes is one write
+ */
+void copy_buffered(int srcfd, int dstfd, off_t off, off_t len,
+                   const char* srcpath, const char* dstpath) {
+    alloc_rdbuf();
+
+    while (len > 0) {
+        ssize_t rdcnt = pread(srcfd, rdbuf, len < (off_t)rdbuflen ? len : (off_t)rdbuflen, off);
+        if (rdcnt == 0) break;
+        if (rdcnt < 0) {
+            fprintf(stderr, "cp: read error for %s\n", srcpath);
+            exit(1);
+        }
+        if (verifyflag) crc = crc32c_update(crc, rdbuf, rdcnt);
+
+        size_t i = 0;
+        size_t wbeg = 0;    /* write begin */
+        while (i != (size_t)rdcnt) {
+            /* up to the next block boundary of the file */
+            size_t blk = blksize - (off + i) % blksize;
+            if (blk > (size_t)rdcnt - i) blk = rdcnt - i;
+
+            int hole = blk == blksize && iszero(rdbuf + i, blk);
+            if (hole || i + blk == (size_t)rdcnt) {
+                size_t wend = hole ? i : i + blk;
+                ssize_t writelen = wend - wbeg;
+                if (writelen > 0 &&
+                    pwrite(dstfd, rdbuf + wbeg, writelen, off + wbeg) != writelen) {
+                    fprintf(stderr, "cp: write error for %s\n", dstpath);
+                    exit(1);
+                }
+                wbeg = i + blk;
+            }
+            i += blk;
+        }
+        off += rdcnt;
+        len -= rdcnt;
+    }
+}
+
+/*
+ * copy [off, off + len) in the kernel, the rest falls back to
+ * copy_buffered() when the files do not allow it
+ */
+void copy_range(int srcfd, int dstfd, off_t off, off_t len,
+                const char* srcpath, const char* dstpath) {
+    while (len > 0 && !norange) {
+        off_t inoff = off;
+        off_t outoff = off;
+        ssize_t n = copy_file_range(srcfd, &inoff, dstfd, &outoff,
+                                    len < RANGELEN ? len : RANGELEN, 0);
+        if (n == 0) return;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+                errno != EOPNOTSUPP && errno != EPERM && errno != ETXTBSY) {
+                fprintf(stderr, "cp: copy error for %s: %s\n", dstpath, strerror(errno));
+                exit(1);
+            }
+            /* -s range measures copy_file_range, not the fallback */
+            if (strategy == COPY_RANGE) {
+                fprintf(stderr, "cp: copy_file_range from %s to %s: %s\n",
+                        srcpath, dstpath, strerror(errno));
+                exit(1);
+            }
+            norange = 1;
+            break;
+        }
+        off += n;
+        len -= n;
+    }
+    copy_buffered(srcfd, dstfd, off, len, srcpath, dstpath);
+}
+
+/*
+ * copy [off, off + len) with writes straight from a mapping of the
+ * source, MAPLEN at a time
+ */
+void copy_mmap(int srcfd, int dstfd, off_t off, off_t len,
+               const char* srcpath, const char* dstpath) {
+    off_t pagesize = sysconf(_SC_PAGESIZE);
+    while (len > 0) {
+        off_t mapoff = off / pagesize * pagesize;
+        size_t maplen = off - mapoff + (len < MAPLEN ? len : MAPLEN);
+        char* map = (char*)mmap(NULL, maplen, PROT_READ, MAP_SHARED, srcfd, mapoff);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "cp: mmap error for %s: %s\n", srcpath, strerror(errno));
+            exit(1);
+        }
+        madvise(map, maplen, MADV_SEQUENTIAL);
+        madvise(map, maplen, MADV_HUGEPAGE);
+
+        size_t done = off - mapoff;
+        while (done < maplen) {
+            ssize_t n = pwrite(dstfd, map + done, maplen - done, mapoff + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fprintf(stderr, "cp: write error for %s\n", dstpath);
+                exit(1);
+            }
+            done += n;
+        }
+        munmap(map, maplen);
+        len -= maplen - (off - mapoff);
+        off = mapoff + maplen;
+    }
+}
+
+/*
+ * copy [off, off + len) with sendfile, which writes at the file
+ * offset of dstfd
+ */
+void copy_sendfile(int srcfd, int dstfd, off_t off, off_t len,
+                   const char* srcpath, const char* dstpath) {
+    if (lseek(dstfd, off, SEEK_SET) < 0) {
+        fprintf(stderr, "cp: lseek error for %s\n", dstpath);
+        exit(1);
+    }
+    while (len > 0) {
+        ssize_t n = sendfile(dstfd, srcfd, &off, len < RANGELEN ? len : RANGELEN);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            fprintf(stderr, "cp: sendfile error from %s to %s: %s\n",
+                    srcpath, dstpath, strerror(errno));
+            exit(1);
+        }
+        if (n == 0) break;
+        len -= n;
+    }
+}
+
+void copy_data(int srcfd, int dstfd, off_t off, off_t len,
+               const char* srcpath, const char* dstpath) {
+    switch (strategy) {
+        case COPY_READ4K:
+        case COPY_READ:
+            copy_buffered(srcfd, dstfd, off, len, srcpath, dstpath);
+            break;
+        case COPY_MMAP:
+            copy_mmap(srcfd, dstfd, off, len, srcpath, dstpath);
+            break;
+        case COPY_SENDFILE:
+            copy_sendfile(srcfd, dstfd, off, len, srcpath, dstpath);
+            break;
+        default:
+            copy_range(srcfd, dstfd, off, len, srcpath, dstpath);
+            break;
+    }
+}
+
+/* blksize of dstfd, a power of 2 that fits the read buffer */
+void init_blksize(int dstfd) {
+    struct stat dststat;
+    blksize = 4096;
+    if (fstat(dstfd, &dststat) == 0 && dststat.st_blksize >= 512 &&
+        dststat.st_blksize <= RDBUFLEN && (dststat.st_blksize & (dststat.st_blksize - 1)) == 0) {
+        blksize = dststat.st_blksize;
+    }
+}
+
 /*
- * can copy "file hole"
+ * copy the data extents of [off, end), "file hole" is found with
+ * SEEK_DATA/SEEK_HOLE and never touched
  */
+void copy_extents(int srcfd, int dstfd, off_t off, off_t end,
+                  const char* srcpath, const char* dstpath) {
+    norange = 0;
+    init_blksize(dstfd);
+
+    while (off < end) {
+        off_t data = lseek(srcfd, off, SEEK_DATA);
+        off_t hole = end;
+        if (data < 0 && errno == ENXIO) break;  /* a hole up to the end */
+        if (data < 0) {
+            /* no SEEK_DATA here: all of it is data */
+            data = off;
+        } else if ((hole = lseek(srcfd, data, SEEK_HOLE)) < 0 || hole > end) {
+            hole = end;
+        }
+        if (data >= end) break;
+
+        copy_data(srcfd, dstfd, data, hole - data, srcpath, dstpath);
+        off = hole;
+    }
+}
+
+/*
+ * one file cut in chunklen pieces, the workers take the next piece
+ * until none is left
+ */
+typedef struct cpchunks cpchunks;
+struct cpchunks {
+    int srcfd;
+    int dstfd;
+    off_t size;
+    atomic_long next;
+    const char* srcpath;
+    const char* dstpath;
+};
+
+void* chunk_worker(void* arg) {
+    cpchunks* chunks = (cpchunks*)arg;
+    off_t off;
+    while ((off = atomic_fetch_add(&chunks->next, 1) * chunklen) < chunks->size) {
+        off_t len = chunks->size - off < chunklen ? chunks->size - off : chunklen;
+        posix_fadvise(chunks->srcfd, off, len, POSIX_FADV_WILLNEED);
+        copy_extents(chunks->srcfd, chunks->dstfd, off, off + len,
+                     chunks->srcpath, chunks->dstpath);
+        /* start the writeback now, what is clean leaves the cache */
+        sync_file_range(chunks->dstfd, off, len, SYNC_FILE_RANGE_WRITE);
+        posix_fadvise(chunks->dstfd, off, len, POSIX_FADV_DONTNEED);
+    }
+    free(rdbuf);
+    rdbuf = NULL;
+    return NULL;
+}
+
+/*
+ * requests the block device of fd can have in flight, 0 when it is
+ * not a block device (tmpfs, nfs)
+ */
+int queue_depth(int fd) {
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0 || major(statbuf.st_dev) == 0) return 0;
+
+    /* a partition has the queue of its disk */
+    char path[PATH_MAX];
+    FILE* fp = NULL;
+    for (int i = 0; i < 2 && fp == NULL; i++) {
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%squeue/nr_requests",
+                 major(statbuf.st_dev), minor(statbuf.st_dev), i ? "../" : "");
+        fp = fopen(path, "r");
+    }
+    int depth = 0;
+    if (fp) {
+        if (fscanf(fp, "%d", &depth) != 1) depth = 0;
+        fclose(fp);
+    }
+    return depth;
+}
+
+/*
+ * workers for one file: -j, else enough to keep the shallower
+ * device queue busy with copies of chunklen, else one per cpu
+ */
+int chunk_threads(int srcfd, int dstfd) {
+    int n = nthreads;
+    if (n <= 0) {
+        int srcdepth = queue_depth(srcfd);
+        int dstdepth = queue_depth(dstfd);
+        int depth = srcdepth && dstdepth ? (srcdepth < dstdepth ? srcdepth : dstdepth)
+                                         : srcdepth + dstdepth;
+        n = depth ? depth / 16 : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (n < 1) n = 1;
+    if (n > MAXCHUNKTHREADS) n = MAXCHUNKTHREADS;
+    return n;
+}
+
+void copy_chunked(int srcfd, int dstfd, off_t size, int threads,
+                  const char* srcpath, const char* dstpath) {
+    /* a sparse file stays sparse, else the blocks are reserved at once */
+    struct stat statbuf;
+    if (fstat(srcfd, &statbuf) == 0 && (off_t)statbuf.st_blocks * 512 >= size) {
+        fallocate(dstfd, 0, 0, size);
+    }
+    posix_fadvise(srcfd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+    cpchunks chunks;
+    chunks.srcfd = srcfd;
+    chunks.dstfd = dstfd;
+    chunks.size = size;
+    atomic_init(&chunks.next, 0);
+    chunks.srcpath = srcpath;
+    chunks.dstpath = dstpath;
+
+    pthread_t tids[MAXCHUNKTHREADS];
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&tids[started], NULL, chunk_worker, &chunks) == 0) {
+        started++;
+    }
+    if (started == 0) chunk_worker(&chunks);
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+/*
+ * --direct: the main thread reads DIRECTLEN at a time while a writer
+ * thread writes the previous block, both with O_DIRECT
+ */
+typedef struct cpdirect cpdirect;
+struct cpdirect {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char* bufs[2];
+    ssize_t lens[2];    /* bytes read into bufs[i], -1 when it is free */
+    off_t offs[2];
+    int eof;            /* no more reads */
+    int dstfd;
+    const char* dstpath;
+};
+
+void direct_write(cpdirect* direct, const char* buf, size_t len, off_t off) {
+    size_t aligned = len / DIRECTALIGN * DIRECTALIGN;
+    size_t i = 0;
+    while (i < aligned) {
+        /* whole zero blocks stay "file hole" */
+        size_t wbeg = i;
+        while (i < aligned && !iszero(buf + i, DIRECTALIGN)) i += DIRECTALIGN;
+        ssize_t writelen = i - wbeg;
+        if (writelen > 0 &&
+            pwrite(direct->dstfd, buf + wbeg, writelen, off + wbeg) != writelen) {
+            fprintf(stderr, "cp: write error for %s: %s\n", direct->dstpath, strerror(errno));
+            exit(1);
+        }
+        while (i < aligned && iszero(buf + i, DIRECTALIGN)) i += DIRECTALIGN;
+    }
+
+    /* the unaligned tail of the file goes through the page cache */
+    if (len > aligned) {
+        int flags = fcntl(direct->dstfd, F_GETFL);
+        fcntl(direct->dstfd, F_SETFL, flags & ~O_DIRECT);
+        ssize_t writelen = len - aligned;
+        if (pwrite(direct->dstfd, buf + aligned, writelen, off + aligned) != writelen) {
+            fprintf(stderr, "cp: write error for %s: %s\n", direct->dstpath, strerror(errno));
+            exit(1);
+        }
+        fdatasync(direct->dstfd);
+        posix_fadvise(direct->dstfd, off + aligned, writelen, POSIX_FADV_DONTNEED);
+        fcntl(direct->dstfd, F_SETFL, flags);
+    }
+}
+
+void* direct_writer(void* arg) {
+    cpdirect* direct = (cpdirect*)arg;
+    for (int i = 0; ; i ^= 1) {
+        pthread_mutex_lock(&direct->lock);
+        while (direct->lens[i] < 0 && !direct->eof) {
+            pthread_cond_wait(&direct->cond, &direct->lock);
+        }
+        if (direct->lens[i] < 0) {
+            pthread_mutex_unlock(&direct->lock);
+            break;
+        }
+        pthread_mutex_unlock(&direct->lock);
+
+        direct_write(direct, direct->bufs[i], direct->lens[i], direct->offs[i]);
+
+        pthread_mutex_lock(&direct->lock);
+        direct->lens[i] = -1;
+        pthread_cond_signal(&direct->cond);
+        pthread_mutex_unlock(&direct->lock);
+    }
+    return NULL;
+}
+
+void copy_direct(int srcfd, int dstfd, off_t size, const char* srcpath, const char* dstpath) {
+    cpdirect direct;
+    pthread_mutex_init(&direct.lock, NULL);
+    pthread_cond_init(&direct.cond, NULL);
+    direct.eof = 0;
+    direct.dstfd = dstfd;
+    direct.dstpath = dstpath;
+    for (int i = 0; i < 2; i++) {
+        if (posix_memalign((void**)&direct.bufs[i], DIRECTALIGN, DIRECTLEN) != 0) {
+            fprintf(stderr, "cp: malloc error for buffer\n");
+            exit(1);
+        }
+        direct.lens[i] = -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, direct_writer, &direct) != 0) {
+        fprintf(stderr, "cp: pthread_create error\n");
+        exit(1);
+    }
+
+    off_t off = 0;
+    for (int i = 0; off < size; i ^= 1) {
+        pthread_mutex_lock(&direct.lock);
+        while (direct.lens[i] >= 0) pthread_cond_wait(&direct.cond, &direct.lock);
+        pthread_mutex_unlock(&direct.lock);
+
+        ssize_t rdcnt = pread(srcfd, direct.bufs[i], DIRECTLEN, off);
+        if (rdcnt < 0 && errno == EINTR) {
+            i ^= 1;
+            continue;
+        }
+        if (rdcnt < 0) {
+            fprintf(stderr, "cp: read error for %s: %s\n", srcpath, strerror(errno));
+            exit(1);
+        }
+        if (rdcnt == 0) break;
+        /* while the writer has the other buffer */
+        if (verifyflag) crc = crc32c_update(crc, direct.bufs[i], rdcnt);
+
+        pthread_mutex_lock(&direct.lock);
+        direct.offs[i] = off;
+        direct.lens[i] = rdcnt;
+        pthread_cond_signal(&direct.cond);
+        pthread_mutex_unlock(&direct.lock);
+        off += rdcnt;
+    }
+
+    pthread_mutex_lock(&direct.lock);
+    direct.eof = 1;
+    pthread_cond_signal(&direct.cond);
+    pthread_mutex_unlock(&direct.lock);
+    pthread_join(tid, NULL);
+
+    free(direct.bufs[0]);
+    free(direct.bufs[1]);
+    pthread_mutex_destroy(&direct.lock);
+    pthread_cond_destroy(&direct.cond);
+}
+
+/*
+ * --direct where O_DIRECT is not supported: a chunk at a time is
+ * copied, written back and dropped from the page cache
+ */
+void copy_dontneed(int srcfd, int dstfd, off_t size, const char* srcpath, const char* dstpath) {
+    for (off_t off = 0; off < size; off += DIRECTLEN) {
+        off_t len = size - off < DIRECTLEN ? size - off : DIRECTLEN;
+        copy_extents(srcfd, dstfd, off, off + len, srcpath, dstpath);
+        sync_file_range(dstfd, off, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+                        SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(srcfd, off, len, POSIX_FADV_DONTNEED);
+        posix_fadvise(dstfd, off, len, POSIX_FADV_DONTNEED);
+    }
+}
+
+/*
+ * set O_DIRECT on both fds, return 0, or -1 when one of the files
+ * does not take it
+ */
+int set_direct(int srcfd, int dstfd) {
+    int srcflags = fcntl(srcfd, F_GETFL);
+    int dstflags = fcntl(dstfd, F_GETFL);
+    if (srcflags < 0 || dstflags < 0 || fcntl(srcfd, F_SETFL, srcflags | O_DIRECT) < 0) {
+        return -1;
+    }
+    if (fcntl(dstfd, F_SETFL, dstflags | O_DIRECT) < 0) {
+        fcntl(srcfd, F_SETFL, srcflags);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * --verify: check the copy against crc with one read of the
+ * destination, O_DIRECT when the file takes it, else after dropping
+ * it from the page cache. --verify=xattr stores crc instead
+ */
+void verify_copy(int dstfd, off_t size, const char* dstpath) {
+    if (verifyflag == 2) {
+        char hex[9];
+        snprintf(hex, sizeof(hex), "%08x", ~crc);
+        if (fsetxattr(dstfd, CRCXATTR, hex, 8, 0) < 0) {
+            fprintf(stderr, "cp: setxattr error for %s: %s\n", dstpath, strerror(errno));
+            status = 1;
+        }
+        return;
+    }
+
+    int flags = fcntl(dstfd, F_GETFL);
+    if (fcntl(dstfd, F_SETFL, flags | O_DIRECT) < 0) {
+        fdatasync(dstfd);
+        posix_fadvise(dstfd, 0, size, POSIX_FADV_DONTNEED);
+    }
+
+    char* buf;
+    if (posix_memalign((void**)&buf, DIRECTALIGN, DIRECTLEN) != 0) {
+        fprintf(stderr, "cp: malloc error for buffer\n");
+        exit(1);
+    }
+    uint32_t dstcrc = 0xffffffff;
+    off_t off = 0;
+    while (off < size) {
+        ssize_t rdcnt = pread(dstfd, buf, DIRECTLEN, off);
+        if (rdcnt < 0 && errno == EINTR) continue;
+        if (rdcnt <= 0) break;
+        dstcrc = crc32c_update(dstcrc, buf, rdcnt);
+        off += rdcnt;
+    }
+    free(buf);
+    fcntl(dstfd, F_SETFL, flags);
+
+    if (off != size || dstcrc != crc) {
+        fprintf(stderr, "cp: verify error for %s: crc32c %08x, copy %08x\n",
+                dstpath, ~crc, ~dstcrc);
+        status = 1;
+    }
+}
+
+/*
+ * --sync: read both files and rewrite only the blocks of DELTABLK
+ * that differ, the rest of the copy is not written at all
+ */
+void copy_delta(int srcfd, int dstfd, off_t size, const char* srcpath, const char* dstpath) {
+    alloc_rdbuf();
+    char* dstbuf;
+    if (posix_memalign((void**)&dstbuf, 4096, RDBUFLEN) != 0) {
+        fprintf(stderr, "cp: malloc error for buffer\n");
+        exit(1);
+    }
+    posix_fadvise(srcfd, 0, size, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(dstfd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+    for (off_t off = 0; off < size; ) {
+        ssize_t rdcnt = pread(srcfd, rdbuf, RDBUFLEN, off);
+        if (rdcnt < 0 && errno == EINTR) continue;
+        if (rdcnt < 0) {
+            fprintf(stderr, "cp: read error for %s\n", srcpath);
+            exit(1);
+        }
+        if (rdcnt == 0) break;
+        /* past the end of the old copy nothing matches */
+        ssize_t dstcnt = pread(dstfd, dstbuf, rdcnt, off);
+        if (dstcnt < 0) dstcnt = 0;
+
+        size_t i = 0;
+        while (i < (size_t)rdcnt) {
+            size_t wbeg = i;    /* write begin */
+            while (i < (size_t)rdcnt) {
+                size_t blk = (size_t)rdcnt - i < DELTABLK ? (size_t)rdcnt - i : DELTABLK;
+                if (i + blk <= (size_t)dstcnt && memcmp(rdbuf + i, dstbuf + i, blk) == 0) break;
+                i += blk;
+            }
+            ssize_t writelen = i - wbeg;
+            if (writelen > 0 &&
+                pwrite(dstfd, rdbuf + wbeg, writelen, off + wbeg) != writelen) {
+                fprintf(stderr, "cp: write error for %s\n", dstpath);
+                exit(1);
+            }
+            /* skip the blocks that are the same */
+            while (i < (size_t)rdcnt) {
+                size_t blk = (size_t)rdcnt - i < DELTABLK ? (size_t)rdcnt - i : DELTABLK;
+                if (i + blk > (size_t)dstcnt || memcmp(rdbuf + i, dstbuf + i, blk) != 0) break;
+                i += blk;
+            }
+        }
+        off += rdcnt;
+    }
+    free(dstbuf);
+}
+
+/*
+ * --update: does dst in dirfd have the size and mtime of srcfd
+ */
+int unchanged(int srcfd, int dirfd, const char* dst) {
+    struct statx srcstat;
+    struct statx dststat;
+    if (statx(srcfd, "", AT_EMPTY_PATH, STATX_SIZE | STATX_MTIME, &srcstat) < 0 ||
+        statx(dirfd, dst, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_SIZE | STATX_MTIME, &dststat) < 0) {
+        return 0;
+    }
+    return S_ISREG(dststat.stx_mode) &&
+           srcstat.stx_size == dststat.stx_size &&
+           srcstat.stx_mtime.tv_sec == dststat.stx_mtime.tv_sec &&
+           srcstat.stx_mtime.tv_nsec == dststat.stx_mtime.tv_nsec;
+}
+
+/*
+ * is dst in dirfd the file of srcfd, which opening it with O_TRUNC
+ * would empty
+ */
+int same_file(int srcfd, int dirfd, const char* dst) {
+    struct stat srcstat;
+    struct stat dststat;
+    return fstat(srcfd, &srcstat) == 0 && fstatat(dirfd, dst, &dststat, 0) == 0 &&
+           srcstat.st_dev == dststat.st_dev && srcstat.st_ino == dststat.st_ino;
+}
+
+/*
+ * flags to open a destination with, --sync keeps the old data to
+ * compare with
+ */
+int dst_flags() {
+    return (verifyflag || syncflag ? O_RDWR : O_WRONLY) |
+           (syncflag ? 0 : O_TRUNC) | O_CREAT;
+}
+
+/*
+ * fastest first: share the extents (reflink), then copy the data
+ * extents in the kernel, then read/write. a file of several chunks
+ * is copied by up to threads workers. --direct keeps the data out
+ * of the page cache instead, --verify reads and writes it itself to
+ * see all of it, --sync writes only what changed
+ */
+void copy_fd(int srcfd, int dstfd, off_t size, int threads,
+             const char* srcpath, const char* dstpath) {
+    /* an old copy of --sync, only worth reading when it is big */
+    struct stat dststat;
+    int delta = syncflag && !verifyflag && fstat(dstfd, &dststat) == 0 &&
+                dststat.st_size >= RDBUFLEN;
+    if (syncflag && !delta && ftruncate(dstfd, 0) < 0) {
+        fprintf(stderr, "cp: truncate error for %s\n", dstpath);
+        exit(1);
+    }
+
+    crc = 0xffffffff;
+    if (delta) {
+        copy_delta(srcfd, dstfd, size, srcpath, dstpath);
+    } else if (strategy == COPY_AUTO && !verifyflag && ioctl(dstfd, FICLONE, srcfd) == 0) {
+        /* shares the extents, nothing to copy */
+    } else if (directflag && set_direct(srcfd, dstfd) == 0) {
+        copy_direct(srcfd, dstfd, size, srcpath, dstpath);
+    } else if (verifyflag) {
+        /* all of the data, holes too, passes the checksum in order */
+        init_blksize(dstfd);
+        copy_buffered(srcfd, dstfd, 0, size, srcpath, dstpath);
+    } else if (directflag) {
+        copy_dontneed(srcfd, dstfd, size, srcpath, dstpath);
+    } else if (threads > 1 && size >= 2 * chunklen && strategy != COPY_SENDFILE) {
+        copy_chunked(srcfd, dstfd, size, threads, srcpath, dstpath);
+    } else {
+        copy_extents(srcfd, dstfd, 0, size, srcpath, dstpath);
+    }
+
+    /* a "file hole" at the end has no data to write */
+    if (ftruncate(dstfd, size) < 0) {
+        fprintf(stderr, "cp: truncate error for %s\n", dstpath);
+        exit(1);
+    }
+    if (verifyflag) verify_copy(dstfd, size, dstpath);
+
+    /* what --update compares on the next run */
+    struct stat srcstat;
+    if (updateflag && fstat(srcfd, &srcstat) == 0) {
+        struct timespec times[2] = { srcstat.st_atim, srcstat.st_mtim };
+        fchmod(dstfd, srcstat.st_mode & 07777);
+        futimens(dstfd, times);
+    }
+}
+
 void ftof(const char* srcpath, const char* dstpath) {
     struct stat statbuf;
     if (stat(srcpath, &statbuf) < 0) {
@@ -36,68 +849,57 @@ void ftof(const char* srcpath, const char* dstpath) {
         exit(1);
     }
 
-    int dstfd;
-    if ((dstfd = open(dstpath, O_WRONLY | O_TRUNC | O_CREAT, 0777)) < 0) {
-        fprintf(stderr, "cp: open error for %s\n", dstpath);
+    if (same_file(srcfd, AT_FDCWD, dstpath)) {
+        fprintf(stderr, "cp: %s and %s are the same file\n", srcpath, dstpath);
         exit(1);
     }
-
-    char buf[RDBUFLEN + 1];
-    ssize_t rdcnt = 0;
-    while ((rdcnt = read(srcfd, buf, RDBUFLEN)) > 0) {
-        buf[RDBUFLEN] = '\0';
-
-        size_t i = 0;
-        size_t wbeg = 0;    /* write begin */
-        size_t lbeg = 0;    /* lseek begin */
-        while (i != (size_t)rdcnt) {
-            if (buf[i] != 0) {
-                wbeg = i;
-                /* loop util encounter a 'file hole' */
-                while (i != (size_t)rdcnt && buf[i] != '\0') ++i;
-                ssize_t writelen = i - wbeg;
-                if (write(dstfd, buf + wbeg, writelen) != writelen) {
-                    fprintf(stderr, "cp: write error for %s\n", dstpath);
-                    exit(1);
-                }
-            }
-
-            lbeg = i;
-            /* loop util encounter a 'character' */
-            while (i != (size_t)rdcnt && buf[i] == '\0') ++i;
-            ssize_t lseeklen = i - lbeg;
-            if (lseek(dstfd, lseeklen, SEEK_CUR) == -1) {
-                fprintf(stderr, "cp: lseek error for %s\n", strerror(errno));
-                exit(0);
-            }
-        }
+    if (updateflag && unchanged(srcfd, AT_FDCWD, dstpath)) {
+        close(srcfd);
+        return;
     }
 
-    if (-1 == rdcnt) {
-        fprintf(stderr, "cp: read error for %s\n", srcpath);
+    int dstfd;
+    if ((dstfd = open(dstpath, dst_flags(), 0777)) < 0) {
+        fprintf(stderr, "cp: open error for %s\n", dstpath);
         exit(1);
     }
 
+    copy_fd(srcfd, dstfd, statbuf.st_size, chunk_threads(srcfd, dstfd), srcpath, dstpath);
+
     close(srcfd);
     close(dstfd);
 }
 
-void ftodir(const char* fpath, const char* dirpath) {
-    const char* basename = strchr(fpath, '/');
-    if (basename == NULL) basename = fpath;
-    else basename += 1;
+const char* basename_of(const char* path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') --len;
+    const char* base = path + len;
+    while (base != path && base[-1] != '/') --base;
+    return base;
+}
 
-    char* dstpath = (char*)malloc(strlen(dirpath) + strlen(basename) + 2);
-    dstpath[0] = 0;
-    strcpy(dstpath, dirpath);
-    if (dstpath[strlen(dstpath) - 1] != '/') strcat(dstpath, "/");
-    strcat(dstpath, basename);
-    /* just link */
-    if (link(fpath, dstpath)) {
-        fprintf(stderr, "cp: link error for %s\n", strerror(errno));
-        free(dstpath);
+/* dir + "/" + name */
+char* joinpath(const char* dir, const char* name, size_t namelen) {
+    size_t dirlen = strlen(dir);
+    char* path = (char*)malloc(dirlen + namelen + 2);
+    if (path == NULL) {
+        fprintf(stderr, "cp: malloc error for pathname\n");
         exit(1);
     }
+    memcpy(path, dir, dirlen);
+    if (dirlen == 0 || path[dirlen - 1] != '/') path[dirlen++] = '/';
+    memcpy(path + dirlen, name, namelen);
+    path[dirlen + namelen] = '\0';
+    return path;
+}
+
+void ftodir(const char* fpath, const char* dirpath) {
+    const char* base = basename_of(fpath);
+    size_t len = strlen(base);
+    while (len > 1 && base[len - 1] == '/') --len;
+
+    char* dstpath = joinpath(dirpath, base, len);
+    ftof(fpath, dstpath);
     free(dstpath);
 }
 
@@ -126,13 +928,436 @@ void docopy(const char* srcpath, const char* dstpath) {
     }
 }
 
+/*
+ * cp -r: a directory holds its open fds while its files are waiting,
+ * the files are opened and created relative to them
+ */
+typedef struct cpdir cpdir;
+struct cpdir {
+    int srcfd;
+    int dstfd;
+    char* src;
+    char* dst;
+    mode_t mode;    /* of dst once its entries are in, or (mode_t)-1 */
+    atomic_int refs;
+};
+
+/*
+ * a file of dir when dst is NULL, else a directory in dir, which
+ * is held until the directory is open (dir is NULL for the top one)
+ */
+typedef struct cpjob cpjob;
+struct cpjob {
+    cpdir* dir;
+    char* src;      /* name in dir, or path of the directory */
+    char* dst;      /* path of the existing destination directory */
+    mode_t mode;    /* for cpdir.mode */
+};
+
+/*
+ * the jobs of one worker: the owner pushes and pops at the tail,
+ * the others steal the oldest job at the head
+ */
+typedef struct cpqueue cpqueue;
+struct cpqueue {
+    pthread_mutex_t lock;
+    cpjob* jobs;
+    size_t head;
+    size_t tail;
+    size_t cap;
+};
+
+cpqueue queues[MAXTHREADS];
+int nqueues;
+atomic_long pending;        /* jobs queued or running */
+atomic_int idle;            /* workers waiting for a job */
+pthread_mutex_t idlelock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t idlecond = PTHREAD_COND_INITIALIZER;
+__thread int self;          /* queue of this worker */
+
+void push_job(cpdir* dir, char* src, char* dst, mode_t mode) {
+    atomic_fetch_add(&pending, 1);
+
+    cpqueue* q = &queues[self];
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->cap) {
+        if (q->head > q->cap / 2) {
+            memmove(q->jobs, q->jobs + q->head, (q->tail - q->head) * sizeof(cpjob));
+            q->tail -= q->head;
+            q->head = 0;
+        } else {
+            q->cap = q->cap ? q->cap * 2 : 64;
+            q->jobs = (cpjob*)realloc(q->jobs, q->cap * sizeof(cpjob));
+            if (q->jobs == NULL) {
+                fprintf(stderr, "cp: malloc error for jobs\n");
+                exit(1);
+            }
+        }
+    }
+    q->jobs[q->tail].dir = dir;
+    q->jobs[q->tail].src = src;
+    q->jobs[q->tail].dst = dst;
+    q->jobs[q->tail].mode = mode;
+    q->tail++;
+    pthread_mutex_unlock(&q->lock);
+
+    if (atomic_load(&idle) > 0) {
+        pthread_mutex_lock(&idlelock);
+        pthread_cond_signal(&idlecond);
+        pthread_mutex_unlock(&idlelock);
+    }
+}
+
+/*
+ * the newest job of our own queue, else the oldest of another,
+ * return 0 when there is none
+ */
+int take_job(cpjob* job) {
+    for (int i = 0; i < nqueues; i++) {
+        cpqueue* q = &queues[(self + i) % nqueues];
+        pthread_mutex_lock(&q->lock);
+        if (q->tail != q->head) {
+            *job = i == 0 ? q->jobs[--q->tail] : q->jobs[q->head++];
+            if (q->tail == q->head) q->head = q->tail = 0;
+            pthread_mutex_unlock(&q->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    return 0;
+}
+
+void unref_dir(cpdir* dir) {
+    if (atomic_fetch_sub(&dir->refs, 1) != 1) return;
+    /* made with rwx for the owner, now it gets the mode of src */
+    struct stat statbuf;
+    if (dir->mode != (mode_t)-1 && dir->dstfd >= 0 &&
+        (fstat(dir->dstfd, &statbuf) < 0 ||
+         fchmod(dir->dstfd, dir->mode | (statbuf.st_mode & S_ISGID)) < 0)) {
+        fprintf(stderr, "cp: chmod error for %s: %s\n", dir->dst, strerror(errno));
+        status = 1;
+    }
+    close(dir->srcfd);
+    close(dir->dstfd);
+    free(dir->src);
+    free(dir->dst);
+    free(dir);
+}
+
+void copy_entry(cpdir* dir, const char* name) {
+    char* srcpath = joinpath(dir->src, name, strlen(name));
+    char* dstpath = joinpath(dir->dst, name, strlen(name));
+
+    struct stat statbuf;
+    int srcfd = openat(dir->srcfd, name, O_RDONLY | O_NOFOLLOW);
+    if (srcfd < 0 || fstat(srcfd, &statbuf) < 0) {
+        fprintf(stderr, "cp: open error for %s\n", srcpath);
+        status = 1;
+    } else if (same_file(srcfd, dir->dstfd, name)) {
+        fprintf(stderr, "cp: %s and %s are the same file\n", srcpath, dstpath);
+        status = 1;
+    } else if (updateflag && unchanged(srcfd, dir->dstfd, name)) {
+        /* the copy is up to date */
+    } else {
+        int dstfd = openat(dir->dstfd, name, dst_flags(), statbuf.st_mode & 07777);
+        if (dstfd < 0) {
+            fprintf(stderr, "cp: open error for %s\n", dstpath);
+            status = 1;
+        } else {
+            /* the files of the tree are the parallelism */
+            copy_fd(srcfd, dstfd, statbuf.st_size, 1, srcpath, dstpath);
+            close(dstfd);
+        }
+    }
+    if (srcfd >= 0) close(srcfd);
+    free(srcpath);
+    free(dstpath);
+}
+
+void copy_link(cpdir* dir, const char* name) {
+    char target[PATH_MAX];
+    ssize_t len = readlinkat(dir->srcfd, name, target, sizeof(target) - 1);
+    if (len >= 0) {
+        target[len] = '\0';
+        unlinkat(dir->dstfd, name, 0);
+    }
+    if (len < 0 || symlinkat(target, dir->dstfd, name) < 0) {
+        fprintf(stderr, "cp: symlink error for %s/%s: %s\n", dir->dst, name, strerror(errno));
+        status = 1;
+    }
+}
+
+/*
+ * queue the entries of directory src, dst exists already and gets
+ * mode when they are done; src and dst are opened relative to
+ * parent, which is released once they are open
+ */
+void copy_dir(cpdir* parent, char* src, char* dst, mode_t mode) {
+    cpdir* dir = (cpdir*)malloc(sizeof(cpdir));
+    if (dir == NULL) {
+        fprintf(stderr, "cp: malloc error for directory\n");
+        exit(1);
+    }
+    dir->src = src;
+    dir->dst = dst;
+    dir->mode = mode;
+    atomic_init(&dir->refs, 1);
+    if (parent) {
+        /* relative to the parent, no path walk per directory */
+        const char* name = strrchr(src, '/') + 1;
+        dir->srcfd = openat(parent->srcfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        dir->dstfd = openat(parent->dstfd, name, O_RDONLY | O_DIRECTORY);
+        unref_dir(parent);
+    } else {
+        dir->srcfd = open(src, O_RDONLY | O_DIRECTORY);
+        dir->dstfd = open(dst, O_RDONLY | O_DIRECTORY);
+    }
+
+    DIR* dp = NULL;
+    int fd;
+    if (dir->srcfd < 0 || dir->dstfd < 0 ||
+        (fd = openat(dir->srcfd, ".", O_RDONLY | O_DIRECTORY)) < 0 ||
+        (dp = fdopendir(fd)) == NULL) {
+        fprintf(stderr, "cp: open error for %s: %s\n", dir->srcfd < 0 ? src : dst, strerror(errno));
+        status = 1;
+    }
+
+    struct dirent* entry;
+    while (dp && (entry = readdir(dp)) != NULL) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        struct stat statbuf;
+        if (fstatat(dir->srcfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) < 0) {
+            fprintf(stderr, "cp: stat error for %s/%s\n", src, name);
+            status = 1;
+        } else if (S_ISDIR(statbuf.st_mode)) {
+            /* owner keeps rwx so the files can go in */
+            mode_t mode = statbuf.st_mode & 07777;
+            if (mkdirat(dir->dstfd, name, mode | S_IRWXU) == 0) {
+                /* what mkdir(2) makes of mode, setgid comes from the parent */
+                mode &= 01777 & ~cmask;
+            } else if (errno == EEXIST) {
+                mode = (mode_t)-1;
+            } else {
+                fprintf(stderr, "cp: mkdir error for %s/%s: %s\n", dst, name, strerror(errno));
+                status = 1;
+                continue;
+            }
+            atomic_fetch_add(&dir->refs, 1);
+            push_job(dir, joinpath(src, name, strlen(name)), joinpath(dst, name, strlen(name)), mode);
+        } else if (S_ISREG(statbuf.st_mode)) {
+            atomic_fetch_add(&dir->refs, 1);
+            push_job(dir, strdup(name), NULL, 0);
+        } else if (S_ISLNK(statbuf.st_mode)) {
+            copy_link(dir, name);
+        } else {
+            fprintf(stderr, "cp: %s/%s is not a regular file\n", src, name);
+            status = 1;
+        }
+    }
+    if (dp) closedir(dp);
+    unref_dir(dir);
+}
+
+void* worker(void* arg) {
+    self = (int)(long)arg;
+    while (1) {
+        cpjob job;
+        if (take_job(&job)) {
+            if (job.dst == NULL) {
+                copy_entry(job.dir, job.src);
+                unref_dir(job.dir);
+                free(job.src);
+            } else {
+                copy_dir(job.dir, job.src, job.dst, job.mode);
+            }
+            if (atomic_fetch_sub(&pending, 1) == 1) {
+                pthread_mutex_lock(&idlelock);
+                pthread_cond_broadcast(&idlecond);
+                pthread_mutex_unlock(&idlelock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&idlelock);
+        if (atomic_load(&pending) == 0) {
+            pthread_mutex_unlock(&idlelock);
+            break;
+        }
+        /* a push may miss the signal, look again soon anyway */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        atomic_fetch_add(&idle, 1);
+        pthread_cond_timedwait(&idlecond, &idlelock, &ts);
+        atomic_fetch_sub(&idle, 1);
+        pthread_mutex_unlock(&idlelock);
+    }
+    free(rdbuf);
+    rdbuf = NULL;
+    return NULL;
+}
+
+void copytree(const char* srcpath, const char* dstpath) {
+    struct stat statbuf;
+    if (stat(srcpath, &statbuf) < 0) {
+        fprintf(stderr, "cp: stat error for %s\n", srcpath);
+        exit(1);
+    }
+    if (!S_ISDIR(statbuf.st_mode)) {
+        docopy(srcpath, dstpath);
+        return;
+    }
+
+    /* into dst when it is a directory, else as dst */
+    struct stat dststat;
+    int intodir = stat(dstpath, &dststat) == 0 && S_ISDIR(dststat.st_mode);
+
+    /* the copy must not be walked into */
+    char realsrc[PATH_MAX];
+    char realdst[PATH_MAX];
+    char* parent;
+    if (intodir) {
+        parent = strdup(dstpath);
+    } else {
+        const char* base = basename_of(dstpath);
+        parent = base == dstpath ? strdup(".") : strndup(dstpath, base - dstpath);
+    }
+    if (realpath(srcpath, realsrc) && realpath(parent, realdst)) {
+        size_t srclen = strlen(realsrc);
+        if (strncmp(realsrc, realdst, srclen) == 0 &&
+            (realdst[srclen] == '/' || realdst[srclen] == '\0' || srclen == 1)) {
+            fprintf(stderr, "cp: cannot copy %s into itself\n", srcpath);
+            exit(1);
+        }
+    }
+    free(parent);
+
+    char* target;
+    if (intodir) {
+        const char* base = basename_of(srcpath);
+        size_t len = strlen(base);
+        while (len > 1 && base[len - 1] == '/') --len;
+        target = joinpath(dstpath, base, len);
+    } else {
+        target = strdup(dstpath);
+    }
+    cmask = umask(0);
+    umask(cmask);
+    mode_t mode = statbuf.st_mode & 07777;
+    if (mkdir(target, mode | S_IRWXU) == 0) {
+        mode &= 01777 & ~cmask;
+    } else if (errno == EEXIST) {
+        mode = (mode_t)-1;
+    } else {
+        fprintf(stderr, "cp: mkdir error for %s: %s\n", target, strerror(errno));
+        exit(1);
+    }
+
+    /* a directory fd per directory being copied */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    nqueues = nthreads > 0 ? nthreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nqueues <= 0) nqueues = 1;
+    if (nqueues > MAXTHREADS) nqueues = MAXTHREADS;
+    for (int i = 0; i < nqueues; i++) {
+        pthread_mutex_init(&queues[i].lock, NULL);
+    }
+
+    push_job(NULL, strdup(srcpath), target, mode);
+
+    pthread_t tids[MAXTHREADS];
+    for (int i = 1; i < nqueues; i++) {
+        if (pthread_create(&tids[i], NULL, worker, (void*)(long)i) != 0) {
+            fprintf(stderr, "cp: pthread_create error\n");
+            exit(1);
+        }
+    }
+    worker((void*)0);
+    for (int i = 1; i < nqueues; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+/*
+ * N, NK, NM or NG, rounded up to whole buffers
+ */
+off_t parse_size(const char* str) {
+    char* end;
+    long long n = strtoll(str, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': n <<= 10; end++; break;
+        case 'm': case 'M': n <<= 20; end++; break;
+        case 'g': case 'G': n <<= 30; end++; break;
+    }
+    if (n <= 0 || *end != '\0') usage();
+    return (n + RDBUFLEN - 1) / RDBUFLEN * RDBUFLEN;
+}
+
+struct option longopts[] = {
+    { "direct", no_argument, NULL, 'D' },
+    { "verify", optional_argument, NULL, 'V' },
+    { "update", no_argument, NULL, 'U' },
+    { "sync", no_argument, NULL, 'Y' },
+    { NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char* argv[]) {
-   if (argc != 3) usage(); 
+    int ch;
+    while ((ch = getopt_long(argc, argv, "rj:c:s:", longopts, NULL)) != -1) {
+        switch (ch) {
+            case 'D':
+                directflag = 1;
+                break;
+            case 'V':
+                if (optarg && strcmp(optarg, "xattr") != 0) usage();
+                verifyflag = optarg ? 2 : 1;
+                break;
+            case 'Y':
+                syncflag = 1;
+                /* fall through */
+            case 'U':
+                updateflag = 1;
+                break;
+            case 'r':
+                rflag = 1;
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'c':
+                chunklen = parse_size(optarg);
+                break;
+            case 's':
+                strategy = -1;
+                for (int i = 0; i <= COPY_SENDFILE; i++) {
+                    if (strcmp(optarg, strategy_names[i]) == 0) strategy = i;
+                }
+                if (strategy < 0) usage();
+                if (strategy == COPY_READ4K) rdbuflen = 4096;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind != 2) usage();
 
-   const char* srcpath = argv[1];
-   const char* dstpath = argv[2];
+    const char* srcpath = argv[optind];
+    const char* dstpath = argv[optind + 1];
 
-   docopy(srcpath, dstpath);
+    init_iszero();
+    init_crc32c();
+    if (rflag) copytree(srcpath, dstpath);
+    else docopy(srcpath, dstpath);
 
-   exit(0);
+    exit(status);
 }
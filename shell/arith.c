@@ -0,0 +1,474 @@
+#include "arith.h"
+#include "vars.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ARITHMAXDEPTH       32      /* variables whose value is an expression */
+
+/*
+ * binary operators, from lowest to highest precedence:
+ * ,  = op=  ?:  ||  &&  |  ^  &  == !=  < <= > >=  << >>  + -  * / %  **
+ */
+enum arith_opcode {
+    AR_NONE,
+    AR_COMMA,
+    AR_ASSIGN,
+    AR_COND,
+    AR_LOR,
+    AR_LAND,
+    AR_BOR,
+    AR_XOR,
+    AR_BAND,
+    AR_EQ,
+    AR_NE,
+    AR_LT,
+    AR_LE,
+    AR_GT,
+    AR_GE,
+    AR_SHL,
+    AR_SHR,
+    AR_ADD,
+    AR_SUB,
+    AR_MUL,
+    AR_DIV,
+    AR_MOD,
+    AR_POW
+};
+
+typedef struct arith_op arith_op;
+struct arith_op {
+    const char* sym;
+    int         op;
+    int         prec;
+    int         binop;      /* operator of a compound assignment */
+};
+
+/* longer symbols first, so "<<=" is not taken for "<" */
+static const struct arith_op arith_ops[] = {
+    { "<<=", AR_ASSIGN, 2,  AR_SHL  },
+    { ">>=", AR_ASSIGN, 2,  AR_SHR  },
+    { "**",  AR_POW,    14, AR_NONE },
+    { "*=",  AR_ASSIGN, 2,  AR_MUL  },
+    { "/=",  AR_ASSIGN, 2,  AR_DIV  },
+    { "%=",  AR_ASSIGN, 2,  AR_MOD  },
+    { "+=",  AR_ASSIGN, 2,  AR_ADD  },
+    { "-=",  AR_ASSIGN, 2,  AR_SUB  },
+    { "&=",  AR_ASSIGN, 2,  AR_BAND },
+    { "^=",  AR_ASSIGN, 2,  AR_XOR  },
+    { "|=",  AR_ASSIGN, 2,  AR_BOR  },
+    { "||",  AR_LOR,    4,  AR_NONE },
+    { "&&",  AR_LAND,   5,  AR_NONE },
+    { "==",  AR_EQ,     9,  AR_NONE },
+    { "!=",  AR_NE,     9,  AR_NONE },
+    { "<=",  AR_LE,     10, AR_NONE },
+    { ">=",  AR_GE,     10, AR_NONE },
+    { "<<",  AR_SHL,    11, AR_NONE },
+    { ">>",  AR_SHR,    11, AR_NONE },
+    { ",",   AR_COMMA,  1,  AR_NONE },
+    { "=",   AR_ASSIGN, 2,  AR_NONE },
+    { "?",   AR_COND,   3,  AR_NONE },
+    { "|",   AR_BOR,    6,  AR_NONE },
+    { "^",   AR_XOR,    7,  AR_NONE },
+    { "&",   AR_BAND,   8,  AR_NONE },
+    { "<",   AR_LT,     10, AR_NONE },
+    { ">",   AR_GT,     10, AR_NONE },
+    { "+",   AR_ADD,    12, AR_NONE },
+    { "-",   AR_SUB,    12, AR_NONE },
+    { "*",   AR_MUL,    13, AR_NONE },
+    { "/",   AR_DIV,    13, AR_NONE },
+    { "%",   AR_MOD,    13, AR_NONE },
+};
+
+/*
+ * an operand, name is set when it can be assigned to
+ */
+typedef struct arith_value arith_value;
+struct arith_value {
+    int64_t            value;
+    struct string_view name;
+};
+
+typedef struct arith arith;
+struct arith {
+    const char* str;
+    size_t      len;
+    size_t      rank;
+    int         noeval;     /* inside the skipped side of && || ?: */
+    int         depth;
+    const char* err;
+    size_t      errpos;
+    size_t      operand;    /* right operand of the operator being applied */
+};
+
+static int eval_text(const char* expr, size_t len, int depth, int64_t* result);
+
+size_t arith_span(const char* str, size_t len) {
+    if (len < 5 || str[0] != '$' || str[1] != '(' || str[2] != '(') return 0;
+
+    int depth = 0;
+    for (size_t i = 3; i + 1 < len; i++) {
+        char ch = str[i];
+        if (ch == '\n') {
+            return 0;
+        } else if (ch == '(') {
+            ++depth;
+        } else if (ch == ')') {
+            if (depth > 0) {
+                --depth;
+            } else {
+                return str[i + 1] == ')' ? i + 2 : 0;
+            }
+        }
+    }
+    return 0;
+}
+
+static void arith_error(struct arith* ar, const char* err) {
+    if (ar->err == NULL) {
+        ar->err = err;
+        ar->errpos = ar->rank;
+    }
+}
+
+static void operand_error(struct arith* ar, const char* err) {
+    if (ar->noeval) return;
+    size_t rank = ar->rank;
+    ar->rank = ar->operand;
+    arith_error(ar, err);
+    ar->rank = rank;
+}
+
+static void skip_blanks(struct arith* ar) {
+    while (ar->rank < ar->len && isspace((unsigned char)ar->str[ar->rank])) {
+        ++ar->rank;
+    }
+}
+
+static int is_name_start(char ch) {
+    return isalpha((unsigned char)ch) || ch == '_';
+}
+
+static int is_name_char(char ch) {
+    return isalnum((unsigned char)ch) || ch == '_';
+}
+
+static const struct arith_op* peek_op(struct arith* ar) {
+    skip_blanks(ar);
+    const char* str = ar->str + ar->rank;
+    size_t remain = ar->len - ar->rank;
+    for (size_t i = 0; i < sizeof(arith_ops) / sizeof(arith_ops[0]); i++) {
+        size_t symlen = strlen(arith_ops[i].sym);
+        if (symlen <= remain && memcmp(str, arith_ops[i].sym, symlen) == 0) {
+            return arith_ops + i;
+        }
+    }
+    return NULL;
+}
+
+static int digit_value(char ch, int base) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'z') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'Z') return ch - 'A' + (base <= 36 ? 10 : 36);
+    if (ch == '@') return 62;
+    if (ch == '_') return 63;
+    return 64;
+}
+
+/*
+ * 42, 0x2a, 052, 2#101010, numbers wrap around like C
+ */
+static int64_t parse_number(struct arith* ar) {
+    const char* str = ar->str;
+    size_t rank = ar->rank;
+    size_t end = rank;
+    while (end < ar->len && (is_name_char(str[end]) || str[end] == '@' || str[end] == '#')) {
+        ++end;
+    }
+
+    int base = 10;
+    if (end - rank > 1 && str[rank] == '0' && (str[rank + 1] == 'x' || str[rank + 1] == 'X')) {
+        base = 16;
+        rank += 2;
+    } else if (str[rank] == '0') {
+        base = 8;
+    } else {
+        const char* hash = memchr(str + rank, '#', end - rank);
+        if (hash) {
+            base = 0;
+            for (; str + rank < hash; rank++) {
+                if (!isdigit((unsigned char)str[rank])) break;
+                base = base * 10 + (str[rank] - '0');
+                if (base > 64) break;
+            }
+            if (str + rank != hash || base < 2 || base > 64) {
+                arith_error(ar, "invalid arithmetic base");
+                return 0;
+            }
+            rank += 1;
+        }
+    }
+
+    uint64_t value = 0;
+    if (rank == end) arith_error(ar, "invalid number");
+    for (; rank < end; rank++) {
+        int digit = digit_value(str[rank], base);
+        if (digit >= base) {
+            ar->rank = rank;
+            arith_error(ar, "value too great for base");
+            return 0;
+        }
+        value = value * base + digit;
+    }
+    ar->rank = end;
+    return (int64_t)value;
+}
+
+/*
+ * value of a variable is an expression itself, unset or empty is 0
+ */
+static int64_t variable_value(struct arith* ar, const char* value) {
+    int64_t result = 0;
+    if (value == NULL || value[0] == '\0') return 0;
+    if (ar->depth >= ARITHMAXDEPTH) {
+        arith_error(ar, "expression recursion level exceeded");
+        return 0;
+    }
+    if (eval_text(value, strlen(value), ar->depth + 1, &result) < 0) {
+        arith_error(ar, "invalid variable value");
+    }
+    return result;
+}
+
+static void assign(struct arith* ar, const struct string_view* name, int64_t value) {
+    if (ar->noeval) return;
+
+    char numbuf[32];
+    snprintf(numbuf, sizeof(numbuf), "%" PRId64, value);
+    if (var_set(name->str, name->len, numbuf) < 0) {
+        arith_error(ar, "cannot assign variable");
+    }
+}
+
+static int64_t apply(struct arith* ar, int op, int64_t lhs, int64_t rhs) {
+    /* unsigned arithmetic wraps instead of overflowing */
+    uint64_t a = (uint64_t)lhs;
+    uint64_t b = (uint64_t)rhs;
+
+    switch (op) {
+        case AR_BOR:  return (int64_t)(a | b);
+        case AR_XOR:  return (int64_t)(a ^ b);
+        case AR_BAND: return (int64_t)(a & b);
+        case AR_EQ:   return lhs == rhs;
+        case AR_NE:   return lhs != rhs;
+        case AR_LT:   return lhs < rhs;
+        case AR_LE:   return lhs <= rhs;
+        case AR_GT:   return lhs > rhs;
+        case AR_GE:   return lhs >= rhs;
+        case AR_SHL:  return (int64_t)(a << (b & 63));
+        case AR_SHR:  return lhs >> (b & 63);
+        case AR_ADD:  return (int64_t)(a + b);
+        case AR_SUB:  return (int64_t)(a - b);
+        case AR_MUL:  return (int64_t)(a * b);
+        case AR_DIV:
+        case AR_MOD:
+            if (rhs == 0) {
+                operand_error(ar, "division by 0");
+                return 0;
+            }
+            if (rhs == -1) return op == AR_DIV ? (int64_t)(0 - a) : 0;
+            return op == AR_DIV ? lhs / rhs : lhs % rhs;
+        case AR_POW:
+            {
+                if (rhs < 0) {
+                    operand_error(ar, "exponent less than 0");
+                    return 0;
+                }
+                uint64_t result = 1;
+                for (; b; b >>= 1) {
+                    if (b & 1) result *= a;
+                    a *= a;
+                }
+                return (int64_t)result;
+            }
+        default:
+            return 0;
+    }
+}
+
+static struct arith_value parse_expr(struct arith* ar, int minprec);
+
+static struct arith_value parse_unary(struct arith* ar) {
+    struct arith_value v;
+    v.value = 0;
+    v.name.str = NULL;
+    v.name.len = 0;
+
+    skip_blanks(ar);
+    if (ar->err) return v;
+    if (ar->rank == ar->len) {
+        arith_error(ar, "operand expected");
+        return v;
+    }
+
+    const char* str = ar->str;
+    char ch = str[ar->rank];
+    if (ch == '(') {
+        ar->rank += 1;
+        v.value = parse_expr(ar, 1).value;
+        skip_blanks(ar);
+        if (ar->rank < ar->len && str[ar->rank] == ')') {
+            ar->rank += 1;
+        } else {
+            arith_error(ar, "')' expected");
+        }
+    } else if ((ch == '+' || ch == '-') &&
+               ar->rank + 1 < ar->len && str[ar->rank + 1] == ch) {
+        /* ++name --name, otherwise two signs */
+        size_t saved = ar->rank;
+        ar->rank += 2;
+        skip_blanks(ar);
+        if (ar->rank < ar->len && is_name_start(str[ar->rank])) {
+            v = parse_unary(ar);
+            v.value = apply(ar, ch == '+' ? AR_ADD : AR_SUB, v.value, 1);
+            assign(ar, &v.name, v.value);
+            v.name.str = NULL;
+        } else {
+            ar->rank = saved + 1;
+            v.value = parse_unary(ar).value;
+            if (ch == '-') v.value = (int64_t)(0 - (uint64_t)v.value);
+        }
+    } else if (ch == '+' || ch == '-' || ch == '!' || ch == '~') {
+        ar->rank += 1;
+        int64_t value = parse_unary(ar).value;
+        if (ch == '-') v.value = (int64_t)(0 - (uint64_t)value);
+        else if (ch == '!') v.value = !value;
+        else if (ch == '~') v.value = ~value;
+        else v.value = value;
+    } else if (isdigit((unsigned char)ch)) {
+        v.value = parse_number(ar);
+    } else if (is_name_start(ch)) {
+        size_t begin = ar->rank;
+        while (ar->rank < ar->len && is_name_char(str[ar->rank])) ++ar->rank;
+        v.name.str = str + begin;
+        v.name.len = ar->rank - begin;
+        v.value = variable_value(ar, var_get(v.name.str, v.name.len));
+
+        /* name++ name-- */
+        size_t rank = ar->rank;
+        while (rank < ar->len && isspace((unsigned char)str[rank])) ++rank;
+        if (rank + 1 < ar->len && (str[rank] == '+' || str[rank] == '-') &&
+            str[rank + 1] == str[rank]) {
+            ar->rank = rank + 2;
+            assign(ar, &v.name, apply(ar, str[rank] == '+' ? AR_ADD : AR_SUB, v.value, 1));
+            v.name.str = NULL;
+        }
+    } else {
+        arith_error(ar, "operand expected");
+    }
+
+    return v;
+}
+
+/*
+ * precedence climbing: operators binding at least minprec
+ */
+static struct arith_value parse_expr(struct arith* ar, int minprec) {
+    struct arith_value lhs = parse_unary(ar);
+
+    while (ar->err == NULL) {
+        const struct arith_op* op = peek_op(ar);
+        if (op == NULL || op->prec < minprec) break;
+        ar->rank += strlen(op->sym);
+
+        if (op->op == AR_ASSIGN) {
+            if (lhs.name.str == NULL) {
+                arith_error(ar, "attempted assignment to non-variable");
+                break;
+            }
+            /* right associative */
+            skip_blanks(ar);
+            size_t operand = ar->rank;
+            int64_t rhs = parse_expr(ar, op->prec).value;
+            ar->operand = operand;
+            if (op->binop != AR_NONE) rhs = apply(ar, op->binop, lhs.value, rhs);
+            assign(ar, &lhs.name, rhs);
+            lhs.value = rhs;
+        } else if (op->op == AR_COND) {
+            int cond = lhs.value != 0;
+            ar->noeval += !cond;
+            int64_t yes = parse_expr(ar, 1).value;
+            ar->noeval -= !cond;
+            skip_blanks(ar);
+            if (ar->rank >= ar->len || ar->str[ar->rank] != ':') {
+                arith_error(ar, "':' expected");
+                break;
+            }
+            ar->rank += 1;
+            ar->noeval += cond;
+            int64_t no = parse_expr(ar, op->prec).value;
+            ar->noeval -= cond;
+            lhs.value = cond ? yes : no;
+        } else if (op->op == AR_LAND || op->op == AR_LOR) {
+            /* the right side is parsed but not evaluated */
+            int done = (op->op == AR_LAND) ? lhs.value == 0 : lhs.value != 0;
+            ar->noeval += done;
+            int64_t rhs = parse_expr(ar, op->prec + 1).value;
+            ar->noeval -= done;
+            lhs.value = done ? op->op == AR_LOR : rhs != 0;
+        } else if (op->op == AR_COMMA) {
+            lhs.value = parse_expr(ar, op->prec + 1).value;
+        } else {
+            /* ** is right associative */
+            int nextprec = op->op == AR_POW ? op->prec : op->prec + 1;
+            skip_blanks(ar);
+            size_t operand = ar->rank;
+            int64_t rhs = parse_expr(ar, nextprec).value;
+            ar->operand = operand;
+            lhs.value = apply(ar, op->op, lhs.value, rhs);
+        }
+        lhs.name.str = NULL;
+    }
+
+    return lhs;
+}
+
+static int eval_text(const char* expr, size_t len, int depth, int64_t* result) {
+    struct arith ar;
+    ar.str    = expr;
+    ar.len    = len;
+    ar.rank   = 0;
+    ar.noeval = 0;
+    ar.depth  = depth;
+    ar.err    = NULL;
+    ar.errpos = 0;
+    ar.operand = 0;
+
+    skip_blanks(&ar);
+    *result = 0;
+    if (ar.rank == ar.len) return 0;    /* $(( )) is 0 */
+
+    *result = parse_expr(&ar, 1).value;
+    skip_blanks(&ar);
+    if (ar.err == NULL && ar.rank < ar.len) arith_error(&ar, "syntax error in expression");
+
+    if (ar.err) {
+        if (depth == 0) {
+            size_t begin = 0;
+            while (begin < len && isspace((unsigned char)expr[begin])) ++begin;
+            while (len > begin && isspace((unsigned char)expr[len - 1])) --len;
+            if (ar.errpos > len) ar.errpos = len;
+            fprintf(stderr, "bsh: %.*s: %s (error token is \"%.*s\").\n",
+                    (int)(len - begin), expr + begin, ar.err,
+                    (int)(len - ar.errpos), expr + ar.errpos);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+int arith_eval(const char* expr, size_t len, int64_t* result) {
+    return eval_text(expr, len, 0, result);
+}
@@ -0,0 +1,26 @@
+#ifndef BDU_SHELL_ARITH_H
+#define BDU_SHELL_ARITH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * arithmetic expansion $(( expression ))
+ *
+ * 64-bit integer arithmetic with the C operators, ** and
+ * assignments; the expression is evaluated in place from the
+ * command text, names refer to shell variables.
+ */
+
+/*
+ * return length of $(( ... )) starting at str, or 0 if str does
+ * not start a complete arithmetic expansion
+ */
+size_t arith_span(const char* str, size_t len);
+
+/*
+ * evaluate expr[0, len), return 0 or -1 after printing an error
+ */
+int arith_eval(const char* expr, size_t len, int64_t* result);
+
+#endif /* BDU_SHELL_ARITH_H */
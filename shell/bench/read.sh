@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# lines per second of a while read loop over a file, a pipe and <(list)
+#
+# usage: bench/read.sh [lines]    (run from the shell directory)
+
+LINES=${1:-10000000}
+BSH=${BSH:-./bsh}
+FILE=${TMPDIR:-/tmp}/bsh-read-bench.$$
+
+trap 'rm -f "$FILE"' EXIT
+seq 1 "$LINES" > "$FILE"
+
+LOOP='n=0; while read line; do n=$((n + 1)); done'
+
+now() {
+    date +%s%N
+}
+
+# run name input shell...
+run() {
+    name=$1
+    input=$2
+    shift 2
+    start=$(now)
+    case $input in
+        file)  "$@" -c "$LOOP < $FILE" 2>/dev/null || return ;;
+        pipe)  cat "$FILE" | "$@" -c "$LOOP" 2>/dev/null || return ;;
+        subst) "$@" -c "$LOOP < <(cat $FILE)" 2>/dev/null || return ;;
+    esac
+    end=$(now)
+    ms=$(( (end - start) / 1000000 ))
+    [ "$ms" -gt 0 ] || ms=1
+    printf '%-6s %-6s %10d lines %8d ms %12d lines/sec\n' \
+        "$name" "$input" "$LINES" "$ms" $(( LINES * 1000 / ms ))
+}
+
+for input in file pipe subst; do
+    run bsh $input "$BSH"
+    command -v bash >/dev/null && run bash $input bash
+    # dash has no <(list)
+    if [ $input != subst ] && command -v dash >/dev/null; then
+        run dash $input dash
+    fi
+done
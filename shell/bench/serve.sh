@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# requests per second of bsh --serve against starting bsh -c each time
+#
+# usage: bench/serve.sh [requests] [script]    (run from the shell directory)
+
+REQUESTS=${1:-2000}
+SCRIPT=${2:-'x=$((1 + 2)); test $x -eq 3'}
+BSH=${BSH:-./bsh}
+CC=${CC:-cc}
+DIR=${TMPDIR:-/tmp}/bsh-serve-bench.$$
+SOCK=$DIR/sock
+
+mkdir -p "$DIR"
+trap 'kill $SERVER 2>/dev/null; rm -rf "$DIR"' EXIT
+
+$CC -O2 -o "$DIR/serveclient" bench/serveclient.c || exit 1
+"$BSH" --serve "$SOCK" &
+SERVER=$!
+while [ ! -S "$SOCK" ]; do sleep 0.1; done
+
+"$DIR/serveclient" "$SOCK" "$REQUESTS" "$SCRIPT" > /dev/null
+"$DIR/serveclient" -spawn "$BSH" "$REQUESTS" "$SCRIPT" > /dev/null
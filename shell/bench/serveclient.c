@@ -0,0 +1,119 @@
+/*
+ * client of bsh --serve for bench/serve.sh
+ *
+ * serveclient socket requests script
+ *     send the script requests times over one connection
+ * serveclient -spawn bsh requests script
+ *     run bsh -c script requests times instead
+ */
+#include "../serve.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int send_request(int sock, const char* script) {
+    struct serve_request req;
+    memset(&req, 0, sizeof(req));
+    req.magic = SERVE_REQUEST_MAGIC;
+    req.scriptlen = strlen(script);
+
+    /* stdin, stdout and stderr go along with the header */
+    int fds[3] = { 0, 1, 2 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov[2];
+    iov[0].iov_base = &req;
+    iov[0].iov_len = sizeof(req);
+    iov[1].iov_base = (void*)script;
+    iov[1].iov_len = req.scriptlen;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t n = sendmsg(sock, &msg, 0);
+    return n == (ssize_t)(sizeof(req) + req.scriptlen) ? 0 : -1;
+}
+
+static int recv_reply(int sock, struct serve_reply* reply) {
+    size_t done = 0;
+    while (done < sizeof(*reply)) {
+        ssize_t n = read(sock, (char*)reply + done, sizeof(*reply) - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return reply->magic == SERVE_REPLY_MAGIC ? 0 : -1;
+}
+
+static int run_served(const char* path, long requests, const char* script) {
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        return -1;
+    }
+
+    for (long i = 0; i < requests; i++) {
+        struct serve_reply reply;
+        if (send_request(sock, script) < 0 || recv_reply(sock, &reply) < 0) {
+            fprintf(stderr, "serveclient: request %ld failed\n", i);
+            return -1;
+        }
+    }
+    close(sock);
+    return 0;
+}
+
+static int run_spawned(const char* bsh, long requests, const char* script) {
+    for (long i = 0; i < requests; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execl(bsh, bsh, "-c", script, (char*)NULL);
+            _exit(127);
+        }
+        if (pid < 0 || waitpid(pid, NULL, 0) < 0) return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int spawn = argc == 5 && strcmp(argv[1], "-spawn") == 0;
+    if (argc != 4 && !spawn) {
+        fprintf(stderr, "usage: serveclient [-spawn bsh | socket] requests script\n");
+        return 2;
+    }
+    const char* target = argv[spawn ? 2 : 1];
+    long requests = atol(argv[spawn ? 3 : 2]);
+    const char* script = argv[spawn ? 4 : 3];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = spawn ? run_spawned(target, requests, script)
+                    : run_served(target, requests, script);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (err < 0) return 1;
+
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    /* stdout belongs to the scripts */
+    fprintf(stderr, "%-8s %8ld requests %8.0f ms %10.0f requests/sec\n",
+            spawn ? "bsh -c" : "--serve", requests, ms, requests * 1e3 / ms);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# run a million commands in one bsh and print memstat every 100k,
+# live_bytes, open_fds and rss_kb should stay flat
+#
+# usage: bench/soak.sh [commands] [external-every]    (run from the shell directory)
+
+COMMANDS=${1:-1000000}
+EXTERNAL=${2:-1000}
+BSH=${BSH:-./bsh}
+DIR=${TMPDIR:-/tmp}/bsh-soak-bench.$$
+SCRIPT=$DIR/soak.bsh
+
+mkdir -p "$DIR"
+trap 'rm -rf "$DIR"' EXIT
+
+# ten commands a round
+cat > "$SCRIPT" <<SOAK
+n=0
+while test \$n -lt $((COMMANDS / 10)); do
+    n=\$((n + 1))
+    x=\$((n % 7))
+    test \$x -eq 3
+    echo \$n > $DIR/out
+    read line < $DIR/out
+    echo \$line >> $DIR/out
+    if test \$((n % $EXTERNAL)) -eq 0; then true < $DIR/out; fi
+    if test \$((n % 10000)) -eq 0; then memstat; fi
+done
+memstat
+SOAK
+
+"$BSH" "$SCRIPT" | awk '
+    { print; for (i = 1; i <= NF; i++) { split($i, kv, "="); v[NR, kv[1]] = kv[2] } }
+    END {
+        n = NR
+        if (n < 2) exit 1
+        split("live_bytes open_fds rss_kb", keys, " ")
+        for (k = 1; k <= 3; k++) {
+            key = keys[k]
+            printf "%s first=%s last=%s %s\n", key, v[1, key], v[n, key],
+                   v[n, key] <= v[1, key] * 1.1 ? "flat" : "GROWING"
+        }
+    }' >&2
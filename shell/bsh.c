@@ -1,7 +1,20 @@
 #include "bsh.h"
+#include "vars.h"
+#include "script.h"
+#include "stage.h"
+#include "fanout.h"
+#include "read.h"
+#include "pstat.h"
+#include "serve.h"
+#include "coproc.h"
+#include "record.h"
+#include "split.h"
+#include "builtins_table.h"
+#include "mem.h"
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 #include <errno.h>
 
 #include <assert.h>
@@ -11,13 +24,10 @@
 
 static const char* PROMPT       = "bsh> ";
 
-/*
- * built-in commands
- */
-enum builtins {
-    eCD = 1,
-    eEXIT
-};
+/* exit status of the last executed command, like $? */
+int last_exit_status = 0;
+
+int tail_exec = 0;
 
 void do_redirection(int stdinfd, int stdoutfd, int stderrfd) {
     if (stdinfd >= 0) {
@@ -30,7 +40,7 @@ void do_redirection(int stdinfd, int stdoutfd, int stderrfd) {
          * when process terminated,
          * all opened file descriptors will closed forcedly
          */
-        close(stdinfd);
+        if (stdinfd > STDERR_FILENO) close(stdinfd);
     }
 
     if (stdoutfd >= 0) {
@@ -39,7 +49,7 @@ void do_redirection(int stdinfd, int stdoutfd, int stderrfd) {
                     strerror(errno));
             return;
         }
-        close(stdoutfd);
+        if (stdoutfd > STDERR_FILENO) close(stdoutfd);
     }
 
     if (stderrfd >= 0) {
@@ -48,7 +58,8 @@ void do_redirection(int stdinfd, int stdoutfd, int stderrfd) {
                     strerror(errno));
             return;
         }
-        close(stderrfd);
+        /* 2>&1 must not close stdout */
+        if (stderrfd > STDERR_FILENO) close(stderrfd);
     }
 }
 
@@ -62,8 +73,8 @@ int execute(const struct pipe_command* command) {
     return -1;
 }
 
-pid_t fork_and_execute(const struct pipe_command* command) {
-    assert(command);
+pid_t spawn_command(char** arglist, int stdinfd, int stdoutfd, int stderrfd) {
+    assert(arglist && arglist[0]);
 
     pid_t pid;
     if ((pid = fork()) < 0) {
@@ -72,156 +83,503 @@ pid_t fork_and_execute(const struct pipe_command* command) {
     } else if (pid == 0) {
         restore_signals();
 
-        execute(command);
-        fprintf(stderr, "bsh: execute %s error.\n", command->arglist[0]);
-        /* if support 'echo $?' command,
-         * may be should make exit value more clear... */
-        exit(-1);
+        do_redirection(stdinfd, stdoutfd, stderrfd);
+        execvp(arglist[0], arglist);
+        fprintf(stderr, "bsh: execute %s error.\n", arglist[0]);
+        /* command not found or not executable, like sh */
+        exit(127);
     }
     return pid;
 }
 
-pid_t execute_with_pipe(struct pipe_command** pipe_commands,
-                      size_t pipe_commands_len) {
-    assert(pipe_commands && pipe_commands[0] != NULL);
+pid_t fork_and_execute(const struct pipe_command* command) {
+    assert(command);
 
-    pid_t child_pid;
-    int readfd = -1;
+    return spawn_command((char**)command->arglist, command->stdinfd,
+                         command->stdoutfd, command->stderrfd);
+}
 
+/*
+ * fork every stage but the last one, which replaces the calling
+ * process; never returns
+ */
+static void execute_pipe_stages(struct pipe_command** pipe_commands,
+                                size_t pipe_commands_len) {
+    int readfd = -1;
     pid_t grand_child_pid;
-    if ((child_pid = fork()) < 0) {
-        return -1;
-    } else if (child_pid == 0) {
-        /* create a new process group */
-        /* setpgid(0, 0); */
-
-        /* execute pipe commands in grand-child process */
-        int first_pipefd[2];
-        pipe(first_pipefd);
-        pipe_commands[0]->stdoutfd = first_pipefd[1];
-        /* execute first command */
-        grand_child_pid = fork_and_execute(pipe_commands[0]);
-        close(first_pipefd[1]);
-        if (grand_child_pid < 0 ) {
-            fprintf(stderr, "bsh: fork error.\n");
-            exit(-1);
-        }
-        readfd = first_pipefd[0];
-
-        for (size_t i = 1; i < pipe_commands_len - 1; i++) {
-            int pipefd[2];
-            pipe(pipefd);
-            pipe_commands[i]->stdinfd = readfd;
-            pipe_commands[i]->stdoutfd = pipefd[1];
-
-            grand_child_pid = fork_and_execute(pipe_commands[i]);
-            close(readfd);
-            readfd = pipefd[0];
-            close(pipefd[1]);
-            if (grand_child_pid < 0) {
-                fprintf(stderr, "bsh: fork error.\n");
-                exit(-1);
-            }
-        }
 
-        pipe_commands[pipe_commands_len - 1]->stdinfd = readfd;
-        /* execute last command in child process */
-        grand_child_pid = execute(pipe_commands[pipe_commands_len - 1]);
+    restore_signals();
+    /* create a new process group */
+    /* setpgid(0, 0); */
+
+    /* execute pipe commands in grand-child process */
+    int first_pipefd[2];
+    pipe(first_pipefd);
+    pipe_commands[0]->stdoutfd = first_pipefd[1];
+    /* execute first command */
+    grand_child_pid = fork_and_execute(pipe_commands[0]);
+    close(first_pipefd[1]);
+    if (grand_child_pid < 0 ) {
+        fprintf(stderr, "bsh: fork error.\n");
+        exit(-1);
+    }
+    readfd = first_pipefd[0];
+
+    for (size_t i = 1; i < pipe_commands_len - 1; i++) {
+        int pipefd[2];
+        pipe(pipefd);
+        pipe_commands[i]->stdinfd = readfd;
+        pipe_commands[i]->stdoutfd = pipefd[1];
+
+        grand_child_pid = fork_and_execute(pipe_commands[i]);
         close(readfd);
+        readfd = pipefd[0];
+        close(pipefd[1]);
         if (grand_child_pid < 0) {
             fprintf(stderr, "bsh: fork error.\n");
             exit(-1);
         }
     }
 
+    /* execute last command in this process */
+    struct pipe_command* last_command = pipe_commands[pipe_commands_len - 1];
+    last_command->stdinfd = readfd;
+    execute(last_command);
+    fprintf(stderr, "bsh: execute %s error.\n", last_command->arglist[0]);
+    exit(127);
+}
+
+pid_t execute_with_pipe(struct pipe_command** pipe_commands,
+                      size_t pipe_commands_len) {
+    assert(pipe_commands && pipe_commands[0] != NULL);
+
+    pid_t child_pid;
+    if ((child_pid = fork()) < 0) {
+        return -1;
+    } else if (child_pid == 0) {
+        execute_pipe_stages(pipe_commands, pipe_commands_len);
+    }
+
     return child_pid;
 }
 
+int builtin_id(const char* name) {
+    const struct builtin_slot* slot =
+        builtin_slots + builtin_hash(name, BUILTINSEED) % BUILTINSLOTS;
+    return slot->name && strcmp(slot->name, name) == 0 ? slot->id : 0;
+}
+
+int builtin_keeps_stdin(const char* name, int hasargs) {
+    switch (builtin_id(name)) {
+        case 0:
+            return 0;
+        case eEXEC:
+            /* exec cmd hands every fd of the shell to cmd */
+            return !hasargs;
+        default:
+            /* read goes through the lookahead, coproc gets a pipe */
+            return 1;
+    }
+}
+
 int is_builtins(struct pipe_command** pipe_commands) {
     assert(pipe_commands && pipe_commands[0] != NULL);
     assert(pipe_commands[0]->arglist != NULL && pipe_commands[0]->arglist[0] != NULL);
 
-    char* command = pipe_commands[0]->arglist[0];
-    assert(command != NULL);
-    
-    /* only support two built-in commands: cd, exit... */
-    if (strcmp(command, "cd") == 0) {
-        return eCD;
-    } else if (strcmp(command, "exit") == 0) {
-        return eEXIT;
-    } else {
+    return builtin_id(pipe_commands[0]->arglist[0]);
+}
+
+/*
+ * make srcfd descriptor fd of the shell, descriptors above 2 are
+ * close-on-exec so they stay out of unrelated children
+ */
+static int exec_move_fd(int srcfd, int fd) {
+    input_forget(fd);
+    if (srcfd == CLOSEDFD) {
+        close(fd);
         return 0;
     }
+    if (srcfd == fd) return 0;
 
+    if (dup3(srcfd, fd, fd > STDERR_FILENO ? O_CLOEXEC : 0) < 0) {
+        fprintf(stderr, "bsh: exec: %d: %s.\n", fd, strerror(errno));
+        close(srcfd);
+        return -1;
+    }
+    close(srcfd);
     return 0;
 }
 
-int do_builtins(struct pipe_command** pipe_commands) {
+/*
+ * exec [command [arg...]]
+ * without a command the redirections stay with the shell:
+ * exec 3>log, then cmd >&3 writes to log without opening it again
+ */
+int do_exec(struct pipe_command* command) {
+    if (command->fanoutlen > 0) {
+        fprintf(stderr, "bsh: exec: only one stdout file.\n");
+        return 1;
+    }
+
+    int fds[3] = { command->stdinfd, command->stdoutfd, command->stderrfd };
+    for (int i = 0; i < 3; i++) {
+        /* exec >&3 3>&- must not lose fd 3 */
+        if (fds[i] >= 0 && (command->shellfds & (1 << i))) {
+            fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 10);
+        }
+    }
+    /* the lists of exec < <(list) run on with the shell */
+    command->substfdslen = 0;
+    command->substpidslen = 0;
+
+    int status = 0;
+    for (int i = 0; i < 3; i++) {
+        if ((fds[i] >= 0 || fds[i] == CLOSEDFD) && exec_move_fd(fds[i], i) < 0) {
+            status = 1;
+        }
+    }
+    command->stdinfd = command->stdoutfd = command->stderrfd = -2;
+    for (size_t i = 0; i < command->fdredirlen; i++) {
+        struct fd_redirection* redir = command->fdredirs + i;
+        if (exec_move_fd(redir->srcfd, redir->fd) < 0) status = 1;
+    }
+    command->fdredirlen = 0;
+    if (status != 0 || command->arglist[1] == NULL) return status;
+
+    input_sync_all();
+    restore_signals();
+    execvp(command->arglist[1], command->arglist + 1);
+    fprintf(stderr, "bsh: exec: %s: %s.\n", command->arglist[1], strerror(errno));
+    ignore_signals();
+    return 127;
+}
+
+static int run_builtin(int built_in, struct pipe_command** pipe_commands) {
     char** arglist = pipe_commands[0]->arglist;
 
-    if (strcmp(arglist[0], "cd") == 0) {
+    if (built_in == eCD) {
         if (arglist[1] == NULL) { /* cd to home dir */
             char* homedir = getenv("HOME");
             if (homedir) {
                 if (chdir(homedir) < 0) {
                     fprintf(stderr, "cd: error for %s.\n", strerror(errno));
-                    return -1;
+                    return 1;
                 }
             } else {
                 fprintf(stderr, "cd: unknown home dir.\n");
-                return -1;
+                return 1;
             }
         } else {
             char* todir = arglist[1];
             if (chdir(todir) < 0) {
                 fprintf(stderr, "cd: error for %s.\n", strerror(errno));
-                return -1;
+                return 1;
             }
         }
-    } else if (strcmp(arglist[0], "exit") == 0) {
+        test_stat_cache_clear();
+    } else if (built_in == eEXIT) {
+        if (arglist[1] != NULL) last_exit_status = atoi(arglist[1]) & 0xff;
         /* indicate exit loop... */
         return -2;
+    } else if (built_in == eTEST) {
+        return do_test(arglist);
+    } else if (built_in == eREAD) {
+        return do_read(arglist, pipe_commands[0]->stdinfd,
+                       pipe_commands[0]->shellfds & (1 << STDIN_FILENO));
+    } else if (built_in == eEXEC) {
+        return do_exec(pipe_commands[0]);
+    } else if (built_in == eMEMSTAT) {
+        return do_memstat(arglist, pipe_commands[0]->stdoutfd);
+    } else if (built_in == eCOPROC) {
+        return do_coproc(arglist);
+    } else if (built_in == eECHO) {
+        return do_echo(arglist, pipe_commands[0]->stdoutfd);
+    } else if (built_in == ePRINTF) {
+        return do_printf(arglist, pipe_commands[0]->stdoutfd);
+    } else if (built_in == ePWD) {
+        return do_pwd(arglist, pipe_commands[0]->stdoutfd);
+    } else if (built_in == eTYPE) {
+        return do_type(arglist, pipe_commands[0]->stdoutfd);
+    } else if (built_in == eFALSE) {
+        return 1;
     }
 
     return 0;
 }
 
+/*
+ * return exit status of the built-in command,
+ * or -2 to indicate exit loop
+ *
+ * the command's redirections hold for the built-in like for an
+ * external command: cmd > a > b goes through the fan-out relay,
+ * 2> is fd 2 of the shell while the built-in runs. exec moves the
+ * redirections itself
+ */
+int do_builtins(int built_in, struct pipe_command** pipe_commands) {
+    struct pipe_command* command = pipe_commands[0];
+    if (built_in == eEXEC) {
+        int status = run_builtin(built_in, pipe_commands);
+        /* exec 3>f moved an fd on a file test may have seen */
+        test_stat_cache_clear();
+        return status;
+    }
+    /* echo hi > f, coproc: files may change under test */
+    int writes = command->stdoutfd >= 0 || command->stderrfd >= 0 ||
+                 built_in == eCOPROC;
+
+    struct fanout fo;
+    int has_fanout = command->fanoutlen > 1;
+    if (has_fanout && fanout_start(&fo, command) < 0) return 1;
+
+    int savedfd = -1;
+    if (command->stderrfd >= 0 && command->stderrfd != STDERR_FILENO) {
+        fflush(stderr);
+        savedfd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+        if (savedfd < 0 || dup2(command->stderrfd, STDERR_FILENO) < 0) {
+            fprintf(stderr, "bsh: dup2 STDERR_FILENO failed %s\n", strerror(errno));
+            if (savedfd >= 0) close(savedfd);
+            savedfd = -1;
+        }
+    }
+
+    int status = run_builtin(built_in, pipe_commands);
+
+    if (savedfd >= 0) {
+        fflush(stderr);
+        dup2(savedfd, STDERR_FILENO);
+        close(savedfd);
+    }
+    if (has_fanout) {
+        /* the relay sees EOF, then closes the files */
+        close(command->stdoutfd);
+        command->stdoutfd = -2;
+        command->fanoutlen = 0;
+        if (fanout_finish(&fo) < 0 && status == 0) status = 1;
+    }
+    if (writes) test_stat_cache_clear();
+    return status;
+}
+
+/*
+ * translate status from waitpid into a shell exit status
+ */
+int exit_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+/*
+ * name=value [name=value...]
+ * return -1 if arglist is not made up of assignments
+ */
+int do_assignments(char** arglist) {
+    for (size_t i = 0; arglist[i] != NULL; i++) {
+        if (is_assignment(arglist[i]) == 0) return -1;
+    }
+    for (size_t i = 0; arglist[i] != NULL; i++) {
+        size_t namelen = is_assignment(arglist[i]);
+        var_set(arglist[i], namelen, arglist[i] + namelen + 1);
+    }
+    return 0;
+}
+
+/*
+ * return non-zero if some stage of the pipe can run in-process
+ */
+int has_stage_builtins(struct pipe_command** pipe_commands, size_t commands_len) {
+    for (size_t i = 0; i < commands_len; i++) {
+        if (find_stage_builtin(pipe_commands[i]->arglist)) return 1;
+    }
+    return 0;
+}
+
+static int has_split(struct pipe_command** pipe_commands, size_t commands_len) {
+    for (size_t i = 0; i < commands_len; i++) {
+        if (pipe_commands[i]->split) return 1;
+    }
+    return 0;
+}
+
+/*
+ * the last command may replace the shell when nothing waits for the
+ * shell to come back: no relay threads, no in-process stages, no
+ * split, process substitution or coprocess to look after
+ */
+static int can_tail_exec(struct pipe_command** pipe_commands, size_t commands_len,
+                         int stats, int has_fanout) {
+    if (!tail_exec || stats != PSTAT_OFF || has_fanout) return 0;
+    if (has_stage_builtins(pipe_commands, commands_len)) return 0;
+    if (has_split(pipe_commands, commands_len)) return 0;
+    for (size_t i = 0; i < commands_len; i++) {
+        if (pipe_commands[i]->substpidslen > 0) return 0;
+    }
+    return coproc_running() == 0;
+}
+
 int execute_command(struct pipe_command** pipe_commands, size_t commands_len) {
     assert(pipe_commands != NULL && pipe_commands[0] != NULL);
 
-    int built_in = is_builtins(pipe_commands);
-    if (built_in) {
-        return do_builtins(pipe_commands);
+    if (commands_len == 1) {
+        char** arglist = pipe_commands[0]->arglist;
+        if (do_assignments(arglist) == 0) {
+            last_exit_status = 0;
+            return 0;
+        }
+        if (script_has_function(arglist[0])) {
+            return script_call_function(arglist);
+        }
+
+        int built_in = is_builtins(pipe_commands);
+        if (built_in) {
+            int status = do_builtins(built_in, pipe_commands);
+            if (status < 0) return status;
+            last_exit_status = status;
+            return 0;
+        }
     }
 
-    pid_t child_pid;
-    if (commands_len == 1) { /* no pipe */
+    /* an external command may change anything test has seen */
+    test_stat_cache_clear();
+    /* and reads from where read stopped */
+    input_sync_all();
+
+    int stats = pstat_mode(pipe_commands);
+    if (stats < 0) {
+        last_exit_status = 2;
+        return 0;
+    }
+
+    /* cmd > a > b: relay stdout of the last command to every file */
+    struct pipe_command* last_command = pipe_commands[commands_len - 1];
+    struct fanout fo;
+    int has_fanout = last_command->fanoutlen > 1;
+    if (has_fanout && fanout_start(&fo, last_command) < 0) {
+        last_exit_status = 1;
+        return -1;
+    }
+
+    /* nothing follows: become the command instead of forking and waiting */
+    if (can_tail_exec(pipe_commands, commands_len, stats, has_fanout)) {
+        fflush(NULL);
+        if (commands_len > 1) execute_pipe_stages(pipe_commands, commands_len);
+        restore_signals();
+        execute(pipe_commands[0]);
+        fprintf(stderr, "bsh: execute %s error.\n", pipe_commands[0]->arglist[0]);
+        exit(127);
+    }
+
+    pid_t child_pid = 0;
+    int fused_status = -1;
+    if (has_split(pipe_commands, commands_len)) {
+        /* the shell deals chunks to the copies of one stage */
+        fused_status = execute_split(pipe_commands, commands_len);
+        if (fused_status < 0) child_pid = -1;
+    } else if (stats != PSTAT_OFF) {
+        /* every stage a process, so each edge is a real pipe */
+        fused_status = execute_pstat(pipe_commands, commands_len, stats);
+        if (fused_status < 0) child_pid = -1;
+    } else if (has_stage_builtins(pipe_commands, commands_len)) {
+        /* a lone in-process command is a pipe of one stage */
+        fused_status = execute_fused_pipe(pipe_commands, commands_len);
+        if (fused_status < 0) child_pid = -1;
+    } else if (commands_len == 1) { /* no pipe */
         child_pid = fork_and_execute(*pipe_commands);
     } else {
         child_pid = execute_with_pipe(pipe_commands, commands_len);
     }
 
-    if (child_pid < 0) return (int)child_pid;
-    waitpid(child_pid, NULL, 0);
+    /* relay sees EOF once the command closes its end */
+    if (has_fanout) {
+        close(last_command->stdoutfd);
+        last_command->stdoutfd = -2;
+    }
 
-    return 0;
+    int status = 0;
+    if (child_pid < 0) {
+        last_exit_status = 127;
+    } else if (fused_status >= 0) {
+        last_exit_status = fused_status;
+    } else if (waitpid(child_pid, &status, 0) < 0) {
+        fprintf(stderr, "bsh: waitpid error for %s.\n", strerror(errno));
+        last_exit_status = 1;
+    } else {
+        last_exit_status = exit_status(status);
+    }
+
+    if (has_fanout) {
+        /* the relay has closed the files */
+        last_command->fanoutlen = 0;
+        if (fanout_finish(&fo) < 0 && last_exit_status == 0) last_exit_status = 1;
+    }
+
+    return child_pid < 0 ? (int)child_pid : 0;
 }
 
 void ignore_signals() {
     signal(SIGINT, SIG_IGN);
     signal(SIGQUIT, SIG_IGN);
+    /* in-process stages see EPIPE instead */
+    signal(SIGPIPE, SIG_IGN);
 }
 
 void restore_signals() {
     signal(SIGINT, SIG_DFL);
     signal(SIGQUIT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    /* a child forked by an in-process stage inherits its blocked SIGINT */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGQUIT);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
 }
 
     
 
-int main() {
+void usage() {
+    fprintf(stderr, "usage: bsh [-c cmdline | --serve socket [workers] | script [arg...]]\n"
+                    "       bsh --record log | --replay log [dir]\n");
+    exit(2);
+}
+
+int execute_line(const char* line) {
+    if (script_is_compound(line)) return script_run_text(line);
+    return parse_and_execute_cmdline(line);
+}
+
+int main(int argc, char* argv[]) {
     ignore_signals();
 
+    if (argc > 1) {
+        if (strcmp(argv[1], "-c") == 0) {
+            if (argc < 3) usage();
+            /* bsh -c cmdline [$0 [$1...]] */
+            if (argc > 3) positional_set(argc - 3, argv + 3, NULL);
+            else positional_set(1, argv, NULL);
+            script_tail_exec = 1;
+            script_owns_stdin = 1;
+            script_run_text(argv[2]);
+        } else if (strcmp(argv[1], "--replay") == 0) {
+            if (argc < 3 || argc > 4) usage();
+            if (replay(argv[2], argc > 3 ? argv[3] : NULL) < 0) exit(2);
+        } else if (strcmp(argv[1], "--record") == 0) {
+            if (argc != 3) usage();
+            if (record_open(argv[2]) < 0) exit(2);
+        } else if (strcmp(argv[1], "--serve") == 0) {
+            if (argc < 3 || argc > 4) usage();
+            serve(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+            exit(1);
+        } else {
+            script_tail_exec = 1;
+            script_owns_stdin = 1;
+            script_run_file(argc - 1, argv + 1);
+        }
+        if (strcmp(argv[1], "--record") != 0) exit(last_exit_status);
+    }
+
     char cmdline[MAXCMDLINE + 1];
     cmdline[0] = 0;
 
@@ -229,25 +587,22 @@ int main() {
         printf("%s", PROMPT);
         fflush(NULL);
 
-        char* input = fgets(cmdline, MAXCMDLINE + 1, stdin);
-        if (input != NULL) {
-            size_t cmdlinelen = strlen(input);
-            if (cmdlinelen == MAXCMDLINE && cmdline[MAXCMDLINE - 1] != '\n') {
+        ssize_t linelen = input_readline(STDIN_FILENO, cmdline, MAXCMDLINE + 1);
+        if (linelen > 0) {
+            if (linelen > MAXCMDLINE) {
                 printf("\n\tinput line exceed max count %d\n", MAXCMDLINE);
             } else {
-                cmdline[cmdlinelen - 1] = '\0';
-                int err = parse_and_execute_cmdline(cmdline);
+                if (cmdline[linelen - 1] == '\n') cmdline[linelen - 1] = '\0';
+                uint64_t start = record_now_us();
+                int err = execute_line(cmdline);
+                record_command(cmdline, last_exit_status, record_now_us() - start);
                 if (err == -2) {
                     fprintf(stdout, "Bye......\n");
                     break;
                 }
             }
         } else {
-            /*
-             * call this function clear EOF tag,
-             * otherwise, we will get in a dead loop:)
-             */
-            clearerr(stdin);
+            /* EOF of a tty, the user may go on typing */
             fprintf(stdout, "\n");
         }
     }
@@ -1,11 +1,32 @@
 #ifndef BDU_SHELL_H
 #define BDU_SHELL_H
 
+#include <sys/types.h>
+
 #include "util.h"
 #include "parse.h"
+#include "test.h"
+
+#define BSH_VERSION         "0.2.0"
+
+extern int last_exit_status;
+/*
+ * non-zero while the last pipeline of a run the process exits after
+ * executes, the shell may exec it instead of forking and waiting
+ */
+extern int tail_exec;
 
 void ignore_signals();
 void restore_signals();
+int exit_status(int status);
+/*
+ * fork and exec arglist, fds >= 0 become stdin, stdout and stderr
+ * of the child, return pid or < 0 if fork failed
+ */
+pid_t spawn_command(char** arglist, int stdinfd, int stdoutfd, int stderrfd);
+pid_t fork_and_execute(const struct pipe_command* command);
 int execute_command(struct pipe_command** pipe_commands, size_t commandslen);
+/* run one input line like the interactive loop, -2 means exit */
+int execute_line(const char* line);
 
 #endif /* BDU_SHELL_H */
@@ -0,0 +1,454 @@
+#include "builtins.h"
+#include "stage.h"
+#include "script.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * output of one call: pieces of the arguments as they are, or
+ * text built into buf
+ */
+typedef struct builtin_out builtin_out;
+struct builtin_out {
+    struct iovec iov[2 * ARGSMAXCOUNT + 1];
+    int          iovcnt;
+    char*        buf;
+    size_t       len;
+    size_t       cap;
+    int          errfd;     /* diagnostics, the stage's errfd in a pipeline */
+};
+
+static void out_init(struct builtin_out* out, int errfd) {
+    out->errfd = errfd;
+    out->iovcnt = 0;
+    out->buf = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
+
+static void out_piece(struct builtin_out* out, const char* str, size_t len) {
+    if (len == 0) return;
+    out->iov[out->iovcnt].iov_base = (void*)str;
+    out->iov[out->iovcnt].iov_len = len;
+    out->iovcnt += 1;
+}
+
+static int out_reserve(struct builtin_out* out, size_t len) {
+    if (out->len + len + 1 <= out->cap) return 0;
+    size_t cap = (out->len + len + 1) * 2;
+    if (cap < 256) cap = 256;
+    char* p = (char*)mem_realloc(out->buf, cap);
+    if (p == NULL) return -1;
+    out->buf = p;
+    out->cap = cap;
+    return 0;
+}
+
+static int out_append(struct builtin_out* out, const char* str, size_t len) {
+    if (out_reserve(out, len) < 0) return -1;
+    memcpy(out->buf + out->len, str, len);
+    out->len += len;
+    return 0;
+}
+
+/* the text built in buf is the whole output */
+static void out_text(struct builtin_out* out) {
+    out->iovcnt = 0;
+    out_piece(out, out->buf, out->len);
+}
+
+static void out_free(struct builtin_out* out) {
+    mem_free(out->buf);
+    out->buf = NULL;
+}
+
+/* write every piece, a pipe may take a part at a time */
+static int out_write(struct builtin_out* out, int fd) {
+    struct iovec* iov = out->iov;
+    int iovcnt = out->iovcnt;
+    fflush(stdout);
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int out_emit(struct builtin_out* out, const char* name, int stdoutfd, int status) {
+    if (out_write(out, stdoutfd >= 0 ? stdoutfd : STDOUT_FILENO) < 0) {
+        dprintf(out->errfd, "bsh: %s: write error for %s.\n", name, strerror(errno));
+        status = 1;
+    }
+    out_free(out);
+    return status;
+}
+
+static int out_stage(struct builtin_out* out, struct stage_io* io, int status) {
+    for (int i = 0; i < out->iovcnt; i++) {
+        if (writer_write(&io->out, out->iov[i].iov_base, out->iov[i].iov_len) < 0) {
+            status = 1;
+            break;
+        }
+    }
+    out_free(out);
+    return status;
+}
+
+/*
+ * append the escape sequence at str, return its length;
+ * *stop is set by \c, which ends the output
+ */
+static size_t append_escape(struct builtin_out* out, const char* str, int* stop) {
+    char ch = str[1];
+    size_t len = 2;
+    switch (ch) {
+    case 'a':  ch = '\a'; break;
+    case 'b':  ch = '\b'; break;
+    case 'e':  ch = '\033'; break;
+    case 'f':  ch = '\f'; break;
+    case 'n':  ch = '\n'; break;
+    case 'r':  ch = '\r'; break;
+    case 't':  ch = '\t'; break;
+    case 'v':  ch = '\v'; break;
+    case '\\': break;
+    case 'c':
+        *stop = 1;
+        return len;
+    case '0': {
+        /* \0nnn */
+        int value = 0;
+        while (len < 5 && str[len] >= '0' && str[len] <= '7') {
+            value = value * 8 + (str[len++] - '0');
+        }
+        ch = (char)value;
+        break;
+    }
+    default:
+        /* not an escape, a trailing backslash stays */
+        out_append(out, "\\", 1);
+        return 1;
+    }
+    out_append(out, &ch, 1);
+    return len;
+}
+
+/* append str with its escapes expanded, return non-zero after \c */
+static int append_escaped(struct builtin_out* out, const char* str) {
+    int stop = 0;
+    while (*str && !stop) {
+        const char* backslash = strchr(str, '\\');
+        size_t plain = backslash ? (size_t)(backslash - str) : strlen(str);
+        out_append(out, str, plain);
+        str += plain;
+        if (*str == '\\') str += append_escape(out, str, &stop);
+    }
+    return stop;
+}
+
+static int format_echo(char** arglist, struct builtin_out* out) {
+    int newline = 1;
+    int escapes = 0;
+    size_t i = 1;
+    /* options only as long as every letter is one */
+    for (; arglist[i] && arglist[i][0] == '-' && arglist[i][1]; i++) {
+        const char* opt = arglist[i] + 1;
+        if (opt[strspn(opt, "neE")] != '\0') break;
+        for (; *opt; opt++) {
+            if (*opt == 'n') newline = 0;
+            else escapes = (*opt == 'e');
+        }
+    }
+
+    if (!escapes) {
+        for (size_t first = i; arglist[i]; i++) {
+            if (i > first) out_piece(out, " ", 1);
+            out_piece(out, arglist[i], strlen(arglist[i]));
+        }
+        if (newline) out_piece(out, "\n", 1);
+        return 0;
+    }
+
+    int stop = 0;
+    for (size_t first = i; arglist[i] && !stop; i++) {
+        if (i > first) out_append(out, " ", 1);
+        stop = append_escaped(out, arglist[i]);
+    }
+    if (newline && !stop) out_append(out, "\n", 1);
+    out_text(out);
+    return 0;
+}
+
+/* snprintf one conversion of spec into out */
+#define APPEND_FORMATTED(out, spec, value)                          \
+    do {                                                            \
+        int n_ = snprintf(NULL, 0, spec, value);                    \
+        if (n_ > 0 && out_reserve(out, n_) == 0) {                  \
+            snprintf((out)->buf + (out)->len, n_ + 1, spec, value); \
+            (out)->len += n_;                                       \
+        }                                                           \
+    } while (0)
+
+static int printf_number(const char* arg, long long* value, int errfd) {
+    if (arg == NULL || arg[0] == '\0') {
+        *value = 0;
+        return 0;
+    }
+    /* 'c is the code of c */
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *value = (unsigned char)arg[1];
+        return 0;
+    }
+    char* end = NULL;
+    errno = 0;
+    *value = strtoll(arg, &end, 0);
+    if (*end != '\0' || errno) {
+        dprintf(errfd, "bsh: printf: %s: invalid number.\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * one pass over format, return the exit status or -1 on a bad
+ * format; *args moves past the arguments used
+ */
+static int printf_pass(const char* format, char*** args, struct builtin_out* out,
+                       int* stop) {
+    int status = 0;
+    const char* p = format;
+    while (*p && !*stop) {
+        if (*p == '\\') {
+            p += append_escape(out, p, stop);
+            continue;
+        }
+        if (*p != '%') {
+            size_t plain = strcspn(p, "\\%");
+            out_append(out, p, plain);
+            p += plain;
+            continue;
+        }
+        if (p[1] == '%') {
+            out_append(out, "%", 1);
+            p += 2;
+            continue;
+        }
+
+        /* %[flags][width][.precision]conversion */
+        const char* start = p++;
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p += 1;
+            p += strspn(p, "0123456789");
+        }
+        char conv = *p;
+        size_t speclen = p - start;
+        char spec[32];
+        if (conv == '\0' || strchr("diouxXeEfgGcsb", conv) == NULL || speclen + 3 > sizeof(spec)) {
+            dprintf(out->errfd, "bsh: printf: %.*s: invalid format.\n",
+                    (int)(p - start + (conv != '\0')), start);
+            return -1;
+        }
+        p += 1;
+        memcpy(spec, start, speclen);
+        const char* arg = **args;
+        if (arg) *args += 1;
+
+        if (conv == 's' || conv == 'c' || conv == 'b') {
+            strcpy(spec + speclen, "s");
+            if (conv == 'b') {
+                struct builtin_out text;
+                out_init(&text, out->errfd);
+                *stop = append_escaped(&text, arg ? arg : "");
+                out_append(&text, "", 1);
+                APPEND_FORMATTED(out, spec, text.buf ? text.buf : "");
+                out_free(&text);
+            } else if (conv == 'c') {
+                char ch[2] = { arg ? arg[0] : '\0', '\0' };
+                APPEND_FORMATTED(out, spec, ch);
+            } else {
+                APPEND_FORMATTED(out, spec, arg ? arg : "");
+            }
+        } else if (strchr("eEfgG", conv)) {
+            char* end = NULL;
+            double value = arg ? strtod(arg, &end) : 0;
+            if (arg && (*end != '\0' || end == arg) && arg[0] != '\0') {
+                dprintf(out->errfd, "bsh: printf: %s: invalid number.\n", arg);
+                status |= 1;
+            }
+            spec[speclen] = conv;
+            spec[speclen + 1] = '\0';
+            APPEND_FORMATTED(out, spec, value);
+        } else {
+            long long value;
+            status |= printf_number(arg, &value, out->errfd);
+            spec[speclen] = 'l';
+            spec[speclen + 1] = 'l';
+            spec[speclen + 2] = conv;
+            spec[speclen + 3] = '\0';
+            if (conv == 'd' || conv == 'i') {
+                APPEND_FORMATTED(out, spec, value);
+            } else {
+                APPEND_FORMATTED(out, spec, (unsigned long long)value);
+            }
+        }
+    }
+    return status;
+}
+
+static int format_printf(char** arglist, struct builtin_out* out) {
+    if (arglist[1] == NULL) {
+        dprintf(out->errfd, "usage: printf format [arg...]\n");
+        return 2;
+    }
+
+    /* the format is used again while arguments are left */
+    char** args = arglist + 2;
+    int status = 0;
+    int stop = 0;
+    do {
+        char** before = args;
+        int err = printf_pass(arglist[1], &args, out, &stop);
+        if (err < 0) {
+            status = 1;
+            break;
+        }
+        status |= err;
+        if (args == before) break;
+    } while (*args && !stop);
+
+    out_text(out);
+    return status;
+}
+
+static int format_pwd(char** arglist, struct builtin_out* out) {
+    (void)arglist;
+    if (out_reserve(out, PATH_MAX) < 0) return 1;
+    if (getcwd(out->buf, out->cap - 1) == NULL) {
+        dprintf(out->errfd, "bsh: pwd: %s.\n", strerror(errno));
+        return 1;
+    }
+    out->len = strlen(out->buf);
+    out_append(out, "\n", 1);
+    out_text(out);
+    return 0;
+}
+
+/* full path of command in $PATH into path, 0 if found */
+static int find_in_path(const char* command, char* path, size_t pathlen) {
+    struct stat statbuf;
+    if (strchr(command, '/')) {
+        snprintf(path, pathlen, "%s", command);
+        return access(path, X_OK) == 0 && stat(path, &statbuf) == 0 &&
+               S_ISREG(statbuf.st_mode) ? 0 : -1;
+    }
+
+    const char* dirs = getenv("PATH");
+    if (dirs == NULL) dirs = "/usr/bin:/bin";
+    while (1) {
+        size_t dirlen = strcspn(dirs, ":");
+        snprintf(path, pathlen, "%.*s%s%s", (int)dirlen, dirs,
+                 dirlen > 0 ? "/" : "", command);
+        if (access(path, X_OK) == 0 && stat(path, &statbuf) == 0 &&
+            S_ISREG(statbuf.st_mode)) {
+            return 0;
+        }
+        if (dirs[dirlen] == '\0') return -1;
+        dirs += dirlen + 1;
+    }
+}
+
+static int format_type(char** arglist, struct builtin_out* out) {
+    if (arglist[1] == NULL) {
+        dprintf(out->errfd, "usage: type name...\n");
+        return 2;
+    }
+
+    int status = 0;
+    char path[PATH_MAX];
+    for (size_t i = 1; arglist[i]; i++) {
+        const char* name = arglist[i];
+        if (script_has_function(name)) {
+            APPEND_FORMATTED(out, "%s is a function\n", name);
+        } else if (builtin_id(name)) {
+            APPEND_FORMATTED(out, "%s is a shell builtin\n", name);
+        } else if (find_in_path(name, path, sizeof(path)) == 0) {
+            out_append(out, name, strlen(name));
+            APPEND_FORMATTED(out, " is %s\n", path);
+        } else {
+            dprintf(out->errfd, "bsh: type: %s: not found.\n", name);
+            status = 1;
+        }
+    }
+    out_text(out);
+    return status;
+}
+
+int do_echo(char** arglist, int stdoutfd) {
+    struct builtin_out out;
+    out_init(&out, STDERR_FILENO);
+    return out_emit(&out, "echo", stdoutfd, format_echo(arglist, &out));
+}
+
+int do_printf(char** arglist, int stdoutfd) {
+    struct builtin_out out;
+    out_init(&out, STDERR_FILENO);
+    return out_emit(&out, "printf", stdoutfd, format_printf(arglist, &out));
+}
+
+int do_pwd(char** arglist, int stdoutfd) {
+    struct builtin_out out;
+    out_init(&out, STDERR_FILENO);
+    return out_emit(&out, "pwd", stdoutfd, format_pwd(arglist, &out));
+}
+
+int do_type(char** arglist, int stdoutfd) {
+    struct builtin_out out;
+    out_init(&out, STDERR_FILENO);
+    return out_emit(&out, "type", stdoutfd, format_type(arglist, &out));
+}
+
+/* echo, printf and pwd as pipeline stages */
+int builtin_can_run(char** arglist) {
+    (void)arglist;
+    return 1;
+}
+
+int builtin_echo(char** arglist, struct stage_io* io) {
+    struct builtin_out out;
+    out_init(&out, io->errfd);
+    return out_stage(&out, io, format_echo(arglist, &out));
+}
+
+int builtin_printf(char** arglist, struct stage_io* io) {
+    struct builtin_out out;
+    out_init(&out, io->errfd);
+    return out_stage(&out, io, format_printf(arglist, &out));
+}
+
+int builtin_pwd(char** arglist, struct stage_io* io) {
+    struct builtin_out out;
+    out_init(&out, io->errfd);
+    return out_stage(&out, io, format_pwd(arglist, &out));
+}
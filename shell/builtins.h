@@ -0,0 +1,44 @@
+#ifndef BDU_SHELL_BUILTINS_H
+#define BDU_SHELL_BUILTINS_H
+
+/*
+ * commands run inside the shell
+ *
+ * the names are looked up in a perfect hash table: mkbuiltins picks
+ * a seed for which no two names share a slot and writes the table to
+ * builtins_table.h at build time, so a lookup is one hash and one
+ * strcmp.
+ */
+typedef struct builtin_slot builtin_slot;
+struct builtin_slot {
+    const char* name;
+    int         id;
+};
+
+static inline unsigned builtin_hash(const char* name, unsigned seed) {
+    unsigned h = seed;
+    for (; *name; name++) h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+/* enum builtins value of name, or 0 (bsh.c) */
+int builtin_id(const char* name);
+
+/*
+ * non-zero if built-in name never lets a child read the shell's
+ * stdin, hasargs is set for exec cmd (bsh.c)
+ */
+int builtin_keeps_stdin(const char* name, int hasargs);
+
+/*
+ * echo [-neE] [arg...], printf format [arg...], pwd, type name...
+ *
+ * output goes to stdoutfd, or stdout if it is not redirected, with
+ * one writev(2) per call; return the exit status
+ */
+int do_echo(char** arglist, int stdoutfd);
+int do_printf(char** arglist, int stdoutfd);
+int do_pwd(char** arglist, int stdoutfd);
+int do_type(char** arglist, int stdoutfd);
+
+#endif /* BDU_SHELL_BUILTINS_H */
@@ -0,0 +1,183 @@
+#include "coproc.h"
+#include "bsh.h"
+#include "vars.h"
+#include "read.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAXCOPROCS          16
+#define COPROCNAMELEN       64
+
+typedef struct coproc coproc;
+struct coproc {
+    char  name[COPROCNAMELEN];
+    pid_t pid;
+    int   readfd;       /* its stdout, -1 once closed */
+    int   writefd;      /* its stdin, -1 once closed */
+};
+
+static struct coproc coprocs[MAXCOPROCS];
+
+static struct coproc* coproc_find(const char* name) {
+    for (size_t i = 0; i < MAXCOPROCS; i++) {
+        if (coprocs[i].pid > 0 && strcmp(coprocs[i].name, name) == 0) {
+            return coprocs + i;
+        }
+    }
+    return NULL;
+}
+
+static int is_coproc_name(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= COPROCNAMELEN - 8) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char ch = name[i];
+        if (!(ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+              (i > 0 && ch >= '0' && ch <= '9'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* NAME[index] = fd, or unset it for fd < 0 */
+static void set_fd_var(const char* name, const char* suffix, int fd) {
+    char var[COPROCNAMELEN + 8];
+    int varlen = snprintf(var, sizeof(var), "%s%s", name, suffix);
+    if (fd < 0) {
+        var_unset(var, varlen);
+        return;
+    }
+    char value[16];
+    snprintf(value, sizeof(value), "%d", fd);
+    var_set(var, varlen, value);
+}
+
+static void close_input(struct coproc* cp) {
+    if (cp->writefd < 0) return;
+    close(cp->writefd);
+    cp->writefd = -1;
+    set_fd_var(cp->name, "[1]", -1);
+}
+
+static int coproc_wait(struct coproc* cp) {
+    close_input(cp);
+    if (cp->readfd >= 0) {
+        input_forget(cp->readfd);
+        close(cp->readfd);
+        cp->readfd = -1;
+    }
+    set_fd_var(cp->name, "", -1);
+    set_fd_var(cp->name, "[0]", -1);
+    set_fd_var(cp->name, "_PID", -1);
+
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(cp->pid, &status, 0)) < 0 && errno == EINTR) {}
+    cp->pid = 0;
+    return pid < 0 ? 127 : exit_status(status);
+}
+
+/* a pipe with both ends moved above the fds of commands */
+static int coproc_pipe(int pipefd[2]) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
+    pipefd[0] = fcntl(fds[0], F_DUPFD_CLOEXEC, 10);
+    pipefd[1] = fcntl(fds[1], F_DUPFD_CLOEXEC, 10);
+    close(fds[0]);
+    close(fds[1]);
+    if (pipefd[0] < 0 || pipefd[1] < 0) {
+        if (pipefd[0] >= 0) close(pipefd[0]);
+        if (pipefd[1] >= 0) close(pipefd[1]);
+        return -1;
+    }
+    return 0;
+}
+
+static int coproc_start(const char* name, char** arglist) {
+    if (coproc_find(name)) {
+        fprintf(stderr, "bsh: coproc: %s is already running.\n", name);
+        return 1;
+    }
+    struct coproc* cp = NULL;
+    for (size_t i = 0; i < MAXCOPROCS && cp == NULL; i++) {
+        if (coprocs[i].pid <= 0) cp = coprocs + i;
+    }
+    if (cp == NULL) {
+        fprintf(stderr, "bsh: coproc: too many coprocesses.\n");
+        return 1;
+    }
+
+    int in[2], out[2];
+    if (coproc_pipe(in) < 0) {
+        fprintf(stderr, "bsh: coproc: pipe error for %s.\n", strerror(errno));
+        return 1;
+    }
+    if (coproc_pipe(out) < 0) {
+        fprintf(stderr, "bsh: coproc: pipe error for %s.\n", strerror(errno));
+        close(in[0]);
+        close(in[1]);
+        return 1;
+    }
+
+    /* the child must not write out what the shell has buffered */
+    fflush(NULL);
+    pid_t pid = spawn_command(arglist, in[0], out[1], -1);
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        return 127;
+    }
+
+    snprintf(cp->name, sizeof(cp->name), "%s", name);
+    cp->pid = pid;
+    cp->readfd = out[0];
+    cp->writefd = in[1];
+    set_fd_var(name, "", cp->readfd);
+    set_fd_var(name, "[0]", cp->readfd);
+    set_fd_var(name, "[1]", cp->writefd);
+    set_fd_var(name, "_PID", pid);
+    return 0;
+}
+
+int do_coproc(char** arglist) {
+    const char* opt = arglist[1];
+    int closing = opt && (strcmp(opt, "-c") == 0 || strcmp(opt, "-w") == 0);
+    const char* name = closing ? arglist[2] : opt;
+    if (name == NULL || (closing ? arglist[3] != NULL : arglist[2] == NULL)) {
+        fprintf(stderr, "usage: coproc NAME command [arg...]\n"
+                        "       coproc -c|-w NAME\n");
+        return 2;
+    }
+    if (!is_coproc_name(name)) {
+        fprintf(stderr, "bsh: coproc: '%s': not a valid name.\n", name);
+        return 2;
+    }
+    if (!closing) return coproc_start(name, arglist + 2);
+
+    struct coproc* cp = coproc_find(name);
+    if (cp == NULL) {
+        fprintf(stderr, "bsh: coproc: %s: no such coprocess.\n", name);
+        return 1;
+    }
+    if (opt[1] == 'w') return coproc_wait(cp);
+    close_input(cp);
+    return 0;
+}
+
+int coproc_running() {
+    int running = 0;
+    for (size_t i = 0; i < MAXCOPROCS; i++) {
+        if (coprocs[i].pid > 0) running += 1;
+    }
+    return running;
+}
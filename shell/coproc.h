@@ -0,0 +1,27 @@
+#ifndef BDU_SHELL_COPROC_H
+#define BDU_SHELL_COPROC_H
+
+/*
+ * coproc NAME command [arg...]
+ * coproc -c NAME
+ * coproc -w NAME
+ *
+ * start command with its stdin and stdout on pipes to the shell and
+ * keep it running across commands. ${NAME[0]} (and $NAME) is the fd
+ * to read its output from, ${NAME[1]} the fd to write its input to,
+ * $NAME_PID its pid:
+ *
+ *     coproc BC bc
+ *     echo 1+2 >&${BC[1]}
+ *     read sum <&${BC[0]}
+ *
+ * the fds are close-on-exec, only the commands they are redirected
+ * to see them. -c closes the input side so the command sees EOF,
+ * -w closes both and waits for it, with its exit status.
+ */
+int do_coproc(char** arglist);
+
+/* number of coprocesses not waited for */
+int coproc_running();
+
+#endif /* BDU_SHELL_COPROC_H */
@@ -0,0 +1,168 @@
+#include "fanout.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define SPLICELEN           (1024 * 1024)
+
+/*
+ * move *len bytes from pipe infd to the target, *len counts down,
+ * a failed target only discards its copy
+ */
+static int drain(int infd, struct fanout_target* target, size_t* len) {
+    char buf[64 * 1024];
+
+    while (*len > 0) {
+        if (!target->nosplice && target->fd >= 0) {
+            ssize_t n = splice(infd, NULL, target->fd, NULL, *len, SPLICE_F_MOVE);
+            if (n > 0) {
+                *len -= n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno != EINVAL) return -1;
+            /* splice refuses O_APPEND files and some devices */
+            target->nosplice = 1;
+        }
+
+        ssize_t rdcnt = read(infd, buf, *len < sizeof(buf) ? *len : sizeof(buf));
+        if (rdcnt <= 0) {
+            if (rdcnt < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        for (ssize_t off = 0; off < rdcnt && target->fd >= 0; ) {
+            ssize_t wrcnt = write(target->fd, buf + off, rdcnt - off);
+            if (wrcnt < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            off += wrcnt;
+        }
+        *len -= rdcnt;
+    }
+
+    return 0;
+}
+
+static void target_failed(struct fanout* fo, struct fanout_target* target) {
+    if (fo->err == 0) fo->err = errno;
+    if (target->fd >= 0) close(target->fd);
+    target->fd = -1;
+    target->nosplice = 1;
+}
+
+static void relay(struct fanout* fo) {
+    while (1) {
+        struct pollfd pfd;
+        pfd.fd = fo->infd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            fo->err = errno;
+            return;
+        }
+
+        /* a batch is whatever the command has written so far */
+        int avail = 0;
+        if (ioctl(fo->infd, FIONREAD, &avail) < 0 || avail <= 0) {
+            return;     /* EOF: every writer is gone */
+        }
+        size_t n = avail < SPLICELEN ? (size_t)avail : SPLICELEN;
+
+        /* every target but the last gets a duplicate */
+        for (size_t i = 0; i + 1 < fo->len; i++) {
+            struct fanout_target* target = fo->targets + i;
+            if (target->fd < 0) continue;
+
+            ssize_t copied;
+            do {
+                copied = tee(fo->infd, target->teefd[1], n, 0);
+            } while (copied < 0 && errno == EINTR);
+            if (copied != (ssize_t)n) {
+                if (copied >= 0) errno = EIO;
+                target_failed(fo, target);
+                continue;
+            }
+            size_t len = n;
+            if (drain(target->teefd[0], target, &len) < 0) {
+                target_failed(fo, target);
+            }
+        }
+
+        /* the last target consumes the input */
+        struct fanout_target* last = fo->targets + fo->len - 1;
+        size_t len = n;
+        if (drain(fo->infd, last, &len) < 0) {
+            target_failed(fo, last);
+            if (drain(fo->infd, last, &len) < 0) return;
+        }
+    }
+}
+
+static void* fanout_main(void* arg) {
+    struct fanout* fo = (struct fanout*)arg;
+
+    relay(fo);
+    /* a writer still running gets EPIPE instead of blocking forever */
+    close(fo->infd);
+    return NULL;
+}
+
+int fanout_start(struct fanout* fo, struct pipe_command* command) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        fprintf(stderr, "bsh: pipe error for %s.\n", strerror(errno));
+        return -1;
+    }
+    int pipesize = fcntl(pipefd[0], F_GETPIPE_SZ);
+
+    fo->infd = pipefd[0];
+    fo->len  = command->fanoutlen;
+    fo->err  = 0;
+    size_t i = 0;
+    for (; i < fo->len; i++) {
+        struct fanout_target* target = fo->targets + i;
+        target->fd = command->fanoutfds[i];
+        target->nosplice = 0;
+        if (pipe2(target->teefd, O_CLOEXEC) < 0) break;
+        /* a copy always fits into the private pipe */
+        if (pipesize > 0) fcntl(target->teefd[1], F_SETPIPE_SZ, pipesize);
+    }
+
+    if (i < fo->len ||
+        pthread_create(&fo->thread, NULL, fanout_main, fo) != 0) {
+        fprintf(stderr, "bsh: cannot start output fan-out.\n");
+        for (size_t j = 0; j < i; j++) {
+            close(fo->targets[j].teefd[0]);
+            close(fo->targets[j].teefd[1]);
+        }
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+
+    command->stdoutfd = pipefd[1];
+    return 0;
+}
+
+int fanout_finish(struct fanout* fo) {
+    pthread_join(fo->thread, NULL);
+
+    for (size_t i = 0; i < fo->len; i++) {
+        close(fo->targets[i].teefd[0]);
+        close(fo->targets[i].teefd[1]);
+        if (fo->targets[i].fd >= 0) close(fo->targets[i].fd);
+    }
+
+    if (fo->err) {
+        fprintf(stderr, "bsh: output fan-out failed for %s.\n", strerror(fo->err));
+        return -1;
+    }
+    return 0;
+}
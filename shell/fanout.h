@@ -0,0 +1,43 @@
+#ifndef BDU_SHELL_FANOUT_H
+#define BDU_SHELL_FANOUT_H
+
+#include <pthread.h>
+
+#include "parse.h"
+
+/*
+ * cmd > a > b >> c
+ *
+ * the command writes into a pipe, a relay thread of the shell
+ * duplicates the pipe with tee(2) and moves the data into every
+ * file with splice(2), so the data never enters user space.
+ */
+typedef struct fanout_target fanout_target;
+struct fanout_target {
+    int fd;
+    int teefd[2];       /* private pipe holding this target's copy */
+    int nosplice;       /* O_APPEND files and ttys: read/write instead */
+};
+
+typedef struct fanout fanout;
+struct fanout {
+    int                  infd;
+    struct fanout_target targets[MAXOUTFILES];
+    size_t               len;
+    pthread_t            thread;
+    int                  err;
+};
+
+/*
+ * set command->stdoutfd to a new pipe and start relaying it to
+ * command->fanoutfds, the caller closes command->stdoutfd once the
+ * command is started
+ */
+int fanout_start(struct fanout* fo, struct pipe_command* command);
+
+/*
+ * wait for the relay to drain the pipe and close the files
+ */
+int fanout_finish(struct fanout* fo);
+
+#endif /* BDU_SHELL_FANOUT_H */
@@ -0,0 +1,435 @@
+/*
+ * in-process versions of small filters which run as pipeline stages,
+ * options they do not know leave the work to the external command
+ */
+#include "stage.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <regex.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * run fn over every file of arglist, or over stdin without files,
+ * return the worst status
+ */
+typedef int (*filter_fn)(const char* name, struct stage_reader* in,
+                         struct stage_io* io, void* ctx);
+
+static int for_each_input(const char* cmd, char** files, struct stage_io* io,
+                          filter_fn fn, void* ctx) {
+    if (files[0] == NULL) return fn("-", &io->in, io, ctx);
+
+    int status = 0;
+    for (size_t i = 0; files[i] != NULL && !io->out.closed; i++) {
+        if (strcmp(files[i], "-") == 0) {
+            int err = fn("-", &io->in, io, ctx);
+            if (err > status) status = err;
+            continue;
+        }
+
+        int fd = open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            /* after the output of the files before it */
+            writer_flush(&io->out);
+            dprintf(io->errfd, "%s: %s: %s\n", cmd, files[i], strerror(errno));
+            status = 2;
+            continue;
+        }
+
+        struct stage_reader in;
+        if (reader_init(&in, fd, 1, NULL) < 0) {
+            close(fd);
+            return 2;
+        }
+        int err = fn(files[i], &in, io, ctx);
+        reader_close(&in);
+        if (err > status) status = err;
+    }
+
+    return status;
+}
+
+/*
+ * skip leading options accepted by optstring, -- ends options,
+ * return index of first operand or -1 on unknown option
+ */
+static int simple_options(char** arglist, const char* optstring, char* flags) {
+    int i = 1;
+    for (; arglist[i] != NULL; i++) {
+        const char* arg = arglist[i];
+        if (arg[0] != '-' || arg[1] == '\0') break;
+        if (strcmp(arg, "--") == 0) return i + 1;
+        for (size_t j = 1; arg[j] != '\0'; j++) {
+            const char* opt = strchr(optstring, arg[j]);
+            if (opt == NULL) return -1;
+            if (flags) flags[opt - optstring] = 1;
+        }
+    }
+    return i;
+}
+
+/*
+ * cat [file...]
+ */
+int filter_cat_can_run(char** arglist) {
+    return simple_options(arglist, "", NULL) >= 0;
+}
+
+static int cat_input(const char* name, struct stage_reader* in,
+                     struct stage_io* io, void* ctx) {
+    const char* data;
+    ssize_t len;
+    while ((len = reader_getblock(in, &data)) > 0) {
+        if (writer_write(&io->out, data, len) < 0) return 1;
+    }
+    if (len < 0) {
+        dprintf(io->errfd, "cat: %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int filter_cat(char** arglist, struct stage_io* io) {
+    int first = simple_options(arglist, "", NULL);
+    return for_each_input("cat", arglist + first, io, cat_input, NULL) ? 1 : 0;
+}
+
+/*
+ * head [-n count | -count] [file]
+ */
+static int head_options(char** arglist, long* count, int* fileindex) {
+    int i = 1;
+    *count = 10;
+    if (arglist[i] && strcmp(arglist[i], "-n") == 0) {
+        if (arglist[i + 1] == NULL) return -1;
+        *count = atol(arglist[i + 1]);
+        i += 2;
+    } else if (arglist[i] && strncmp(arglist[i], "-n", 2) == 0 &&
+               isdigit((unsigned char)arglist[i][2])) {
+        *count = atol(arglist[i] + 2);
+        i += 1;
+    } else if (arglist[i] && arglist[i][0] == '-' &&
+               isdigit((unsigned char)arglist[i][1])) {
+        *count = atol(arglist[i] + 1);
+        i += 1;
+    }
+    *fileindex = i;
+
+    /* one file at most, headers of several files are left to head */
+    if (arglist[i] && (arglist[i][0] == '-' || arglist[i + 1] != NULL)) return -1;
+    return *count >= 0 ? 0 : -1;
+}
+
+int filter_head_can_run(char** arglist) {
+    long count;
+    int fileindex;
+    return head_options(arglist, &count, &fileindex) == 0;
+}
+
+static int head_input(const char* name, struct stage_reader* in,
+                      struct stage_io* io, void* ctx) {
+    long count = *(long*)ctx;
+    const char* line;
+    ssize_t len = 0;
+    for (long i = 0; i < count && (len = reader_getline(in, &line)) > 0; i++) {
+        if (writer_write(&io->out, line, len) < 0) return 1;
+    }
+    if (len < 0) {
+        dprintf(io->errfd, "head: %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    /* returning closes the input, upstream stops early */
+    return 0;
+}
+
+int filter_head(char** arglist, struct stage_io* io) {
+    long count;
+    int fileindex;
+    head_options(arglist, &count, &fileindex);
+    return for_each_input("head", arglist + fileindex, io, head_input, &count) ? 1 : 0;
+}
+
+/*
+ * grep [-vicnqFE] pattern [file...]
+ */
+static const char GREPOPTS[] = "vicnqFEs";
+
+enum grep_flags {
+    GREP_INVERT,
+    GREP_ICASE,
+    GREP_COUNT,
+    GREP_NUMBER,
+    GREP_QUIET,
+    GREP_FIXED,
+    GREP_EXTENDED,
+    GREP_SILENT
+};
+
+typedef struct grep_ctx grep_ctx;
+struct grep_ctx {
+    char        flags[sizeof(GREPOPTS)];
+    const char* pattern;
+    size_t      patternlen;
+    regex_t     regex;
+    int         multiple;   /* prefix lines with file names */
+    int         matched;
+};
+
+int filter_grep_can_run(char** arglist) {
+    int first = simple_options(arglist, GREPOPTS, NULL);
+    return first >= 0 && arglist[first] != NULL;
+}
+
+static int grep_match(struct grep_ctx* gc, const char* line, size_t len) {
+    if (gc->flags[GREP_FIXED]) {
+        if (gc->patternlen > len) return 0;
+        for (size_t i = 0; i + gc->patternlen <= len; i++) {
+            if (gc->flags[GREP_ICASE] ?
+                strncasecmp(line + i, gc->pattern, gc->patternlen) == 0 :
+                memcmp(line + i, gc->pattern, gc->patternlen) == 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    /* REG_STARTEND: match the line in place, no copy */
+    regmatch_t match;
+    match.rm_so = 0;
+    match.rm_eo = len;
+    return regexec(&gc->regex, line, 1, &match, REG_STARTEND) == 0;
+}
+
+static int grep_input(const char* name, struct stage_reader* in,
+                      struct stage_io* io, void* ctx) {
+    struct grep_ctx* gc = (struct grep_ctx*)ctx;
+    long count = 0;
+    long lineno = 0;
+    const char* line;
+    ssize_t len;
+    char prefix[64];
+
+    while ((len = reader_getline(in, &line)) > 0) {
+        lineno += 1;
+        size_t textlen = line[len - 1] == '\n' ? len - 1 : len;
+        if (grep_match(gc, line, textlen) == gc->flags[GREP_INVERT]) continue;
+
+        gc->matched = 1;
+        count += 1;
+        if (gc->flags[GREP_QUIET]) return 0;
+        if (gc->flags[GREP_COUNT]) continue;
+
+        if (gc->multiple &&
+            (writer_write(&io->out, name, strlen(name)) < 0 ||
+             writer_write(&io->out, ":", 1) < 0)) {
+            return 1;
+        }
+        if (gc->flags[GREP_NUMBER]) {
+            int prefixlen = snprintf(prefix, sizeof(prefix), "%ld:", lineno);
+            if (writer_write(&io->out, prefix, prefixlen) < 0) return 1;
+        }
+        if (writer_write(&io->out, line, textlen) < 0 ||
+            writer_write(&io->out, "\n", 1) < 0) {
+            return 1;
+        }
+    }
+    if (len < 0) {
+        if (!gc->flags[GREP_SILENT]) {
+            dprintf(io->errfd, "grep: %s: %s\n", name, strerror(errno));
+        }
+        return 2;
+    }
+
+    if (gc->flags[GREP_COUNT]) {
+        int prefixlen = gc->multiple ?
+            snprintf(prefix, sizeof(prefix), "%s:%ld\n", name, count) :
+            snprintf(prefix, sizeof(prefix), "%ld\n", count);
+        if (writer_write(&io->out, prefix, prefixlen) < 0) return 1;
+    }
+    return 0;
+}
+
+int filter_grep(char** arglist, struct stage_io* io) {
+    struct grep_ctx gc;
+    memset(&gc, 0, sizeof(gc));
+
+    int first = simple_options(arglist, GREPOPTS, gc.flags);
+    gc.pattern = arglist[first];
+    gc.patternlen = strlen(gc.pattern);
+    gc.multiple = arglist[first + 1] != NULL && arglist[first + 2] != NULL;
+
+    if (!gc.flags[GREP_FIXED]) {
+        int cflags = REG_NOSUB;
+        if (gc.flags[GREP_EXTENDED]) cflags |= REG_EXTENDED;
+        if (gc.flags[GREP_ICASE]) cflags |= REG_ICASE;
+        int err = regcomp(&gc.regex, gc.pattern, cflags);
+        if (err != 0) {
+            char msg[128];
+            regerror(err, &gc.regex, msg, sizeof(msg));
+            dprintf(io->errfd, "grep: %s\n", msg);
+            return 2;
+        }
+    }
+
+    int status = for_each_input("grep", arglist + first + 1, io, grep_input, &gc);
+    if (!gc.flags[GREP_FIXED]) regfree(&gc.regex);
+
+    if (status == 2 && !gc.flags[GREP_QUIET]) return 2;
+    return gc.matched ? 0 : 1;
+}
+
+/*
+ * wc [-lwc] [file...]
+ */
+static const char WCOPTS[] = "lwc";
+
+typedef struct wc_ctx wc_ctx;
+struct wc_ctx {
+    char flags[sizeof(WCOPTS)];
+    int  inputs;
+    int  named;     /* files were given, "-" is printed too */
+    int  width;
+    long total[3];
+};
+
+/*
+ * words are counted byte-wise like wc in the C locale, a multibyte
+ * locale needs the real wc
+ */
+static int c_locale() {
+    const char* names[] = { "LC_ALL", "LC_CTYPE", "LANG" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const char* value = getenv(names[i]);
+        if (value && *value) return strcmp(value, "C") == 0 || strcmp(value, "POSIX") == 0;
+    }
+    return 1;
+}
+
+int filter_wc_can_run(char** arglist) {
+    char flags[sizeof(WCOPTS)] = { 0 };
+    if (simple_options(arglist, WCOPTS, flags) < 0) return 0;
+    int words = flags[1] || (!flags[0] && !flags[2]);
+    return !words || c_locale();
+}
+
+/*
+ * column width of coreutils wc: the digits of the total size of the
+ * regular files, at least 7 when an input is not a regular file, 1
+ * for a single count of a single input or when the first input
+ * cannot be stat'ed
+ */
+static int wc_width(struct wc_ctx* wc, char** files, struct stage_io* io) {
+    int selected = wc->flags[0] + wc->flags[1] + wc->flags[2];
+    if (selected == 1 && wc->inputs == 1) return 1;
+
+    int minimum = 1;
+    unsigned long long total = 0;
+    for (int i = 0; i < wc->inputs; i++) {
+        const char* name = wc->named ? files[i] : "-";
+        struct stat st;
+        int err;
+        if (strcmp(name, "-") != 0) {
+            err = stat(name, &st);
+        } else if (io->in.ring || io->in.fd < 0) {
+            /* the previous stage: a pipe */
+            minimum = 7;
+            continue;
+        } else {
+            err = fstat(io->in.fd, &st);
+        }
+        if (err < 0) {
+            if (i == 0) return 1;
+            continue;
+        }
+        if (S_ISREG(st.st_mode)) total += st.st_size;
+        else minimum = 7;
+    }
+
+    int width = 1;
+    for (; total >= 10; total /= 10) width++;
+    return width < minimum ? minimum : width;
+}
+
+static int wc_print(struct wc_ctx* wc, struct stage_io* io,
+                    const long* counts, const char* name) {
+    char buf[128];
+    int len = 0;
+
+    for (int i = 0; i < 3; i++) {
+        if (!wc->flags[i]) continue;
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%*ld",
+                        len ? " " : "", wc->width, counts[i]);
+    }
+    if (name) {
+        if (writer_write(&io->out, buf, len) < 0 ||
+            writer_write(&io->out, " ", 1) < 0 ||
+            writer_write(&io->out, name, strlen(name)) < 0) {
+            return -1;
+        }
+        len = 0;
+    }
+    buf[len++] = '\n';
+    return writer_write(&io->out, buf, len);
+}
+
+static int wc_input(const char* name, struct stage_reader* in,
+                    struct stage_io* io, void* ctx) {
+    struct wc_ctx* wc = (struct wc_ctx*)ctx;
+    long counts[3] = { 0, 0, 0 };
+    int inword = 0;
+    const char* data;
+    ssize_t len;
+
+    while ((len = reader_getblock(in, &data)) > 0) {
+        counts[2] += len;
+        if (!wc->flags[1]) {
+            for (const char* p = data; (p = memchr(p, '\n', data + len - p)); p++) {
+                counts[0] += 1;
+            }
+            continue;
+        }
+        for (ssize_t i = 0; i < len; i++) {
+            unsigned char ch = data[i];
+            if (ch == '\n') counts[0] += 1;
+            /* other bytes neither start nor end a word */
+            if (isspace(ch)) {
+                inword = 0;
+            } else if (isprint(ch) && !inword) {
+                inword = 1;
+                counts[1] += 1;
+            }
+        }
+    }
+    if (len < 0) {
+        dprintf(io->errfd, "wc: %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    for (int i = 0; i < 3; i++) wc->total[i] += counts[i];
+    return wc_print(wc, io, counts, wc->named ? name : NULL) < 0;
+}
+
+int filter_wc(char** arglist, struct stage_io* io) {
+    struct wc_ctx wc;
+    memset(&wc, 0, sizeof(wc));
+
+    int first = simple_options(arglist, WCOPTS, wc.flags);
+    if (!wc.flags[0] && !wc.flags[1] && !wc.flags[2]) {
+        wc.flags[0] = wc.flags[1] = wc.flags[2] = 1;
+    }
+    while (arglist[first + wc.inputs] != NULL) wc.inputs += 1;
+    wc.named = wc.inputs > 0;
+    if (wc.inputs == 0) wc.inputs = 1;
+    wc.width = wc_width(&wc, arglist + first, io);
+
+    int status = for_each_input("wc", arglist + first, io, wc_input, &wc);
+    if (wc.inputs > 1) wc_print(&wc, io, wc.total, "total");
+    return status ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+#include "mem.h"
+
+#include <unistd.h>
+#include <dirent.h>
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t   live_bytes = 0;
+static size_t   peak_bytes = 0;
+static size_t   live_blocks = 0;
+static uint64_t allocs = 0;
+static uint64_t frees = 0;
+
+static void count_alloc(void* ptr) {
+    if (ptr == NULL) return;
+
+    size_t size = malloc_usable_size(ptr);
+    size_t live = __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&live_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&peak_bytes, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void count_free(void* ptr) {
+    if (ptr == NULL) return;
+
+    __atomic_sub_fetch(&live_bytes, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&live_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED);
+}
+
+void* mem_alloc(size_t size) {
+    void* ptr = malloc(size);
+    count_alloc(ptr);
+    return ptr;
+}
+
+void* mem_calloc(size_t count, size_t size) {
+    void* ptr = calloc(count, size);
+    count_alloc(ptr);
+    return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t size) {
+    if (ptr == NULL) return mem_alloc(size);
+
+    /* the old block is gone once realloc succeeds */
+    size_t oldsize = malloc_usable_size(ptr);
+    void* newptr = realloc(ptr, size);
+    if (newptr == NULL) return NULL;
+
+    size_t newsize = malloc_usable_size(newptr);
+    size_t live = __atomic_add_fetch(&live_bytes, newsize - oldsize, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&peak_bytes, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return newptr;
+}
+
+char* mem_strdup(const char* str) {
+    char* copy = strdup(str);
+    count_alloc(copy);
+    return copy;
+}
+
+char* mem_strndup(const char* str, size_t len) {
+    char* copy = strndup(str, len);
+    count_alloc(copy);
+    return copy;
+}
+
+void mem_free(void* ptr) {
+    count_free(ptr);
+    free(ptr);
+}
+
+void mem_get_stats(struct mem_stats* stats) {
+    stats->live_bytes  = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes  = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    stats->live_blocks = __atomic_load_n(&live_blocks, __ATOMIC_RELAXED);
+    stats->allocs      = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    stats->frees       = __atomic_load_n(&frees, __ATOMIC_RELAXED);
+}
+
+static int count_open_fds() {
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == NULL) return -1;
+
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') ++count;
+    }
+    closedir(dir);
+    /* without the fd of the directory itself */
+    return count - 1;
+}
+
+static long rss_kb() {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) return -1;
+
+    long size = 0;
+    long resident = -1;
+    if (fscanf(fp, "%ld %ld", &size, &resident) != 2) resident = -1;
+    fclose(fp);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int do_memstat(char** arglist, int stdoutfd) {
+    if (arglist[1] != NULL) {
+        fprintf(stderr, "usage: memstat\n");
+        return 2;
+    }
+
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    fflush(stdout);
+    dprintf(stdoutfd >= 0 ? stdoutfd : STDOUT_FILENO,
+            "live_bytes=%zu peak_bytes=%zu live_blocks=%zu allocs=%llu frees=%llu "
+            "open_fds=%d rss_kb=%ld\n",
+            stats.live_bytes, stats.peak_bytes, stats.live_blocks,
+            (unsigned long long)stats.allocs, (unsigned long long)stats.frees,
+            count_open_fds(), rss_kb());
+    return 0;
+}
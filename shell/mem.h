@@ -0,0 +1,40 @@
+#ifndef BDU_SHELL_MEM_H
+#define BDU_SHELL_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * heap of the shell
+ *
+ * every block the shell allocates goes through these so memstat can
+ * tell what is live; sizes come from malloc_usable_size(3), and the
+ * counters are atomic since pipeline stages and relays run as threads.
+ */
+void* mem_alloc(size_t size);
+void* mem_calloc(size_t count, size_t size);
+void* mem_realloc(void* ptr, size_t size);
+char* mem_strdup(const char* str);
+char* mem_strndup(const char* str, size_t len);
+void  mem_free(void* ptr);
+
+typedef struct mem_stats mem_stats;
+struct mem_stats {
+    size_t   live_bytes;
+    size_t   peak_bytes;
+    size_t   live_blocks;
+    uint64_t allocs;
+    uint64_t frees;
+};
+
+void mem_get_stats(struct mem_stats* stats);
+
+/*
+ * memstat
+ *
+ * print heap and fd usage of the shell as key=value pairs,
+ * to stdoutfd if it is redirected
+ */
+int do_memstat(char** arglist, int stdoutfd);
+
+#endif /* BDU_SHELL_MEM_H */
@@ -0,0 +1,71 @@
+/*
+ * write builtins_table.h to stdout: the enum of built-in commands and
+ * a perfect hash table of their names, see builtins.h
+ */
+#include "builtins.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SLOTS               32
+
+static const struct {
+    const char* name;
+    const char* id;
+} builtins[] = {
+    { "cd",      "eCD" },
+    { "exit",    "eEXIT" },
+    { "test",    "eTEST" },
+    { "[",       "eTEST" },
+    { "read",    "eREAD" },
+    { "exec",    "eEXEC" },
+    { "memstat", "eMEMSTAT" },
+    { "coproc",  "eCOPROC" },
+    { "echo",    "eECHO" },
+    { "printf",  "ePRINTF" },
+    { "pwd",     "ePWD" },
+    { "true",    "eTRUE" },
+    { "false",   "eFALSE" },
+    { ":",       "eCOLON" },
+    { "type",    "eTYPE" },
+};
+
+#define BUILTINS            (sizeof(builtins) / sizeof(builtins[0]))
+
+static int collides(unsigned seed) {
+    int used[SLOTS] = { 0 };
+    for (size_t i = 0; i < BUILTINS; i++) {
+        unsigned slot = builtin_hash(builtins[i].name, seed) % SLOTS;
+        if (used[slot]++) return 1;
+    }
+    return 0;
+}
+
+int main() {
+    unsigned seed = 2166136261u;
+    while (collides(seed)) seed += 1;
+
+    printf("/* generated by mkbuiltins, do not edit */\n"
+           "#ifndef BDU_SHELL_BUILTINS_TABLE_H\n"
+           "#define BDU_SHELL_BUILTINS_TABLE_H\n\n"
+           "#include \"builtins.h\"\n\n"
+           "enum builtins {\n");
+    for (size_t i = 0; i < BUILTINS; i++) {
+        int seen = 0;
+        for (size_t j = 0; j < i; j++) seen |= strcmp(builtins[i].id, builtins[j].id) == 0;
+        if (!seen) printf("    %s%s,\n", builtins[i].id, i == 0 ? " = 1" : "");
+    }
+    printf("};\n\n"
+           "#define BUILTINSEED         %uu\n"
+           "#define BUILTINSLOTS        %d\n\n"
+           "static const struct builtin_slot builtin_slots[BUILTINSLOTS] = {\n",
+           seed, SLOTS);
+    for (unsigned slot = 0; slot < SLOTS; slot++) {
+        for (size_t i = 0; i < BUILTINS; i++) {
+            if (builtin_hash(builtins[i].name, seed) % SLOTS != slot) continue;
+            printf("    [%u] = { \"%s\", %s },\n", slot, builtins[i].name, builtins[i].id);
+        }
+    }
+    printf("};\n\n#endif /* BDU_SHELL_BUILTINS_TABLE_H */\n");
+    return 0;
+}
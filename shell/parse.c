@@ -1,7 +1,13 @@
 #include "parse.h"
 #include "bsh.h"
+#include "vars.h"
+#include "arith.h"
+#include "procsubst.h"
+#include "split.h"
+#include "mem.h"
 
 #include <unistd.h>
+#include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -20,18 +26,28 @@ static const char SPLITSIGN     = ';';
  * >>stdout_file
  * 2>stdout_file
  * 2>>stdout_file
+ * 3>file
+ * 3>>file
  */
 enum output_redirection_cases {
     WRONLY,
     APPEND,
     ERR_WRONLY,
-    ERR_APPEND
+    ERR_APPEND,
+    FD_WRONLY,
+    FD_APPEND
 };
 
 void parse_error(char ch) {
     fprintf(stderr, "bsh: parse error near '%c'.\n", ch);
 }
 
+size_t nested_span(const char* str, size_t len) {
+    size_t span = arith_span(str, len);
+    if (span == 0) span = procsubst_span(str, len);
+    return span;
+}
+
 size_t next_arg_len(const char* cmd, size_t cmdlen) {
     size_t rank = 0;
     while (rank < cmdlen) {
@@ -42,6 +58,19 @@ size_t next_arg_len(const char* cmd, size_t cmdlen) {
                  cmd[rank + 1] == '>')) {
                 rank += 1;
             }
+        } else if (ch == '$') {
+            /* $(( a < b )) is one word */
+            size_t span = arith_span(cmd + rank, cmdlen - rank);
+            if (span > 0) {
+                rank += span;
+                continue;
+            }
+        } else if ((ch == '<' || ch == '>') && rank == 0) {
+            /* <(list) is a word, < alone a redirection */
+            size_t span = procsubst_span(cmd, cmdlen);
+            if (span == 0) break;
+            rank += span;
+            continue;
         } else if (ch == ' '  ||
                    ch == '\t' ||
                    ch == '<'  ||
@@ -73,6 +102,19 @@ size_t next_arg(const char* cmd, size_t cmdlen, struct string_view* sv) {
     return endofwhitespaces + arglen;
 }
 
+/*
+ * return the single digit right before the redirection operator at
+ * cmd[rank], like 3 of 3>file, or -1; the digit was taken as the
+ * last argument already
+ */
+static int redirection_fd(const char* cmd, size_t rank, size_t argrank) {
+    if (rank == 0 || argrank == 0 || !isdigit((unsigned char)cmd[rank - 1])) {
+        return -1;
+    }
+    if (rank - 1 > 0 && !isblank((unsigned char)cmd[rank - 2])) return -1;
+    return cmd[rank - 1] - '0';
+}
+
 int parse_command_no_pipe(const struct string_view* cmdfrag,
                           int input_max,
                           int output_max,
@@ -83,13 +125,17 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
     int input_count = 0;
     struct string_view input_file;
     int output_count = 0;
-    struct string_view output_file;
-    int stdout_open_flag = 0;
+    struct string_view output_files[MAXOUTFILES];
+    int stdout_open_flags[MAXOUTFILES];
     int stderr_open_flag = 0;
     int err_max = 1;
     int err_count = 0;
     int stderr_to_stdout_flag = 0;
     struct string_view err_file;
+    int fd_count = 0;
+    struct string_view fd_files[MAXFDREDIRS];
+    int fd_numbers[MAXFDREDIRS];
+    int fd_open_flags[MAXFDREDIRS];
 
     /* single-command arguments */
     struct string_view argfrags[ARGSMAXCOUNT + 1];
@@ -99,7 +145,11 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
     const char* cmd = cmdfrag->str;
     const size_t cmdlen = cmdfrag->len;
     while (rank < cmdlen) {
-        switch (cmd[rank]) {
+        int ch = cmd[rank];
+        if (procsubst_span(cmd + rank, cmdlen - rank) > 0) {
+            ch = 0; /* an argument */
+        }
+        switch (ch) {
             case ' ':
             case '\t':
                 ++rank;
@@ -140,13 +190,32 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
                      * stdin redirection cases(at most 1):
                      * < in_file
                      * <in_file
+                     * <&3
                      *
+                     * other descriptors, for exec:
+                     * 3<in_file
                      */
                 {
+                    int fd = redirection_fd(cmd, rank, argrank);
+                    if (fd >= 0) argrank -= 1; /* drop the fd number */
+
                     rank += 1;
                     struct string_view sv;
                     size_t len = next_arg(cmd + rank, cmdlen - rank, &sv);
-                    if (len > 0 && skip_whitespaces(sv.str, len) < len && input_count < input_max) {
+                    if (len == 0 || skip_whitespaces(cmd + rank, len) == len) {
+                        parse_error('<');
+                        return -1;
+                    }
+                    if (fd > 0) {
+                        if (fd_count == MAXFDREDIRS) {
+                            fprintf(stderr, "bsh: too many descriptor redirections.\n");
+                            return -1;
+                        }
+                        fd_files[fd_count] = sv;
+                        fd_numbers[fd_count] = fd;
+                        fd_open_flags[fd_count] = O_RDONLY;
+                        fd_count += 1;
+                    } else if (input_count < input_max) {
                         input_file = sv;
                         input_count += 1;
                     } else {
@@ -166,31 +235,42 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
                      * >out_file
                      * >> out_file
                      * >>out_file
+                     * >&3
                      *
                      * stderr redirection cases:
                      * 2>&1
+                     * 2>&3
                      * 2> filename
                      * 2>filename
                      * 2>> filename
                      * 2>>filename
+                     *
+                     * other descriptors, for exec:
+                     * 3>filename
+                     * 3>>filename
+                     * 3>&-
                      */
                     int output_redirection_case = WRONLY; /* stdout redirection */
-                    if (rank > 0 &&
-                        cmd[rank - 1] == '2' &&
-                        (rank - 1 == 0 || isblank(cmd[rank - 2]))) {
+                    int fd = redirection_fd(cmd, rank, argrank);
+                    if (fd >= 0) argrank -= 1; /* drop the fd number */
+                    if (fd == 2) {
                         /*
                          * 2>err_file
                          * ^^^^
                          *  r
                          */
                         output_redirection_case = ERR_WRONLY; /* stderr redirection */
+                    } else if (fd == 0 || fd > 2) {
+                        output_redirection_case = FD_WRONLY;
                     }
 
                     if (rank + 1 < cmdlen && cmd[rank + 1] == '>') {
                         if (output_redirection_case == WRONLY) {
                             output_redirection_case = APPEND; /* append stdout redirection */
-                        } else { /* 2>>.. */
+                        } else if (output_redirection_case == ERR_WRONLY) { /* 2>>.. */
                             output_redirection_case = ERR_APPEND; /* append stderr redirection */
+                        } else {
+                            output_redirection_case = FD_APPEND;
                         }
                         rank += 2;
                     } else {
@@ -203,8 +283,9 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
                         switch (output_redirection_case) {
                             case WRONLY: /* create write */
                             case APPEND: /* append */
+                                /* several files: output fans out to each */
                                 if (output_count < output_max) {
-                                    output_file = sv;
+                                    output_files[output_count] = sv;
                                     output_count += 1;
                                 } else {
                                     parse_error('>');
@@ -221,10 +302,6 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
                                 }
 
                                 if (err_count < err_max) {
-                                    /* go back 1 */
-                                    assert(argrank > 0);
-                                    argrank -= 1;
-
                                     err_count += 1;
                                     if (!stderr_to_stdout_flag)
                                         err_file = sv;
@@ -234,25 +311,46 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
                                 }
                                 break;
 
+                            case FD_WRONLY:
+                            case FD_APPEND:
+                                if (fd_count == MAXFDREDIRS) {
+                                    fprintf(stderr, "bsh: too many descriptor redirections.\n");
+                                    return -1;
+                                }
+                                fd_files[fd_count] = sv;
+                                fd_numbers[fd_count] = fd;
+                                fd_count += 1;
+                                break;
+
                             default:
                                 assert(0 && "invalid output redirection case.");
                         }
 
                         switch (output_redirection_case) {
                             case WRONLY:
-                                stdout_open_flag = O_WRONLY | O_CREAT;
+                                stdout_open_flags[output_count - 1] =
+                                    O_WRONLY | O_CREAT | O_TRUNC;
                                 break;
 
                             case ERR_WRONLY:
-                                stderr_open_flag = O_WRONLY | O_CREAT;
+                                stderr_open_flag = O_WRONLY | O_CREAT | O_TRUNC;
                                 break;
 
                             case APPEND:
-                                stdout_open_flag = O_APPEND | O_CREAT;
+                                stdout_open_flags[output_count - 1] =
+                                    O_WRONLY | O_APPEND | O_CREAT;
                                 break;
 
                             case ERR_APPEND:
-                                stderr_open_flag = O_APPEND | O_CREAT;
+                                stderr_open_flag = O_WRONLY | O_APPEND | O_CREAT;
+                                break;
+
+                            case FD_WRONLY:
+                                fd_open_flags[fd_count - 1] = O_WRONLY | O_CREAT | O_TRUNC;
+                                break;
+
+                            case FD_APPEND:
+                                fd_open_flags[fd_count - 1] = O_WRONLY | O_APPEND | O_CREAT;
                                 break;
 
                             default:
@@ -288,15 +386,20 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
     argfrags[argrank].len = 0;
 
     if (input_count) cmdref->stdinfile = input_file;
-    if (output_count) {
-        cmdref->stdoutfile = output_file;
-        cmdref->stdoutfile_openflag = stdout_open_flag;
+    for (int i = 0; i < output_count; i++) {
+        cmdref->stdoutfiles[i] = output_files[i];
+        cmdref->stdoutfile_openflags[i] = stdout_open_flags[i];
     }
     if (err_count) {
         cmdref->stderrfile = err_file;
         cmdref->stderrfile_openflag = stderr_open_flag;
     }
     cmdref->stderr_to_stdout_flag = stderr_to_stdout_flag;
+    for (int i = 0; i < fd_count; i++) {
+        cmdref->fdfiles[i] = fd_files[i];
+        cmdref->fdfile_fds[i] = fd_numbers[i];
+        cmdref->fdfile_openflags[i] = fd_open_flags[i];
+    }
     for (size_t i = 0; i < argrank; i++) {
         cmdref->arguments[i].str = argfrags[i].str;
         cmdref->arguments[i].len = argfrags[i].len;
@@ -305,6 +408,23 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
     return 0;
 }
 
+/*
+ * length of the N| or Nk| of a |N| split after the | at str, or 0
+ */
+static size_t split_marker(const char* str, size_t len, int* copies, int* ordered) {
+    size_t i = 0;
+    int n = 0;
+    while (i < len && i < 3 && isdigit((unsigned char)str[i])) {
+        n = n * 10 + (str[i++] - '0');
+    }
+    if (i == 0) return 0;
+    *ordered = (i < len && str[i] == 'k');
+    if (*ordered) ++i;
+    if (i >= len || str[i] != '|') return 0;
+    *copies = n;
+    return i + 1;
+}
+
 int parse_command_with_pipe(const char* cmd,
                             size_t cmdlen,
                             struct command_frag* pipe_commands) {
@@ -312,11 +432,20 @@ int parse_command_with_pipe(const char* cmd,
 
     struct string_view pipefrags[MAXPIPECOUNT + 1];
     size_t piperank = 0;
+    /* a |N| split runs copies of the frag after it */
+    int splits[MAXPIPECOUNT + 1] = { 0 };
+    int splitorders[MAXPIPECOUNT + 1] = { 0 };
+    int hassplit = 0;
 
     size_t rank = 0;
     size_t fragbegin = rank;
     while (rank < cmdlen) {
         char ch = cmd[rank];
+        size_t span = nested_span(cmd + rank, cmdlen - rank);
+        if (span > 0) {
+            rank += span;
+            continue;
+        }
         if (ch == '|' && piperank == 0 && skip_whitespaces(cmd, rank) == rank) {
             /* all leading blanks */
             fprintf(stderr, "bsh: lead pipe\n");
@@ -336,6 +465,22 @@ int parse_command_with_pipe(const char* cmd,
                     return -1;
                 }
                 fragbegin = rank + 1;
+
+                int copies, ordered;
+                size_t marker = split_marker(cmd + rank + 1, cmdlen - rank - 1,
+                                             &copies, &ordered);
+                if (marker > 0) {
+                    if (hassplit || copies < 1 || copies > MAXSPLIT) {
+                        fprintf(stderr, "bsh: |%d|: a pipeline takes one split "
+                                "of 1 to %d copies.\n", copies, MAXSPLIT);
+                        return -1;
+                    }
+                    hassplit = 1;
+                    splits[piperank] = copies;
+                    splitorders[piperank] = ordered;
+                    rank += marker;
+                    fragbegin = rank + 1;
+                }
             } else {
                 parse_error('|');
                 return -1;
@@ -366,7 +511,7 @@ int parse_command_with_pipe(const char* cmd,
     /* if all parsing correct, fill parsing results */
     size_t i = 1;
     if (piperank == 1) { /* no pipe */
-        if (parse_command_no_pipe(&pipefrags[0], 1, 1, pipe_commands + 0) < 0)
+        if (parse_command_no_pipe(&pipefrags[0], 1, MAXOUTFILES, pipe_commands + 0) < 0)
             return -1;
     } else {
         for (i = 0; i < piperank; i++) {
@@ -375,7 +520,7 @@ int parse_command_with_pipe(const char* cmd,
                     return -1;
                 }
             } else if (i == piperank - 1) {
-                if (parse_command_no_pipe(&pipefrags[i], 0, 1, pipe_commands + i) < 0) {
+                if (parse_command_no_pipe(&pipefrags[i], 0, MAXOUTFILES, pipe_commands + i) < 0) {
                     return -1;
                 }
             } else {
@@ -385,6 +530,10 @@ int parse_command_with_pipe(const char* cmd,
             }
         }
     }
+    for (size_t j = 0; j < piperank; j++) {
+        pipe_commands[j].split = splits[j];
+        pipe_commands[j].splitordered = splitorders[j];
+    }
     /* indicate pipe commands end */
     pipe_commands[i].stderr_to_stdout_flag = -1;
 
@@ -400,59 +549,243 @@ int open_file(const struct string_view* file_sv, int openflag) {
      */
     if (file_sv->str == NULL) return -2;
 
-    char buf[1024];
-    snprintf(buf, file_sv->len + 1, "%s", file_sv->str);
-    /* keep safe */
-    buf[1023] = 0;
+    /* > $log, done < $file: expanded like an argument */
+    char* name = expand_arg(file_sv);
+    if (name == NULL) return -1;
+    if (name[0] == '\0') {
+        fprintf(stderr, "bsh: %.*s: ambiguous redirect.\n",
+                (int)file_sv->len, file_sv->str);
+        mem_free(name);
+        return -1;
+    }
 
     int fd = -1;
     if (openflag & O_CREAT) {
-        fd = open(buf, openflag, 0666);
+        fd = open(name, openflag, 0666);
     } else {
-        fd = open(buf, openflag);
+        fd = open(name, openflag);
     }
     /* handle open error */
     if (fd < 0) {
-        fprintf(stderr, "bsh: open %s failed for %s.\n", buf, strerror(errno));
+        fprintf(stderr, "bsh: open %s failed for %s.\n", name, strerror(errno));
     }
+    /* > f may create or change a file test has seen */
+    if (openflag & (O_CREAT | O_TRUNC | O_APPEND)) test_stat_cache_clear();
+    mem_free(name);
     return fd;
 }
 
+/*
+ * start <(list) or >(list) of sv for pcmd, return the fd or -1;
+ * the fd of an argument is passed as /dev/fd/N and stays open in the
+ * command, a redirection target is closed like an opened file
+ */
+static int start_subst(struct pipe_command* pcmd,
+                       const struct string_view* sv,
+                       int isarg) {
+    if (pcmd->substpidslen == MAXPROCSUBST) {
+        fprintf(stderr, "bsh: too many process substitutions.\n");
+        return -1;
+    }
+
+    pid_t pid;
+    int fd = procsubst_start(sv->str, sv->len, isarg, &pid);
+    if (fd < 0) return -1;
+    pcmd->substpids[pcmd->substpidslen++] = pid;
+    if (isarg) pcmd->substfds[pcmd->substfdslen++] = fd;
+    return fd;
+}
+
+static int is_subst(const struct string_view* sv) {
+    return sv->str != NULL && sv->len > 0 &&
+           procsubst_span(sv->str, sv->len) == sv->len;
+}
+
+/*
+ * return fd N of &N, which has to be open, or CLOSEDFD for &-
+ * if exec may close it, -1 on error
+ */
+static int parse_dup_target(const struct string_view* sv, int isexec) {
+    if (sv->len == 2 && sv->str[1] == '-') {
+        if (isexec) return CLOSEDFD;
+        fprintf(stderr, "bsh: &-: only exec can close a descriptor.\n");
+        return -1;
+    }
+
+    /* >&${CO[1]} names the fd of a coprocess */
+    struct string_view target = *sv;
+    char* text = NULL;
+    if (memchr(sv->str, '$', sv->len)) {
+        text = expand_arg(sv);
+        if (text == NULL) return -1;
+        target.str = text;
+        target.len = strlen(text);
+    }
+
+    int fd = 0;
+    size_t i = 1;
+    for (; i < target.len && i < 8 && isdigit((unsigned char)target.str[i]); i++) {
+        fd = fd * 10 + (target.str[i] - '0');
+    }
+    if (i == 1 || i < target.len || fcntl(fd, F_GETFD) < 0) {
+        fprintf(stderr, "bsh: %.*s: bad file descriptor.\n",
+                (int)target.len - 1, target.str + 1);
+        fd = -1;
+    }
+    mem_free(text);
+    return fd;
+}
+
+/*
+ * open a redirection file of fd stdfd, start the list of
+ * cmd < <(list), cmd > >(list), or refer to a descriptor of the
+ * shell with >&3; stdfd is -1 for fan-out targets, those are closed
+ * by the relay and get their own copy
+ */
+static int open_target(struct pipe_command* pcmd,
+                       const struct string_view* sv,
+                       int openflag,
+                       int stdfd,
+                       int isexec) {
+    if (is_subst(sv)) return start_subst(pcmd, sv, 0);
+    if (sv->str == NULL || sv->str[0] != '&') return open_file(sv, openflag);
+
+    int fd = parse_dup_target(sv, isexec);
+    if (fd < 0) return fd;
+    if (stdfd < 0) return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    pcmd->shellfds |= 1 << stdfd;
+    return fd;
+}
+
+/*
+ * exec 3>file 4<&0 5>&-, the built-in moves the fds into place;
+ * every source is a private copy above 9, so 3>&1 >file still saves
+ * the old stdout whatever exec moves first
+ */
+static int open_fd_redirections(struct pipe_command* pcmd,
+                                const struct command_frag* cmdfrag,
+                                int isexec) {
+    for (size_t i = 0; i < MAXFDREDIRS && cmdfrag->fdfiles[i].str; i++) {
+        const struct string_view* sv = &(cmdfrag->fdfiles[i]);
+        if (!isexec) {
+            fprintf(stderr, "bsh: only exec can redirect descriptor %d.\n",
+                    cmdfrag->fdfile_fds[i]);
+            return -1;
+        }
+
+        int fd;
+        int isdup = (sv->str[0] == '&');
+        if (is_subst(sv)) {
+            fd = start_subst(pcmd, sv, 0);
+        } else if (isdup) {
+            fd = parse_dup_target(sv, isexec);
+        } else {
+            fd = open_file(sv, cmdfrag->fdfile_openflags[i]);
+        }
+        if (fd == -1) return -1;
+
+        struct fd_redirection* redir = pcmd->fdredirs + pcmd->fdredirlen;
+        redir->fd = cmdfrag->fdfile_fds[i];
+        redir->srcfd = fd;
+        if (fd != CLOSEDFD) {
+            redir->srcfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+            if (!isdup) close(fd);
+            if (redir->srcfd < 0) {
+                fprintf(stderr, "bsh: exec: %s.\n", strerror(errno));
+                return -1;
+            }
+        }
+        pcmd->fdredirlen += 1;
+    }
+    return 0;
+}
+
 struct pipe_command* mk_pipecommand(const struct command_frag* cmdfrag) {
     assert(cmdfrag);
 
     struct pipe_command* pcmd =
-        (struct pipe_command*)malloc(sizeof(struct pipe_command));
+        (struct pipe_command*)mem_alloc(sizeof(struct pipe_command));
     if (pcmd) {
-        pcmd->stdinfd = open_file(&(cmdfrag->stdinfile), O_RDONLY);
-        pcmd->stdoutfd = open_file(&(cmdfrag->stdoutfile),
-                                   cmdfrag->stdoutfile_openflag);
+        pcmd->substfdslen = 0;
+        pcmd->substpidslen = 0;
+        pcmd->fanoutlen = 0;
+        pcmd->shellfds = 0;
+        pcmd->fdredirlen = 0;
+        pcmd->split = cmdfrag->split;
+        pcmd->splitordered = cmdfrag->splitordered;
+        pcmd->stdinfd = -2;
+        pcmd->stdoutfd = -2;
+        pcmd->stderrfd = -2;
+
+        /* arguments expanding to an empty string are removed */
+        size_t argc = 0;
+        for (size_t i = 0; i < ARGSMAXCOUNT; i++) {
+            if (cmdfrag->arguments[i].str == NULL ||
+                cmdfrag->arguments[i].len == 0) {
+                break;
+            }
+            char* arg = NULL;
+            if (is_subst(&(cmdfrag->arguments[i]))) {
+                int fd = start_subst(pcmd, &(cmdfrag->arguments[i]), 1);
+                if (fd >= 0) {
+                    char path[32];
+                    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+                    arg = mem_strdup(path);
+                }
+            } else {
+                arg = expand_arg(&(cmdfrag->arguments[i]));
+            }
+            if (arg == NULL) { /* bad $(( )) or malloc failed */
+                pcmd->arglist[argc] = NULL;
+                free_memory(&pcmd, 1);
+                return NULL;
+            }
+            if (arg[0] == '\0') {
+                mem_free(arg);
+            } else {
+                pcmd->arglist[argc++] = arg;
+            }
+        }
+        pcmd->arglist[argc] = NULL;
+
+        int isexec = argc > 0 && strcmp(pcmd->arglist[0], "exec") == 0;
+        pcmd->stdinfd = open_target(pcmd, &(cmdfrag->stdinfile), O_RDONLY,
+                                    STDIN_FILENO, isexec);
+        int fanout = cmdfrag->stdoutfiles[1].str != NULL;
+        pcmd->stdoutfd = open_target(pcmd, &(cmdfrag->stdoutfiles[0]),
+                                     cmdfrag->stdoutfile_openflags[0],
+                                     fanout ? -1 : STDOUT_FILENO, isexec);
+        if (pcmd->stdoutfd >= 0 && fanout) {
+            /* the shell relays stdout to every file */
+            pcmd->fanoutfds[pcmd->fanoutlen++] = pcmd->stdoutfd;
+            pcmd->stdoutfd = -2;
+            for (size_t i = 1; i < MAXOUTFILES && cmdfrag->stdoutfiles[i].str; i++) {
+                int fd = open_target(pcmd, &(cmdfrag->stdoutfiles[i]),
+                                     cmdfrag->stdoutfile_openflags[i], -1, 0);
+                if (fd < 0) {
+                    pcmd->stdoutfd = -1;
+                    break;
+                }
+                pcmd->fanoutfds[pcmd->fanoutlen++] = fd;
+            }
+        }
         if (cmdfrag->stderr_to_stdout_flag == 1) {
             pcmd->stderrfd = 1;
+            pcmd->shellfds |= 1 << STDERR_FILENO;
         } else {
-            pcmd->stderrfd = open_file(&(cmdfrag->stderrfile),
-                                       cmdfrag->stderrfile_openflag);
+            pcmd->stderrfd = open_target(pcmd, &(cmdfrag->stderrfile),
+                                         cmdfrag->stderrfile_openflag,
+                                         STDERR_FILENO, isexec);
         }
 
         /* handle open error */
         if (pcmd->stdinfd == -1 ||
             pcmd->stdoutfd == -1 ||
-            pcmd->stderrfd == -1) {
-            /* no need to free arglist */
-            free(pcmd);
+            pcmd->stderrfd == -1 ||
+            open_fd_redirections(pcmd, cmdfrag, isexec) < 0) {
+            free_memory(&pcmd, 1);
             return NULL;
         }
-
-        size_t i = 0;
-        for (; i < ARGSMAXCOUNT + 1; i++) {
-            if (cmdfrag->arguments[i].str != NULL &&
-                cmdfrag->arguments[i].len != 0) {
-                pcmd->arglist[i] = make_arg(&(cmdfrag->arguments[i]));
-            } else {
-                pcmd->arglist[i] = NULL;
-                break;
-            }
-        }
     }
 
     return pcmd;
@@ -460,19 +793,54 @@ struct pipe_command* mk_pipecommand(const struct command_frag* cmdfrag) {
 
 void free_memory(struct pipe_command** pipecmds, size_t len) {
     for (size_t i = 0; i < len; i++) {
-        freearglist((const char **)pipecmds[i]->arglist);
-        free(pipecmds[i]);
+        struct pipe_command* pcmd = pipecmds[i];
+        /* files opened for the command, the shell's own fds stay */
+        int fds[3] = { pcmd->stdinfd, pcmd->stdoutfd, pcmd->stderrfd };
+        for (int j = 0; j < 3; j++) {
+            if (fds[j] >= 0 && !(pcmd->shellfds & (1 << j))) close(fds[j]);
+        }
+        for (size_t j = 0; j < pcmd->fanoutlen; j++) {
+            close(pcmd->fanoutfds[j]);
+        }
+        for (size_t j = 0; j < pcmd->fdredirlen; j++) {
+            if (pcmd->fdredirs[j].srcfd >= 0) close(pcmd->fdredirs[j].srcfd);
+        }
+        /* <(list) sees EPIPE, >(list) sees EOF */
+        for (size_t j = 0; j < pcmd->substfdslen; j++) {
+            procsubst_close(pcmd->substfds[j]);
+        }
+        for (size_t j = 0; j < pcmd->substpidslen; j++) {
+            while (waitpid(pcmd->substpids[j], NULL, 0) < 0 && errno == EINTR)
+                ;
+        }
+        freearglist((const char **)pcmd->arglist);
+        mem_free(pcmd);
     }
 }
 
-int parse_execute(const char* cmd, size_t cmdlen) {
-    struct command_frag fragarray[MAXPIPECOUNT + 2];
-    bzero(fragarray, sizeof(struct command_frag) *
-            (MAXPIPECOUNT + 2));
-    if (parse_command_with_pipe(cmd, cmdlen, fragarray) < 0) {
-        return -1;
+size_t frag_string_views(struct command_frag* frag,
+                         struct string_view** views) {
+    size_t count = 0;
+    views[count++] = &frag->stdinfile;
+    for (size_t i = 0; i < MAXOUTFILES; i++) {
+        views[count++] = &frag->stdoutfiles[i];
     }
+    views[count++] = &frag->stderrfile;
+    for (size_t i = 0; i < MAXFDREDIRS; i++) {
+        views[count++] = &frag->fdfiles[i];
+    }
+    for (size_t i = 0; i < ARGSMAXCOUNT; i++) {
+        views[count++] = &frag->arguments[i];
+    }
+    assert(count <= FRAGVIEWSMAX);
 
+    return count;
+}
+
+/*
+ * fragarray is terminated by a frag whose stderr_to_stdout_flag is -1
+ */
+int execute_frags(const struct command_frag* fragarray) {
     /* transform command_frag into pipe_command */
     struct pipe_command* pipesarray[MAXPIPECOUNT + 2];
     size_t pipearrayslen = 0;
@@ -492,6 +860,20 @@ int parse_execute(const char* cmd, size_t cmdlen) {
         }
     }
 
+    /* every argument expanded to nothing */
+    for (size_t i = 0; i < pipearrayslen; i++) {
+        if (pipesarray[i]->arglist[0] == NULL) {
+            if (pipearrayslen > 1) {
+                fprintf(stderr, "bsh: empty command in pipe.\n");
+                last_exit_status = 1;
+            } else {
+                last_exit_status = 0;
+            }
+            free_memory(pipesarray, pipearrayslen);
+            return 0;
+        }
+    }
+
     /* call execute_command */
     int err = execute_command(pipesarray, pipearrayslen);
     
@@ -501,44 +883,97 @@ int parse_execute(const char* cmd, size_t cmdlen) {
     return err;
 }
 
+int parse_execute(const char* cmd, size_t cmdlen) {
+    struct command_frag fragarray[MAXPIPECOUNT + 2];
+    bzero(fragarray, sizeof(struct command_frag) *
+            (MAXPIPECOUNT + 2));
+    if (parse_command_with_pipe(cmd, cmdlen, fragarray) < 0) {
+        return -1;
+    }
+
+    return execute_frags(fragarray);
+}
+
+
+/*
+ * return connector at cmdline[rank] and its length,
+ * or -1 if there is no connector
+ */
+int list_connector_at(const char* cmdline, size_t rank, size_t* seplen) {
+    if (rank > 0 && cmdline[rank - 1] == '\\') return -1;
+
+    if (cmdline[rank] == SPLITSIGN) {
+        *seplen = 1;
+        return SEQ;
+    } else if (cmdline[rank] == '&' && cmdline[rank + 1] == '&') {
+        *seplen = 2;
+        return AND;
+    } else if (cmdline[rank] == '|' && cmdline[rank + 1] == '|') {
+        *seplen = 2;
+        return OR;
+    }
+
+    return -1;
+}
 
 /*
  * ; ; ls ;
+ * test -f a && cat a || echo none
  */
 
 /* struct command_frag fragarray[MAXPIPECOUNT + 2] */
 int parse_and_execute_cmdline(const char* cmdline) {
+    test_stat_cache_clear();
+
+    size_t cmdlinelen = strlen(cmdline);
     size_t rank = 0;
     size_t scmdbeg = rank;
-    while (cmdline[rank] != '\0') {
-        if ((rank == 0 || (rank > 0 && cmdline[rank - 1] != '\\')) &&
-                cmdline[rank] == SPLITSIGN) {
-            size_t cmdlen = rank - scmdbeg;
-            /*
-             * filter following cases:
-             * ;;
-             * ;  ;
-             */
-            if (cmdlen > 0 &&
-                skip_whitespaces(cmdline + scmdbeg, cmdlen) < cmdlen) {
+    int connector = SEQ;    /* connector before current command */
+    while (1) {
+        size_t seplen = 0;
+        int next_connector = SEQ;
+        if (cmdline[rank] != '\0') {
+            size_t span = nested_span(cmdline + rank, cmdlinelen - rank);
+            if (span > 0) {
+                rank += span;
+                continue;
+            }
+            next_connector = list_connector_at(cmdline, rank, &seplen);
+            if (next_connector < 0) {
+                ++rank;
+                continue;
+            }
+        }
+
+        size_t cmdlen = rank - scmdbeg;
+        if (cmdlen > 0 &&
+            skip_whitespaces(cmdline + scmdbeg, cmdlen) < cmdlen) {
+            /* short-circuit on exit status of the previous command */
+            if (connector == SEQ ||
+                (connector == AND && last_exit_status == 0) ||
+                (connector == OR && last_exit_status != 0)) {
                 int err = parse_execute(cmdline + scmdbeg, cmdlen);
                 if (err < 0) {
                     return err;
                 }
             }
-
-            scmdbeg = rank + 1;
+        } else if (connector != SEQ || next_connector != SEQ) {
+            /*
+             * filter following cases:
+             * ;;
+             * ;  ;
+             * but && and || need commands on both sides
+             */
+            char ch = cmdline[rank];
+            if (ch == '\0') ch = (connector == OR) ? '|' : '&';
+            parse_error(ch);
+            return -1;
         }
-        
-        ++rank;
-    }
 
-    size_t cmdlen = rank - scmdbeg;
-    if (cmdlen > 0 && skip_whitespaces(cmdline + scmdbeg, cmdlen) < cmdlen) {
-        int err = parse_execute(cmdline + scmdbeg, cmdlen);
-        if (err < 0) {
-            return err;
-        }
+        if (cmdline[rank] == '\0') break;
+        connector = next_connector;
+        rank += seplen;
+        scmdbeg = rank;
     }
 
     return 0;
@@ -1,21 +1,42 @@
 #ifndef BDU_SHELL_PARSE_H
 #define BDU_SHELL_PARSE_H
 
+#include <sys/types.h>
+
 #include "util.h"
 
 #define ARGSMAXCOUNT        20      /* single command max args count */
 #define MAXPIPECOUNT        10      /* max pipe count */
 #define MAXCMDLINE          4096
+#define MAXOUTFILES         8       /* stdout fan-out: cmd > a > b >> c */
+#define MAXPROCSUBST        8       /* <(list) and >(list) of a command */
+#define MAXFDREDIRS         4       /* exec 3>file 4<file */
+#define FRAGVIEWSMAX        (ARGSMAXCOUNT + MAXOUTFILES + MAXFDREDIRS + 2)  /* string views in a frag */
+#define CLOSEDFD            -3      /* exec 3>&- */
 
 typedef struct command_frag command_frag;
 struct command_frag {
     struct string_view stdinfile;
-    struct string_view stdoutfile;
-    int                stdoutfile_openflag;
+    struct string_view stdoutfiles[MAXOUTFILES];
+    int                stdoutfile_openflags[MAXOUTFILES];
     struct string_view stderrfile;
     int                stderrfile_openflag;
     int                stderr_to_stdout_flag;
+    struct string_view fdfiles[MAXFDREDIRS];    /* file, &N or &- */
+    int                fdfile_fds[MAXFDREDIRS];
+    int                fdfile_openflags[MAXFDREDIRS];
     struct string_view arguments[ARGSMAXCOUNT];
+    int                split;           /* copies after |N|, 0 if none */
+    int                splitordered;    /* |Nk| */
+};
+
+/*
+ * exec 3>file: fd becomes a copy of srcfd
+ */
+typedef struct fd_redirection fd_redirection;
+struct fd_redirection {
+    int fd;
+    int srcfd;          /* owned by the command, CLOSEDFD closes fd */
 };
 
 typedef struct pipe_command pipe_command;
@@ -24,9 +45,37 @@ struct pipe_command {
     int   stdinfd;
     int   stdoutfd;
     int   stderrfd;
+    int   fanoutfds[MAXOUTFILES];   /* stdout goes to all of them */
+    size_t fanoutlen;
+    int   substfds[MAXPROCSUBST];   /* shell's ends of <(list), >(list) */
+    size_t substfdslen;
+    pid_t substpids[MAXPROCSUBST];
+    size_t substpidslen;
+    int   shellfds;     /* bit n: fd n is the shell's own, >&3 2>&1 */
+    struct fd_redirection fdredirs[MAXFDREDIRS];    /* exec only */
+    size_t fdredirlen;
+    int   split;        /* copies of the stage after |N|, see split.h */
+    int   splitordered;
+};
+
+/*
+ * connector between two commands of a command line:
+ * a ; b     run b anyway
+ * a && b    run b only if a succeeded
+ * a || b    run b only if a failed
+ */
+enum list_connector {
+    SEQ,
+    AND,
+    OR
 };
 
 void parse_error(char ch);
+/*
+ * return length of $(( ... )), <( ... ) or >( ... ) at str, which are
+ * single words whatever they contain, or 0
+ */
+size_t nested_span(const char* str, size_t len);
 size_t next_arg(const char* cmd, size_t cmdlen, struct string_view* sv);
 int parse_command_no_pipe(const struct string_view* cmdfrag,
                           int input_max,
@@ -35,6 +84,18 @@ int parse_command_no_pipe(const struct string_view* cmdfrag,
 int parse_command_with_pipe(const char* cmd,
                             size_t cmdlen,
                             struct command_frag* fragarray);
+int list_connector_at(const char* cmdline, size_t rank, size_t* seplen);
+/*
+ * collect pointers to every string view of frag into views,
+ * which has room for FRAGVIEWSMAX pointers, return count
+ */
+size_t frag_string_views(struct command_frag* frag,
+                         struct string_view** views);
+/* open redirections and expand arguments, NULL on error */
+struct pipe_command* mk_pipecommand(const struct command_frag* cmdfrag);
+/* also closes process substitutions and waits for them */
+void free_memory(struct pipe_command** pipecmds, size_t len);
+int execute_frags(const struct command_frag* fragarray);
 int parse_and_execute_cmdline(const char* cmdline);
 
 #endif /* BDU_SHELL_PARSE_H */
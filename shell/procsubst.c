@@ -0,0 +1,104 @@
+#include "procsubst.h"
+#include "bsh.h"
+#include "read.h"
+#include "script.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXINHERITED        64
+
+/*
+ * ends without close-on-exec, every later child of a substitution
+ * closes them, or a reader would wait for a writer that never ends
+ */
+static int inherited[MAXINHERITED];
+static size_t inheritedlen = 0;
+
+size_t procsubst_span(const char* str, size_t len) {
+    if (len < 3 || (str[0] != '<' && str[0] != '>') || str[1] != '(') return 0;
+
+    int depth = 0;
+    for (size_t i = 2; i < len; i++) {
+        char ch = str[i];
+        if (ch == '\n') {
+            return 0;
+        } else if (ch == '\\') {
+            ++i;
+        } else if (ch == '(') {
+            ++depth;
+        } else if (ch == ')') {
+            if (depth == 0) return i + 1;
+            --depth;
+        }
+    }
+    return 0;
+}
+
+int procsubst_start(const char* str, size_t len, int inherit, pid_t* pid) {
+    if (inherit && inheritedlen == MAXINHERITED) {
+        fprintf(stderr, "bsh: too many process substitutions.\n");
+        return -1;
+    }
+
+    /* <(list): the shell keeps the read end, >(list): the write end */
+    int output = (str[0] == '<');
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        fprintf(stderr, "bsh: pipe error for %s.\n", strerror(errno));
+        return -1;
+    }
+    int shellfd = output ? pipefd[0] : pipefd[1];
+    int childfd = output ? pipefd[1] : pipefd[0];
+
+    /* the child must not write out what the shell has buffered */
+    fflush(NULL);
+    if ((*pid = fork()) < 0) {
+        fprintf(stderr, "bsh: fork error for %s.\n", strerror(errno));
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    } else if (*pid == 0) {
+        for (size_t i = 0; i < inheritedlen; i++) close(inherited[i]);
+        close(shellfd);
+
+        int target = output ? STDOUT_FILENO : STDIN_FILENO;
+        if (dup2(childfd, target) < 0) {
+            fprintf(stderr, "bsh: dup2 failed %s\n", strerror(errno));
+            exit(1);
+        }
+        close(childfd);
+        if (target == STDIN_FILENO) input_forget(STDIN_FILENO);
+
+        char* text = mem_strndup(str + 2, len - 3);
+        if (text == NULL) exit(1);
+        script_tail_exec = 1;
+        /* the shell may be reading the same stdin */
+        script_owns_stdin = 0;
+        script_run_text(text);
+        exit(last_exit_status);
+    }
+
+    close(childfd);
+    if (inherit) {
+        fcntl(shellfd, F_SETFD, 0);
+        inherited[inheritedlen++] = shellfd;
+    }
+    return shellfd;
+}
+
+void procsubst_close(int fd) {
+    for (size_t i = 0; i < inheritedlen; i++) {
+        if (inherited[i] == fd) {
+            inherited[i] = inherited[--inheritedlen];
+            break;
+        }
+    }
+    close(fd);
+}
@@ -0,0 +1,31 @@
+#ifndef BDU_SHELL_PROCSUBST_H
+#define BDU_SHELL_PROCSUBST_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * process substitution <(list) and >(list)
+ *
+ * list runs in a child of the shell with its stdout (<) or stdin (>)
+ * on a pipe, the command sees the other end as /dev/fd/N, so both
+ * run at the same time and the data never touches the disk.
+ */
+
+/*
+ * return length of <( ... ) or >( ... ) starting at str, or 0 if str
+ * does not start a complete process substitution
+ */
+size_t procsubst_span(const char* str, size_t len);
+
+/*
+ * start the list of str[0, len) and return the shell's end of the
+ * pipe, or -1; an end passed to a command as /dev/fd/N has to be
+ * inherited (inherit != 0), other ends are close-on-exec
+ */
+int procsubst_start(const char* str, size_t len, int inherit, pid_t* pid);
+
+/* close an end returned by procsubst_start */
+void procsubst_close(int fd);
+
+#endif /* BDU_SHELL_PROCSUBST_H */
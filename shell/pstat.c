@@ -0,0 +1,342 @@
+#include "pstat.h"
+#include "bsh.h"
+#include "vars.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <errno.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define PSTATTICKMS         1
+#define RELAYLEN            (1024 * 1024)
+
+typedef struct pstat_stage pstat_stage;
+struct pstat_stage {
+    pid_t    pid;
+    int      pidfd;
+    int      done;
+    int      status;
+    uint64_t wchar;     /* bytes written, from /proc/pid/io */
+    double   end;       /* seconds since the pipeline started */
+};
+
+/*
+ * sampling: fd is the shell's copy of the read end;
+ * exact: the relay moves fd to outfd
+ */
+typedef struct pstat_edge pstat_edge;
+struct pstat_edge {
+    int                    fd;
+    int                    outfd;
+    int                    pipesize;
+    uint64_t               bytes;
+    double                 end;
+    double                 empty;   /* reader had nothing to read */
+    double                 full;    /* writer could not write */
+    const struct timespec* start;
+    pthread_t              thread;
+};
+
+static double since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int pstat_mode(struct pipe_command** pipe_commands) {
+    char** arglist = pipe_commands[0]->arglist;
+    if (strcmp(arglist[0], "pstat") != 0) {
+        const char* value = var_get("BSH_PIPESTATS", 13);
+        if (value == NULL || value[0] == '\0' || strcmp(value, "0") == 0) {
+            return PSTAT_OFF;
+        }
+        return strcmp(value, "exact") == 0 ? PSTAT_EXACT : PSTAT_SAMPLE;
+    }
+
+    int mode = PSTAT_SAMPLE;
+    size_t skip = 1;
+    if (arglist[1] && strcmp(arglist[1], "-x") == 0) {
+        mode = PSTAT_EXACT;
+        skip = 2;
+    }
+    if (arglist[skip] == NULL) {
+        fprintf(stderr, "usage: pstat [-x] command [| command...]\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < skip; i++) mem_free(arglist[i]);
+    size_t i = 0;
+    do {
+        arglist[i] = arglist[i + skip];
+    } while (arglist[i++] != NULL);
+    return mode;
+}
+
+/*
+ * splice one edge across, the time spent waiting on an empty input
+ * is read-blocked time of the next stage, on a full output
+ * write-blocked time of the previous one
+ */
+static void* relay(void* arg) {
+    struct pstat_edge* edge = (struct pstat_edge*)arg;
+
+    while (1) {
+        ssize_t n = splice(edge->fd, NULL, edge->outfd, NULL, RELAYLEN,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            edge->bytes += n;
+            continue;
+        }
+        if (n == 0) break;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) break;
+
+        int queued = 0;
+        struct pollfd pfd;
+        double* waited;
+        if (ioctl(edge->fd, FIONREAD, &queued) < 0 || queued == 0) {
+            pfd.fd = edge->fd;
+            pfd.events = POLLIN;
+            waited = &edge->empty;
+        } else {
+            pfd.fd = edge->outfd;
+            pfd.events = POLLOUT;
+            waited = &edge->full;
+        }
+        double begin = since(edge->start);
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+        *waited += since(edge->start) - begin;
+    }
+
+    edge->end = since(edge->start);
+    close(edge->fd);
+    close(edge->outfd);
+    return NULL;
+}
+
+/*
+ * one sample of every edge still read by the shell,
+ * dt seconds passed since the last one
+ */
+static void sample_edges(struct pstat_edge* edges, size_t len,
+                         struct pstat_stage* stages, double now, double dt) {
+    for (size_t i = 0; i < len; i++) {
+        struct pstat_edge* edge = edges + i;
+        if (edge->fd < 0) continue;
+
+        int queued = 0;
+        if (ioctl(edge->fd, FIONREAD, &queued) < 0) continue;
+        if (queued == 0) {
+            if (stages[i].done) {
+                /* drained after its writer exited */
+                edge->end = now;
+                close(edge->fd);
+                edge->fd = -1;
+            } else {
+                edge->empty += dt;
+            }
+        } else if (queued >= edge->pipesize) {
+            edge->full += dt;
+        }
+    }
+}
+
+static uint64_t proc_wchar(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return 0;
+
+    char line[128];
+    unsigned long long wchar = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "wchar: %llu", &wchar) == 1) break;
+    }
+    fclose(fp);
+    return wchar;
+}
+
+/*
+ * reap the stage if it has exited, the exit is looked at first
+ * so /proc/pid/io still has its final counts
+ */
+static int stage_exited(struct pstat_stage* stage, double now) {
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, stage->pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0) {
+        stage->done = 1;
+        stage->status = 1;
+    } else if (info.si_pid == 0) {
+        return 0;
+    } else {
+        stage->wchar = proc_wchar(stage->pid);
+        int status = 0;
+        while (waitpid(stage->pid, &status, 0) < 0 && errno == EINTR) {}
+        stage->status = exit_status(status);
+        stage->done = 1;
+    }
+
+    stage->end = now;
+    if (stage->pidfd >= 0) close(stage->pidfd);
+    return 1;
+}
+
+static void report(int mode, struct pipe_command** pipe_commands, size_t len,
+                   struct pstat_stage* stages, struct pstat_edge* edges,
+                   double elapsed) {
+    fprintf(stderr, "pstat mode=%s stages=%zu elapsed_ms=%.3f\n",
+            mode == PSTAT_EXACT ? "exact" : "sample", len, elapsed * 1e3);
+    for (size_t i = 0; i < len; i++) {
+        double readblocked = i > 0 ? edges[i - 1].empty : 0;
+        double writeblocked = i + 1 < len ? edges[i].full : 0;
+        fprintf(stderr, "pstat stage=%zu cmd=%s pid=%d status=%d elapsed_ms=%.3f "
+                "read_blocked_ms=%.3f write_blocked_ms=%.3f\n",
+                i, pipe_commands[i]->arglist[0], (int)stages[i].pid,
+                stages[i].status, stages[i].end * 1e3,
+                readblocked * 1e3, writeblocked * 1e3);
+    }
+    for (size_t i = 0; i + 1 < len; i++) {
+        struct pstat_edge* edge = edges + i;
+        uint64_t bytes = mode == PSTAT_EXACT ? edge->bytes : stages[i].wchar;
+        double mbps = edge->end > 0 ? (double)bytes / edge->end / 1e6 : 0;
+        fprintf(stderr, "pstat edge=%zu from=%zu to=%zu bytes=%llu "
+                "elapsed_ms=%.3f mb_per_s=%.1f\n",
+                i, i, i + 1, (unsigned long long)bytes, edge->end * 1e3, mbps);
+    }
+}
+
+int execute_pstat(struct pipe_command** pipe_commands, size_t commands_len, int mode) {
+    struct pstat_stage stages[MAXPIPECOUNT + 1];
+    struct pstat_edge edges[MAXPIPECOUNT];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* fork every stage, the shell keeps an end of each edge */
+    size_t started = 0;
+    size_t edgeslen = 0;
+    int infd = pipe_commands[0]->stdinfd;
+    for (; started < commands_len; started++) {
+        struct pipe_command* command = pipe_commands[started];
+        int outfd = command->stdoutfd;
+        int nextfd = -1;
+        if (started + 1 < commands_len) {
+            struct pstat_edge* edge = edges + edgeslen;
+            int pipefd[2];
+            if (pipe2(pipefd, O_CLOEXEC) < 0) break;
+            bzero(edge, sizeof(*edge));
+            edge->fd = pipefd[0];
+            edge->outfd = -1;
+            edge->pipesize = fcntl(pipefd[0], F_GETPIPE_SZ);
+            edge->start = &start;
+            outfd = pipefd[1];
+            nextfd = pipefd[0];
+
+            if (mode == PSTAT_EXACT) {
+                int relayfd[2];
+                if (pipe2(relayfd, O_CLOEXEC) < 0) {
+                    close(pipefd[0]);
+                    close(pipefd[1]);
+                    break;
+                }
+                edge->outfd = relayfd[1];
+                nextfd = relayfd[0];
+                if (pthread_create(&edge->thread, NULL, relay, edge) != 0) {
+                    close(pipefd[0]);
+                    close(pipefd[1]);
+                    close(relayfd[0]);
+                    close(relayfd[1]);
+                    break;
+                }
+            }
+            edgeslen += 1;
+        }
+
+        struct pstat_stage* stage = stages + started;
+        stage->pid = spawn_command(command->arglist, infd, outfd, command->stderrfd);
+        stage->done = 0;
+        stage->status = 0;
+        stage->wchar = 0;
+        stage->end = 0;
+        stage->pidfd = stage->pid > 0 ? (int)syscall(SYS_pidfd_open, stage->pid, 0) : -1;
+
+        /* a sampled read end stays with the shell until its reader exits */
+        if (started > 0 && mode == PSTAT_EXACT) close(infd);
+        if (started + 1 < commands_len) close(outfd);
+        infd = nextfd;
+        if (stage->pid < 0) {
+            started += 1;
+            break;
+        }
+    }
+    if (started < commands_len && infd >= 0 && mode == PSTAT_EXACT) close(infd);
+
+    /* wait for the stages, sampling the edges meanwhile */
+    size_t live = 0;
+    for (size_t i = 0; i < started; i++) {
+        if (stages[i].pid < 0) {
+            stages[i].done = 1;
+            stages[i].status = 127;
+        } else {
+            live += 1;
+        }
+    }
+    double last = 0;
+    while (live > 0) {
+        struct pollfd pfds[MAXPIPECOUNT + 1];
+        nfds_t nfds = 0;
+        int timeout = mode == PSTAT_SAMPLE ? PSTATTICKMS : -1;
+        for (size_t i = 0; i < started; i++) {
+            if (stages[i].done) continue;
+            if (stages[i].pidfd < 0) {
+                timeout = PSTATTICKMS;
+                continue;
+            }
+            pfds[nfds].fd = stages[i].pidfd;
+            pfds[nfds].events = POLLIN;
+            nfds += 1;
+        }
+        if (poll(pfds, nfds, timeout) < 0 && errno != EINTR) break;
+
+        double now = since(&start);
+        if (mode == PSTAT_SAMPLE) sample_edges(edges, edgeslen, stages, now, now - last);
+        last = now;
+
+        for (size_t i = 0; i < started; i++) {
+            if (stages[i].done || !stage_exited(stages + i, now)) continue;
+            live -= 1;
+            /* the reader is gone, its writer gets EPIPE */
+            if (i > 0 && mode == PSTAT_SAMPLE && edges[i - 1].fd >= 0) {
+                if (edges[i - 1].end == 0) edges[i - 1].end = now;
+                close(edges[i - 1].fd);
+                edges[i - 1].fd = -1;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < edgeslen; i++) {
+        if (mode == PSTAT_EXACT) {
+            pthread_join(edges[i].thread, NULL);
+        } else if (edges[i].fd >= 0) {
+            if (edges[i].end == 0) edges[i].end = since(&start);
+            close(edges[i].fd);
+        }
+    }
+
+    if (started < commands_len) {
+        fprintf(stderr, "bsh: pstat: cannot start the pipeline.\n");
+        return -1;
+    }
+    report(mode, pipe_commands, commands_len, stages, edges, since(&start));
+    return stages[commands_len - 1].status;
+}
@@ -0,0 +1,45 @@
+#ifndef BDU_SHELL_PSTAT_H
+#define BDU_SHELL_PSTAT_H
+
+#include <stddef.h>
+
+#include "parse.h"
+
+/*
+ * pipe statistics
+ *
+ * BSH_PIPESTATS=1 cmd | cmd...      sample every edge
+ * BSH_PIPESTATS=exact               count exactly
+ * pstat [-x] cmd | cmd...           one pipeline, -x counts exactly
+ *
+ * every stage runs as a process, after the pipeline a report goes to
+ * stderr, one "pstat key=value..." line for the pipeline, each stage
+ * and each edge.
+ *
+ * sampling reads FIONREAD of every pipe once a millisecond: an empty
+ * pipe counts as read-blocked time of its reader, a full one as
+ * write-blocked time of its writer; the bytes of an edge are the
+ * wchar of its writer from /proc/pid/io. the exact mode puts a relay
+ * thread into every edge which splice(2)s the data across and counts
+ * the bytes and the time it waits on either side.
+ */
+
+enum pstat_mode {
+    PSTAT_OFF,
+    PSTAT_SAMPLE,
+    PSTAT_EXACT
+};
+
+/*
+ * return the mode for this pipeline and remove a pstat prefix,
+ * -1 if pstat has no command
+ */
+int pstat_mode(struct pipe_command** pipe_commands);
+
+/*
+ * run the pipeline and report, return exit status of the last
+ * command or -1 if it could not be started
+ */
+int execute_pstat(struct pipe_command** pipe_commands, size_t commands_len, int mode);
+
+#endif /* BDU_SHELL_PSTAT_H */
@@ -0,0 +1,355 @@
+#include "read.h"
+#include "vars.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUTBUFLEN         (64 * 1024)
+#define INPUTBUFS           16
+
+/*
+ * lookahead of one fd, data in buf[start, end) is read from the
+ * file but not consumed by the shell yet
+ */
+typedef struct input_buf input_buf;
+struct input_buf {
+    int    used;
+    int    fd;
+    char*  buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    int    bytewise;    /* never read past the newline */
+};
+
+static struct input_buf inputs[INPUTBUFS];
+
+static struct input_buf* input_find(int fd) {
+    for (size_t i = 0; i < INPUTBUFS; i++) {
+        if (inputs[i].used && inputs[i].fd == fd) return inputs + i;
+    }
+    return NULL;
+}
+
+static struct input_buf* input_get(int fd) {
+    struct input_buf* ib = input_find(fd);
+    if (ib) return ib;
+
+    for (size_t i = 0; i < INPUTBUFS; i++) {
+        ib = inputs + i;
+        if (ib->used) continue;
+        /* buffers of forgotten fds are reused */
+        if (ib->buf == NULL) {
+            ib->buf = (char*)mem_alloc(INPUTBUFLEN);
+            if (ib->buf == NULL) return NULL;
+            ib->cap = INPUTBUFLEN;
+        }
+        ib->used  = 1;
+        ib->fd    = fd;
+        ib->start = 0;
+        ib->end   = 0;
+        /*
+         * nobody can be handed the read-ahead of a pipe, a tty
+         * returns at most one line per read(2) anyway
+         */
+        ib->bytewise = lseek(fd, 0, SEEK_CUR) < 0 && !isatty(fd);
+        return ib;
+    }
+    return NULL;
+}
+
+void input_set_private(int fd) {
+    struct input_buf* ib = input_get(fd);
+    if (ib) ib->bytewise = 0;
+}
+
+void input_forget(int fd) {
+    struct input_buf* ib = input_find(fd);
+    if (ib) ib->used = 0;
+}
+
+void input_move(int fd, int newfd) {
+    input_forget(newfd);
+    struct input_buf* ib = input_find(fd);
+    if (ib) ib->fd = newfd;
+}
+
+void input_sync_all() {
+    for (size_t i = 0; i < INPUTBUFS; i++) {
+        struct input_buf* ib = inputs + i;
+        if (!ib->used || ib->start == ib->end) continue;
+
+        off_t ahead = (off_t)(ib->end - ib->start);
+        if (lseek(ib->fd, -ahead, SEEK_CUR) >= 0) {
+            ib->start = ib->end = 0;
+        }
+    }
+}
+
+size_t input_take(int fd, char* buf, size_t len) {
+    struct input_buf* ib = input_find(fd);
+    if (ib == NULL || ib->start == ib->end) return 0;
+
+    size_t n = ib->end - ib->start < len ? ib->end - ib->start : len;
+    memcpy(buf, ib->buf + ib->start, n);
+    ib->start += n;
+    if (ib->start == ib->end) ib->start = ib->end = 0;
+    return n;
+}
+
+int input_give_back(int fd, const char* data, size_t len) {
+    if (len == 0) return 0;
+    if (lseek(fd, -(off_t)len, SEEK_CUR) >= 0) return 0;
+
+    struct input_buf* ib = input_get(fd);
+    if (ib == NULL) return -1;
+    size_t ahead = ib->end - ib->start;
+    if (ahead + len > ib->cap) {
+        char* p = (char*)mem_realloc(ib->buf, ahead + len);
+        if (p == NULL) return -1;
+        ib->buf = p;
+        ib->cap = ahead + len;
+    }
+    /* data was read before the lookahead, it goes in front */
+    memmove(ib->buf + len, ib->buf + ib->start, ahead);
+    memcpy(ib->buf, data, len);
+    ib->start = 0;
+    ib->end   = ahead + len;
+    return 0;
+}
+
+/*
+ * return length of next line including '\n', 0 at EOF, -1 on error,
+ * *line stays valid until the next call
+ */
+static ssize_t input_getline(struct input_buf* ib, const char** line) {
+    size_t scanned = ib->start;
+    while (1) {
+        char* newline = memchr(ib->buf + scanned, '\n', ib->end - scanned);
+        if (newline) {
+            size_t len = newline - (ib->buf + ib->start) + 1;
+            *line = ib->buf + ib->start;
+            ib->start += len;
+            return (ssize_t)len;
+        }
+
+        /* make room for more input */
+        if (ib->start > 0) {
+            memmove(ib->buf, ib->buf + ib->start, ib->end - ib->start);
+            ib->end -= ib->start;
+            ib->start = 0;
+        }
+        if (ib->end == ib->cap) {
+            char* p = (char*)mem_realloc(ib->buf, ib->cap * 2);
+            if (p == NULL) return -1;
+            ib->buf = p;
+            ib->cap *= 2;
+        }
+        scanned = ib->end;
+
+        ssize_t rdcnt;
+        do {
+            rdcnt = read(ib->fd, ib->buf + ib->end,
+                         ib->bytewise ? 1 : ib->cap - ib->end);
+        } while (rdcnt < 0 && errno == EINTR);
+        if (rdcnt < 0) return -1;
+        if (rdcnt == 0) {
+            /* last line without '\n', a tty may go on after EOF */
+            size_t len = ib->end - ib->start;
+            *line = ib->buf + ib->start;
+            ib->start = ib->end = 0;
+            return (ssize_t)len;
+        }
+        ib->end += rdcnt;
+    }
+}
+
+ssize_t input_readline(int fd, char* buf, size_t len) {
+    struct input_buf* ib = input_get(fd);
+    if (ib == NULL) return -1;
+
+    const char* line;
+    ssize_t linelen = input_getline(ib, &line);
+    if (linelen <= 0) return linelen;
+    size_t n = (size_t)linelen < len ? (size_t)linelen : len - 1;
+    memcpy(buf, line, n);
+    buf[n] = '\0';
+    return linelen;
+}
+
+static int is_ifs_space(const char* ifs, char ch) {
+    return (ch == ' ' || ch == '\t' || ch == '\n') && strchr(ifs, ch) != NULL;
+}
+
+static int is_ifs(const char* ifs, char ch) {
+    return ch != '\0' && strchr(ifs, ch) != NULL;
+}
+
+static size_t skip_ifs_spaces(const char* ifs, const char* str, size_t len, size_t pos) {
+    while (pos < len && is_ifs_space(ifs, str[pos])) ++pos;
+    return pos;
+}
+
+/*
+ * assign fields of str[0, len) to names
+ */
+static void split_fields(char** names, const char* str, size_t len) {
+    const char* ifs = var_get("IFS", 3);
+    if (ifs == NULL) ifs = " \t\n";
+
+    size_t pos = skip_ifs_spaces(ifs, str, len, 0);
+    for (size_t i = 0; names[i]; i++) {
+        const char* name = names[i];
+        if (names[i + 1] == NULL) {
+            /* the last name takes the rest without trailing blanks */
+            size_t end = len;
+            while (end > pos && is_ifs_space(ifs, str[end - 1])) --end;
+            var_set_len(name, strlen(name), str + pos, end - pos);
+            break;
+        }
+
+        size_t end = pos;
+        while (end < len && !is_ifs(ifs, str[end])) ++end;
+        var_set_len(name, strlen(name), str + pos, end - pos);
+
+        pos = skip_ifs_spaces(ifs, str, len, end);
+        if (pos < len && is_ifs(ifs, str[pos]) && !is_ifs_space(ifs, str[pos])) {
+            pos = skip_ifs_spaces(ifs, str, len, pos + 1);
+        }
+    }
+}
+
+/*
+ * read a line, without -r a backslash escapes the next character
+ * and joins lines ending with one; return 0 if a complete line was
+ * read, 1 at EOF
+ */
+static int read_line(struct input_buf* ib, int raw, char** names) {
+    const char* line;
+    ssize_t len = input_getline(ib, &line);
+    if (len < 0) {
+        fprintf(stderr, "bsh: read: read error for %s.\n", strerror(errno));
+        return 1;
+    }
+    int status = (len > 0 && line[len - 1] == '\n') ? 0 : 1;
+    if (status == 0) len -= 1;
+
+    if (raw || memchr(line, '\\', len) == NULL) {
+        /* fields are taken from the lookahead buffer in place */
+        split_fields(names, line, len);
+        return status;
+    }
+
+    char* text = NULL;
+    size_t textlen = 0;
+    size_t textcap = 0;
+    while (1) {
+        if (textlen + len + 1 > textcap) {
+            textcap = (textlen + len + 1) * 2;
+            char* p = (char*)mem_realloc(text, textcap);
+            if (p == NULL) {
+                mem_free(text);
+                fprintf(stderr, "bsh: read: out of memory.\n");
+                return 1;
+            }
+            text = p;
+        }
+
+        int joined = 0;
+        for (ssize_t i = 0; i < len; i++) {
+            if (line[i] != '\\') {
+                text[textlen++] = line[i];
+            } else if (i + 1 < len) {
+                text[textlen++] = line[++i];
+            } else {
+                /* backslash-newline */
+                joined = (status == 0);
+            }
+        }
+        if (!joined) break;
+
+        len = input_getline(ib, &line);
+        if (len < 0) break;
+        status = (len > 0 && line[len - 1] == '\n') ? 0 : 1;
+        if (status == 0) len -= 1;
+    }
+
+    split_fields(names, text, textlen);
+    mem_free(text);
+    return status;
+}
+
+static int is_name(const char* name) {
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_') return 0;
+    for (const char* p = name + 1; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_') return 0;
+    }
+    return 1;
+}
+
+int do_read(char** arglist, int stdinfd, int shared) {
+    static char* reply[] = { "REPLY", NULL };
+
+    int raw = 0;
+    int fd = stdinfd >= 0 ? stdinfd : STDIN_FILENO;
+    /* read x <&3 reads on with the lookahead of fd 3 */
+    if (shared) stdinfd = -1;
+    size_t i = 1;
+    for (; arglist[i] && arglist[i][0] == '-' && arglist[i][1] != '\0'; i++) {
+        const char* opt = arglist[i];
+        if (strcmp(opt, "--") == 0) {
+            i += 1;
+            break;
+        } else if (strcmp(opt, "-r") == 0) {
+            raw = 1;
+        } else if (strncmp(opt, "-u", 2) == 0) {
+            const char* value = opt[2] ? opt + 2 : arglist[++i];
+            char* end = NULL;
+            long ufd = value ? strtol(value, &end, 10) : -1;
+            if (value == NULL || *end != '\0' || ufd < 0 || ufd > 1024 * 1024) {
+                fprintf(stderr, "bsh: read: %s: invalid file descriptor.\n",
+                        value ? value : "");
+                return 2;
+            }
+            fd = (int)ufd;
+        } else {
+            fprintf(stderr, "bsh: read: %s: invalid option.\n", opt);
+            fprintf(stderr, "usage: read [-r] [-u fd] [name...]\n");
+            return 2;
+        }
+    }
+
+    char** names = arglist[i] ? arglist + i : reply;
+    for (size_t j = 0; names[j]; j++) {
+        if (!is_name(names[j])) {
+            fprintf(stderr, "bsh: read: '%s': not a valid identifier.\n", names[j]);
+            return 2;
+        }
+    }
+
+    struct input_buf* ib = stdinfd >= 0 ? NULL : input_get(fd);
+    if (ib) return read_line(ib, raw, names);
+
+    /*
+     * read x < file: the fd is gone after this command;
+     * no lookahead slot left: one byte at a time never reads too far
+     */
+    struct input_buf tmp;
+    tmp.used     = 1;
+    tmp.fd       = fd;
+    tmp.cap      = stdinfd >= 0 ? INPUTBUFLEN : 128;
+    tmp.start    = 0;
+    tmp.end      = 0;
+    tmp.bytewise = stdinfd < 0;
+    tmp.buf      = (char*)mem_alloc(tmp.cap);
+    if (tmp.buf == NULL) return 1;
+    int status = read_line(&tmp, raw, names);
+    mem_free(tmp.buf);
+    return status;
+}
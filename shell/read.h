@@ -0,0 +1,63 @@
+#ifndef BDU_SHELL_READ_H
+#define BDU_SHELL_READ_H
+
+#include <sys/types.h>
+
+/*
+ * read [-r] [-u fd] [name...]
+ *
+ * read one line and split it into fields by $IFS, the last name
+ * gets the rest of the line, REPLY is used without names.
+ *
+ * the shell keeps a lookahead buffer per fd across calls, so a
+ * while read loop costs one read(2) per block instead of one per
+ * byte. the data read ahead has to be handed back before any other
+ * process reads the same open file, see input_sync_all; a pipe is
+ * read one byte at a time since its data cannot be handed back,
+ * unless the shell is its only reader, see input_set_private.
+ *
+ * stdinfd is the file of read x < file or -1, shared is non-zero if
+ * it is a descriptor of the shell, read x <&3
+ */
+int do_read(char** arglist, int stdinfd, int shared);
+
+/*
+ * give read-ahead data back before external commands run:
+ * seekable fds are moved back with lseek(2), the read-ahead of a
+ * pipe cannot be returned and stays with the shell
+ */
+void input_sync_all();
+
+/*
+ * an in-process stage reads fd of the shell: copy at most len
+ * bytes of the lookahead to buf and consume them, return the count
+ */
+size_t input_take(int fd, char* buf, size_t len);
+
+/*
+ * the stage is done, data it read but did not consume goes back to
+ * the file with lseek(2) or in front of the lookahead of a pipe
+ */
+int input_give_back(int fd, const char* data, size_t len);
+
+/*
+ * next command line of the interactive loop, read through the
+ * lookahead so read x sees the lines after it. at most len - 1 bytes
+ * are stored with '\0', return the full length of the line including
+ * '\n', 0 at EOF, -1 on error
+ */
+ssize_t input_readline(int fd, char* buf, size_t len);
+
+/*
+ * nothing but the shell reads fd until it is closed, so the lookahead
+ * of a pipe can be read in blocks as well
+ */
+void input_set_private(int fd);
+
+/* fd is about to be closed or replaced, drop its lookahead */
+void input_forget(int fd);
+
+/* newfd refers to the file of fd now and takes over its lookahead */
+void input_move(int fd, int newfd);
+
+#endif /* BDU_SHELL_READ_H */
@@ -0,0 +1,261 @@
+#include "record.h"
+#include "bsh.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORDVERSION       1
+
+extern char** environ;
+
+static FILE* record_fp = NULL;
+
+uint64_t record_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int record_open(const char* path) {
+    record_fp = fopen(path, "w");
+    if (record_fp == NULL) {
+        fprintf(stderr, "bsh: %s: %s.\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(record_fp, "bsh-record %d\n", RECORDVERSION);
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd))) fprintf(record_fp, "cwd %s\n", cwd);
+    for (char** env = environ; *env; env++) {
+        /* one entry a line */
+        if (strchr(*env, '\n') == NULL) fprintf(record_fp, "env %s\n", *env);
+    }
+    fflush(record_fp);
+    return 0;
+}
+
+void record_command(const char* line, int status, uint64_t elapsed_us) {
+    if (record_fp == NULL) return;
+    fprintf(record_fp, "cmd %llu %d %s\n",
+            (unsigned long long)elapsed_us, status, line);
+    /* a session may end with a kill */
+    fflush(record_fp);
+}
+
+void record_close() {
+    if (record_fp) fclose(record_fp);
+    record_fp = NULL;
+}
+
+typedef struct replay_cmd replay_cmd;
+struct replay_cmd {
+    char*    name;          /* first word of the line */
+    uint64_t recorded_us;
+    uint64_t replayed_us;
+    int      recorded_status;
+    int      replayed_status;
+};
+
+typedef struct replay_log replay_log;
+struct replay_log {
+    struct replay_cmd* cmds;
+    size_t             len;
+    size_t             cap;
+    char**             lines;
+};
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_name(const void* a, const void* b) {
+    return strcmp(((const struct replay_cmd*)a)->name,
+                  ((const struct replay_cmd*)b)->name);
+}
+
+/* nearest rank percentile of sorted values */
+static uint64_t percentile(const uint64_t* values, size_t len, int p) {
+    size_t rank = (len * p + 99) / 100;
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * report one line for cmds[0, len), values is scratch space of len
+ */
+static void report(const char* name, const struct replay_cmd* cmds, size_t len,
+                   uint64_t* values) {
+    uint64_t rec[2], rep[2];
+    for (size_t i = 0; i < len; i++) values[i] = cmds[i].recorded_us;
+    qsort(values, len, sizeof(uint64_t), cmp_u64);
+    rec[0] = percentile(values, len, 50);
+    rec[1] = percentile(values, len, 99);
+    for (size_t i = 0; i < len; i++) values[i] = cmds[i].replayed_us;
+    qsort(values, len, sizeof(uint64_t), cmp_u64);
+    rep[0] = percentile(values, len, 50);
+    rep[1] = percentile(values, len, 99);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (cmds[i].recorded_status != cmds[i].replayed_status) mismatches += 1;
+    }
+    fprintf(stderr, "replay cmd=%s count=%zu recorded_p50_us=%llu recorded_p99_us=%llu "
+            "p50_us=%llu p99_us=%llu p50_ratio=%.2f status_mismatches=%zu\n",
+            name, len, (unsigned long long)rec[0], (unsigned long long)rec[1],
+            (unsigned long long)rep[0], (unsigned long long)rep[1],
+            rec[0] > 0 ? (double)rep[0] / rec[0] : 0, mismatches);
+}
+
+static int load(FILE* fp, struct replay_log* log) {
+    char* line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    int version = 0;
+    int err = 0;
+    while ((len = getline(&line, &linecap, fp)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        if (version == 0) {
+            if (sscanf(line, "bsh-record %d", &version) != 1 || version != RECORDVERSION) {
+                err = -1;
+                break;
+            }
+            clearenv();
+        } else if (strncmp(line, "env ", 4) == 0) {
+            char* eq = strchr(line + 4, '=');
+            if (eq == NULL) continue;
+            *eq = '\0';
+            setenv(line + 4, eq + 1, 1);
+        } else if (strncmp(line, "cmd ", 4) == 0) {
+            unsigned long long us;
+            int status, offset = 0;
+            if (sscanf(line + 4, "%llu %d %n", &us, &status, &offset) != 2 || offset == 0) {
+                continue;
+            }
+            if (log->len == log->cap) {
+                size_t cap = log->cap ? log->cap * 2 : 256;
+                struct replay_cmd* cmds = mem_realloc(log->cmds, cap * sizeof(*cmds));
+                char** lines = mem_realloc(log->lines, cap * sizeof(char*));
+                if (cmds) log->cmds = cmds;
+                if (lines) log->lines = lines;
+                if (cmds == NULL || lines == NULL) {
+                    err = -1;
+                    break;
+                }
+                log->cap = cap;
+            }
+            const char* text = line + 4 + offset;
+            struct replay_cmd* cmd = log->cmds + log->len;
+            cmd->name = mem_strndup(text, strcspn(text, " \t"));
+            log->lines[log->len] = mem_strdup(text);
+            if (cmd->name == NULL || log->lines[log->len] == NULL) {
+                mem_free(cmd->name);
+                mem_free(log->lines[log->len]);
+                err = -1;
+                break;
+            }
+            cmd->recorded_us = us;
+            cmd->recorded_status = status;
+            cmd->replayed_us = 0;
+            cmd->replayed_status = 0;
+            log->len += 1;
+        }
+        /* cwd is replaced by the sandbox */
+    }
+    mem_free(line);
+    if (version == 0) err = -1;
+    return err;
+}
+
+static int remove_entry(const char* path, const struct stat* sb, int flag, struct FTW* ftw) {
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    if (remove(path) < 0) fprintf(stderr, "bsh: rm %s: %s.\n", path, strerror(errno));
+    return 0;
+}
+
+int replay(const char* path, const char* dir) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "bsh: %s: %s.\n", path, strerror(errno));
+        return -1;
+    }
+    struct replay_log log = { NULL, 0, 0, NULL };
+    int err = load(fp, &log);
+    fclose(fp);
+    if (err < 0) {
+        fprintf(stderr, "bsh: %s: not a bsh session record.\n", path);
+    }
+
+    char tmpdir[PATH_MAX];
+    int sandbox = -1;    /* fd of the cwd to go back to, it is removed */
+    if (err == 0 && dir == NULL) {
+        const char* tmp = getenv("TMPDIR");
+        snprintf(tmpdir, sizeof(tmpdir), "%s/bsh-replay.XXXXXX", tmp ? tmp : "/tmp");
+        dir = mkdtemp(tmpdir);
+        if (dir == NULL) {
+            fprintf(stderr, "bsh: mkdtemp error for %s.\n", strerror(errno));
+            err = -1;
+        } else if ((sandbox = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+            fprintf(stderr, "bsh: open error for %s.\n", strerror(errno));
+            rmdir(dir);
+            err = -1;
+        }
+    }
+    if (err == 0 && chdir(dir) < 0) {
+        fprintf(stderr, "bsh: cd %s: %s.\n", dir, strerror(errno));
+        err = -1;
+    }
+
+    /* run the session, the lines are consumed by the commands */
+    size_t ran = 0;
+    for (; err == 0 && ran < log.len; ran++) {
+        struct replay_cmd* cmd = log.cmds + ran;
+        uint64_t start = record_now_us();
+        int status = execute_line(log.lines[ran]);
+        cmd->replayed_us = record_now_us() - start;
+        cmd->replayed_status = last_exit_status;
+        if (status == -2) {
+            ran += 1;
+            break;
+        }
+    }
+
+    uint64_t* values = ran > 0 ? mem_alloc(ran * sizeof(uint64_t)) : NULL;
+    if (values) {
+        fprintf(stderr, "replay dir=%s commands=%zu recorded=%zu\n", dir, ran, log.len);
+        report("all", log.cmds, ran, values);
+        qsort(log.cmds, ran, sizeof(struct replay_cmd), cmp_name);
+        for (size_t i = 0; i < ran; ) {
+            size_t j = i + 1;
+            while (j < ran && strcmp(log.cmds[j].name, log.cmds[i].name) == 0) ++j;
+            report(log.cmds[i].name, log.cmds + i, j - i, values);
+            i = j;
+        }
+    }
+
+    /* the default sandbox goes with the session, a given dir stays */
+    if (sandbox >= 0) {
+        if (fchdir(sandbox) == 0) nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        close(sandbox);
+    }
+
+    mem_free(values);
+    for (size_t i = 0; i < log.len; i++) {
+        mem_free(log.cmds[i].name);
+        mem_free(log.lines[i]);
+    }
+    mem_free(log.cmds);
+    mem_free(log.lines);
+    return err;
+}
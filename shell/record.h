@@ -0,0 +1,32 @@
+#ifndef BDU_SHELL_RECORD_H
+#define BDU_SHELL_RECORD_H
+
+#include <stdint.h>
+
+/*
+ * session record and replay
+ *
+ * bsh --record log runs the interactive shell and logs every input
+ * line with its elapsed time and exit status, after a header with
+ * the environment and cwd of the session:
+ *
+ *     bsh-record 1
+ *     cwd /home/me
+ *     env PATH=/usr/bin:/bin
+ *     cmd 1520 0 ls -l
+ *
+ * bsh --replay log [dir] runs the lines again in dir (a new temporary
+ * directory by default, removed at the end) with the recorded
+ * environment, and reports p50/p99 latency per command name against
+ * the recording on stderr.
+ */
+int record_open(const char* path);
+void record_command(const char* line, int status, uint64_t elapsed_us);
+void record_close();
+
+int replay(const char* path, const char* dir);
+
+/* microseconds of CLOCK_MONOTONIC */
+uint64_t record_now_us();
+
+#endif /* BDU_SHELL_RECORD_H */
@@ -0,0 +1,133 @@
+#include "ring.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void futex_wait(_Atomic uint32_t* word, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT_PRIVATE, expected,
+            NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* word) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * the other side sleeps only after announcing it in *waiting and
+ * re-checking the ring, so bumping seq before looking at *waiting
+ * never loses a wakeup
+ */
+static void ring_notify(_Atomic uint32_t* seq, _Atomic int* waiting) {
+    atomic_fetch_add(seq, 1);
+    if (atomic_load(waiting)) futex_wake(seq);
+}
+
+int ring_init(struct ring* r, size_t size) {
+    assert(size > 0 && (size & (size - 1)) == 0);
+
+    r->buf = (char*)mem_alloc(size);
+    if (r->buf == NULL) return -1;
+    r->size = size;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->state, 0);
+    atomic_init(&r->dataseq, 0);
+    atomic_init(&r->spaceseq, 0);
+    atomic_init(&r->rwaiting, 0);
+    atomic_init(&r->wwaiting, 0);
+    return 0;
+}
+
+void ring_destroy(struct ring* r) {
+    mem_free(r->buf);
+    r->buf = NULL;
+}
+
+ssize_t ring_write(struct ring* r, const void* data, size_t len) {
+    const char* src = (const char*)data;
+    size_t done = 0;
+    size_t mask = r->size - 1;
+
+    while (done < len) {
+        if (atomic_load(&r->state) & RING_RCLOSED) return -1;
+
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t space = r->size - (tail - head);
+        if (space == 0) {
+            uint32_t seq = atomic_load(&r->spaceseq);
+            atomic_store(&r->wwaiting, 1);
+            if (atomic_load(&r->head) == head &&
+                !(atomic_load(&r->state) & RING_RCLOSED)) {
+                futex_wait(&r->spaceseq, seq);
+            }
+            atomic_store(&r->wwaiting, 0);
+            continue;
+        }
+
+        /* publish as much as fits in one batch */
+        size_t n = len - done < space ? len - done : space;
+        size_t offset = tail & mask;
+        size_t first = n < r->size - offset ? n : r->size - offset;
+        memcpy(r->buf + offset, src + done, first);
+        memcpy(r->buf, src + done + first, n - first);
+        atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+        done += n;
+
+        ring_notify(&r->dataseq, &r->rwaiting);
+    }
+
+    return (ssize_t)done;
+}
+
+ssize_t ring_read(struct ring* r, void* buf, size_t len) {
+    char* dst = (char*)buf;
+    size_t mask = r->size - 1;
+
+    while (1) {
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        size_t avail = tail - head;
+        if (avail == 0) {
+            if (atomic_load(&r->state) & RING_WCLOSED) {
+                /* producer may have published just before closing */
+                if (atomic_load(&r->tail) == head) return 0;
+                continue;
+            }
+            uint32_t seq = atomic_load(&r->dataseq);
+            atomic_store(&r->rwaiting, 1);
+            if (atomic_load(&r->tail) == tail &&
+                !(atomic_load(&r->state) & RING_WCLOSED)) {
+                futex_wait(&r->dataseq, seq);
+            }
+            atomic_store(&r->rwaiting, 0);
+            continue;
+        }
+
+        size_t n = len < avail ? len : avail;
+        size_t offset = head & mask;
+        size_t first = n < r->size - offset ? n : r->size - offset;
+        memcpy(dst, r->buf + offset, first);
+        memcpy(dst + first, r->buf, n - first);
+        atomic_store_explicit(&r->head, head + n, memory_order_release);
+
+        ring_notify(&r->spaceseq, &r->wwaiting);
+        return (ssize_t)n;
+    }
+}
+
+void ring_close_write(struct ring* r) {
+    atomic_fetch_or(&r->state, RING_WCLOSED);
+    ring_notify(&r->dataseq, &r->rwaiting);
+}
+
+void ring_close_read(struct ring* r) {
+    atomic_fetch_or(&r->state, RING_RCLOSED);
+    ring_notify(&r->spaceseq, &r->wwaiting);
+}
@@ -0,0 +1,51 @@
+#ifndef BDU_SHELL_RING_H
+#define BDU_SHELL_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RINGSIZE            (256 * 1024)    /* must be a power of 2 */
+
+/*
+ * lock-free single-producer/single-consumer byte ring
+ * connecting two in-process pipeline stages.
+ *
+ * data moves without locks, a side only sleeps on a futex
+ * when the ring is full (producer) or empty (consumer).
+ */
+typedef struct ring ring;
+struct ring {
+    char*                buf;
+    size_t               size;
+    _Atomic size_t       head;       /* consumer position */
+    _Atomic size_t       tail;       /* producer position */
+    _Atomic uint32_t     state;      /* RING_WCLOSED | RING_RCLOSED */
+    _Atomic uint32_t     dataseq;    /* bumped when data or EOF is published */
+    _Atomic uint32_t     spaceseq;   /* bumped when space is freed or reader left */
+    _Atomic int          rwaiting;   /* consumer sleeps on dataseq */
+    _Atomic int          wwaiting;   /* producer sleeps on spaceseq */
+};
+
+#define RING_WCLOSED        1       /* producer is done: EOF after data */
+#define RING_RCLOSED        2       /* consumer is gone: writes fail */
+
+int ring_init(struct ring* r, size_t size);
+void ring_destroy(struct ring* r);
+
+/*
+ * write all of data, blocking while the ring is full,
+ * return -1 if the consumer closed the ring
+ */
+ssize_t ring_write(struct ring* r, const void* data, size_t len);
+
+/*
+ * read at most len bytes, blocking while the ring is empty,
+ * return 0 at EOF
+ */
+ssize_t ring_read(struct ring* r, void* buf, size_t len);
+
+void ring_close_write(struct ring* r);
+void ring_close_read(struct ring* r);
+
+#endif /* BDU_SHELL_RING_H */
@@ -0,0 +1,1592 @@
+#include "script.h"
+#include "bsh.h"
+#include "vars.h"
+#include "read.h"
+#include "split.h"
+#include "procsubst.h"
+#include "builtins.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAXLOOPDEPTH        32
+#define MAXCALLDEPTH        256
+
+static const char BC_MAGIC[4] = { 'B', 'S', 'H', 'C' };
+
+/* programs which define functions, newest first */
+static struct bc_program* programs = NULL;
+static int call_depth = 0;
+
+int script_tail_exec = 0;
+int script_owns_stdin = 0;
+
+/*
+ * ----------------------------------------------------------------
+ * compiler
+ * ----------------------------------------------------------------
+ */
+
+typedef struct bc_loop bc_loop;
+struct bc_loop {
+    int      is_for;
+    uint32_t top;           /* target of continue */
+    uint32_t breaks;        /* chain of jumps to patch with loop end */
+};
+
+#if MAXLOOPDEPTH > 0x7f
+#error "loop level must fit into BC_REDIR_ARG"
+#endif
+
+typedef struct bc_compiler bc_compiler;
+struct bc_compiler {
+    struct bc_program*  prog;
+    size_t              codecap;
+    size_t              pipescap;
+    size_t              fragscap;
+    size_t              wordlistscap;
+    size_t              wordscap;
+    size_t              funcscap;
+
+    const char*         name;       /* for error messages */
+    size_t              rank;       /* scan position in pool */
+    int                 line;
+    struct string_view  stmt;       /* unconsumed part of current statement */
+    int                 stmtline;
+    int                 has_stmt;
+
+    struct bc_loop      loops[MAXLOOPDEPTH];
+    int                 loopdepth;
+    int                 error;
+};
+
+/*
+ * make room for one more element of size elemsize
+ */
+static int grow(void** array, size_t* cap, size_t len, size_t elemsize) {
+    if (len < *cap) return 0;
+
+    size_t newcap = *cap ? *cap * 2 : 16;
+    void* p = mem_realloc(*array, newcap * elemsize);
+    if (p == NULL) return -1;
+    *array = p;
+    *cap = newcap;
+    return 0;
+}
+
+static void compile_error(struct bc_compiler* c, const char* msg) {
+    if (!c->error) {
+        fprintf(stderr, "bsh: %s: line %d: %s.\n", c->name, c->stmtline, msg);
+    }
+    c->error = 1;
+}
+
+static uint32_t emit(struct bc_compiler* c, uint32_t op, uint32_t arg) {
+    struct bc_program* prog = c->prog;
+    if (grow((void**)&prog->code, &c->codecap, prog->codelen,
+             sizeof(struct bc_insn)) < 0) {
+        compile_error(c, "out of memory");
+        return 0;
+    }
+    prog->code[prog->codelen].op  = op;
+    prog->code[prog->codelen].arg = arg;
+    return (uint32_t)prog->codelen++;
+}
+
+static uint32_t here(struct bc_compiler* c) {
+    return (uint32_t)c->prog->codelen;
+}
+
+static void patch(struct bc_compiler* c, uint32_t insn, uint32_t target) {
+    if (!c->error) c->prog->code[insn].arg = target;
+}
+
+/*
+ * find next non-empty statement, statements are split by
+ * newline and ';', '#' at the beginning of a word starts a comment
+ */
+static int next_statement(struct bc_compiler* c) {
+    const char* pool = c->prog->pool;
+    size_t poollen = c->prog->poollen;
+
+    while (c->rank < poollen) {
+        size_t begin = c->rank;
+        size_t end = begin;
+        int startline = c->line;
+        while (end < poollen) {
+            char ch = pool[end];
+            size_t span = nested_span(pool + end, poollen - end);
+            if (span > 0) {
+                /* ; inside <(list) does not end the statement */
+                end += span;
+                continue;
+            }
+            if (ch == '\n') break;
+            if (ch == ';' && (end == 0 || pool[end - 1] != '\\')) break;
+            if (ch == '#' && (end == begin || isspace((unsigned char)pool[end - 1]))) break;
+            ++end;
+        }
+
+        /* skip comment and the separator */
+        size_t next = end;
+        if (next < poollen && pool[next] == '#') {
+            while (next < poollen && pool[next] != '\n') ++next;
+        }
+        if (next < poollen) {
+            if (pool[next] == '\n') c->line += 1;
+            next += 1;
+        }
+        c->rank = next;
+
+        size_t len = end - begin;
+        size_t ws = 0;
+        while (ws < len && isspace((unsigned char)pool[begin + ws])) ++ws;
+        while (len > ws && isspace((unsigned char)pool[begin + len - 1])) --len;
+        if (ws < len) {
+            c->stmt.str = pool + begin + ws;
+            c->stmt.len = len - ws;
+            c->stmtline = startline;
+            c->has_stmt = 1;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static size_t first_word_len(const struct string_view* stmt) {
+    size_t len = 0;
+    while (len < stmt->len && !isspace((unsigned char)stmt->str[len])) ++len;
+    return len;
+}
+
+static int stmt_keyword(struct bc_compiler* c, const char* kw) {
+    size_t len = first_word_len(&c->stmt);
+    return c->has_stmt && len == strlen(kw) && strncmp(c->stmt.str, kw, len) == 0;
+}
+
+/*
+ * drop len characters and following blanks from the current statement
+ */
+static void consume(struct bc_compiler* c, size_t len) {
+    c->stmt.str += len;
+    c->stmt.len -= len;
+    size_t ws = skip_whitespaces(c->stmt.str, c->stmt.len);
+    c->stmt.str += ws;
+    c->stmt.len -= ws;
+    if (c->stmt.len == 0) c->has_stmt = 0;
+}
+
+/*
+ * consume a closing keyword which must end its statement
+ */
+static void consume_closing(struct bc_compiler* c, const char* kw) {
+    consume(c, strlen(kw));
+    if (c->has_stmt) compile_error(c, "syntax error after closing keyword");
+}
+
+/*
+ * append frags up to the terminating one, return index of the pipe
+ */
+static uint32_t add_pipe(struct bc_compiler* c, const struct command_frag* fragarray) {
+    struct bc_program* prog = c->prog;
+    struct bc_range range;
+    range.first = (uint32_t)prog->fragslen;
+    range.count = 0;
+    for (size_t i = 0; fragarray[i].stderr_to_stdout_flag != -1; i++) {
+        if (grow((void**)&prog->frags, &c->fragscap, prog->fragslen,
+                 sizeof(struct command_frag)) < 0) {
+            compile_error(c, "out of memory");
+            return BC_NOARG;
+        }
+        prog->frags[prog->fragslen++] = fragarray[i];
+        range.count += 1;
+    }
+
+    if (grow((void**)&prog->pipes, &c->pipescap, prog->pipeslen,
+             sizeof(struct bc_range)) < 0) {
+        compile_error(c, "out of memory");
+        return BC_NOARG;
+    }
+    prog->pipes[prog->pipeslen] = range;
+    return (uint32_t)prog->pipeslen++;
+}
+
+static void compile_pipeline(struct bc_compiler* c, const char* cmd, size_t cmdlen) {
+    struct command_frag fragarray[MAXPIPECOUNT + 2];
+    bzero(fragarray, sizeof(fragarray));
+    if (parse_command_with_pipe(cmd, cmdlen, fragarray) < 0) {
+        compile_error(c, "syntax error");
+        return;
+    }
+
+    uint32_t pipe = add_pipe(c, fragarray);
+    if (pipe != BC_NOARG) emit(c, OP_PIPE, pipe);
+}
+
+/*
+ * a && b || c compiles into
+ *      PIPE a
+ *      JNZ  L1
+ *      PIPE b
+ * L1:  JZ   L2
+ *      PIPE c
+ * L2:
+ * a skipped command leaves the exit status untouched
+ */
+static void compile_list(struct bc_compiler* c) {
+    const char* cmd = c->stmt.str;
+    size_t cmdlen = c->stmt.len;
+    c->has_stmt = 0;
+
+    /* test reuses stat(2) results within one statement only */
+    emit(c, OP_STMT, 0);
+
+    size_t rank = 0;
+    size_t scmdbeg = 0;
+    int connector = SEQ;
+    uint32_t skip = BC_NOARG;
+    while (!c->error) {
+        size_t seplen = 0;
+        int next_connector = SEQ;
+        if (rank < cmdlen) {
+            size_t span = nested_span(cmd + rank, cmdlen - rank);
+            if (span > 0) {
+                rank += span;
+                continue;
+            }
+            next_connector = list_connector_at(cmd, rank, &seplen);
+            if (next_connector < 0 || next_connector == SEQ) {
+                ++rank;
+                continue;
+            }
+        }
+
+        size_t seglen = rank - scmdbeg;
+        if (seglen == 0 || skip_whitespaces(cmd + scmdbeg, seglen) == seglen) {
+            compile_error(c, "syntax error near && or ||");
+            return;
+        }
+        if (connector != SEQ) {
+            skip = emit(c, connector == AND ? OP_JNZ : OP_JZ, BC_NOARG);
+        }
+        compile_pipeline(c, cmd + scmdbeg, seglen);
+        if (skip != BC_NOARG) {
+            patch(c, skip, here(c));
+            skip = BC_NOARG;
+        }
+
+        if (rank >= cmdlen) break;
+        connector = next_connector;
+        rank += seplen;
+        scmdbeg = rank;
+    }
+}
+
+static int compile_block(struct bc_compiler* c, const char* const* terms);
+
+static int compile_until(struct bc_compiler* c, const char* const* terms,
+                         const char* what) {
+    int term = compile_block(c, terms);
+    if (term == -1) compile_error(c, what);
+    return term;
+}
+
+static struct bc_loop* push_loop(struct bc_compiler* c, int is_for, uint32_t top) {
+    if (c->loopdepth == MAXLOOPDEPTH) {
+        compile_error(c, "loops nested too deep");
+        return NULL;
+    }
+    struct bc_loop* loop = c->loops + c->loopdepth++;
+    loop->is_for = is_for;
+    loop->top    = top;
+    loop->breaks = BC_NOARG;
+    return loop;
+}
+
+static void pop_loop(struct bc_compiler* c, uint32_t end) {
+    struct bc_loop* loop = c->loops + --c->loopdepth;
+    uint32_t insn = loop->breaks;
+    while (insn != BC_NOARG && !c->error) {
+        uint32_t next = c->prog->code[insn].arg;
+        patch(c, insn, end);
+        insn = next;
+    }
+}
+
+static void compile_if(struct bc_compiler* c) {
+    static const char* const then_terms[] = { "then", NULL };
+    static const char* const body_terms[] = { "elif", "else", "fi", NULL };
+    static const char* const fi_terms[]   = { "fi", NULL };
+
+    uint32_t ends = BC_NOARG;   /* chain of jumps to the end */
+    consume(c, strlen("if"));
+    while (!c->error) {
+        compile_until(c, then_terms, "'then' expected");
+        if (c->error) return;
+        consume(c, strlen("then"));
+        uint32_t next = emit(c, OP_JNZ, BC_NOARG);
+        int term = compile_until(c, body_terms, "'fi' expected");
+        if (c->error) return;
+        ends = emit(c, OP_JMP, ends);
+        patch(c, next, here(c));
+
+        if (term == 0) {            /* elif */
+            consume(c, strlen("elif"));
+        } else if (term == 1) {     /* else */
+            consume(c, strlen("else"));
+            compile_until(c, fi_terms, "'fi' expected");
+            break;
+        } else {                    /* no branch taken */
+            emit(c, OP_STATUS, 0);
+            break;
+        }
+    }
+    if (c->error) return;
+
+    consume_closing(c, "fi");
+    while (ends != BC_NOARG && !c->error) {
+        uint32_t next = c->prog->code[ends].arg;
+        patch(c, ends, here(c));
+        ends = next;
+    }
+}
+
+/*
+ * non-zero if pipeline index never lets a child read the shell's
+ * stdin: the first command reads < file, assigns or is a built-in
+ * which keeps stdin, and no <(list) or >(list) forks a copy of the
+ * shell holding it
+ */
+static int pipe_keeps_stdin(const struct bc_program* prog, uint32_t index) {
+    const struct bc_range* range = prog->pipes + index;
+    for (uint32_t i = 0; i < range->count; i++) {
+        struct command_frag frag = prog->frags[range->first + i];
+        struct string_view* views[FRAGVIEWSMAX];
+        size_t count = frag_string_views(&frag, views);
+        for (size_t j = 0; j < count; j++) {
+            const struct string_view* sv = views[j];
+            if (sv->str && sv->len > 0 && procsubst_span(sv->str, sv->len) > 0) return 0;
+        }
+    }
+
+    const struct command_frag* first = prog->frags + range->first;
+    if (first->stdinfile.str != NULL) return 1;
+
+    size_t argc = 0;
+    while (argc < ARGSMAXCOUNT && first->arguments[argc].str) {
+        if (!is_assignment(first->arguments[argc].str)) break;
+        ++argc;
+    }
+    if (argc == ARGSMAXCOUNT || first->arguments[argc].str == NULL) return 1;
+    if (argc > 0) return 0;
+
+    /* $cmd may be anything, a function may read stdin */
+    char name[16];
+    const struct string_view* sv = first->arguments;
+    if (sv->len >= sizeof(name) || memchr(sv->str, '$', sv->len)) return 0;
+    memcpy(name, sv->str, sv->len);
+    name[sv->len] = '\0';
+    for (size_t i = 0; i < prog->funcslen; i++) {
+        if (prog->funcs[i].name.len == sv->len &&
+            strncmp(prog->funcs[i].name.str, name, sv->len) == 0) return 0;
+    }
+    if (script_has_function(name)) return 0;
+    return builtin_keeps_stdin(name, first->arguments[1].str != NULL);
+}
+
+/* every pipeline run by code in [from, to) keeps the shell's stdin */
+static int code_keeps_stdin(const struct bc_program* prog, uint32_t from, uint32_t to) {
+    for (uint32_t pc = from; pc < to; pc++) {
+        if (prog->code[pc].op == OP_PIPE && !pipe_keeps_stdin(prog, prog->code[pc].arg)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * a loop starts with
+ *      REDIR pipe|level
+ *      JNZ   out
+ * patched into JMP over both when done has no redirections
+ */
+static uint32_t emit_loop_redir(struct bc_compiler* c) {
+    uint32_t redir = emit(c, OP_REDIR, BC_NOARG);
+    emit(c, OP_JNZ, BC_NOARG);
+    return redir;
+}
+
+/*
+ * done [< file] [> file] [2> file]: the redirections hold for the
+ * whole loop, return non-zero if the loop is redirected
+ */
+static int compile_done(struct bc_compiler* c, uint32_t redir) {
+    consume(c, strlen("done"));
+    if (!c->has_stmt) {
+        if (!c->error) {
+            c->prog->code[redir].op  = OP_JMP;
+            c->prog->code[redir].arg = redir + 2;
+            /* never runs, but a cached program has no jump out of range */
+            c->prog->code[redir + 1].arg = redir + 2;
+        }
+        return 0;
+    }
+
+    struct command_frag fragarray[2];
+    bzero(fragarray, sizeof(fragarray));
+    fragarray[1].stderr_to_stdout_flag = -1;
+    if (parse_command_no_pipe(&c->stmt, 1, 1, fragarray) < 0 ||
+        fragarray[0].arguments[0].str != NULL) {
+        compile_error(c, "syntax error after closing keyword");
+        return 0;
+    }
+    c->has_stmt = 0;
+
+    uint32_t pipe = add_pipe(c, fragarray);
+    if (pipe == BC_NOARG) return 0;
+    uint32_t level = (uint32_t)c->loopdepth;
+    /* done < <(list): the loop may read the pipe in blocks */
+    if (!c->error && code_keeps_stdin(c->prog, redir + 2, here(c))) {
+        level |= BC_REDIR_OWNSTDIN;
+    }
+    patch(c, redir, BC_REDIR_ARG(pipe, level));
+    emit(c, OP_UNREDIR, (uint32_t)c->loopdepth);
+    return 1;
+}
+
+static void compile_while(struct bc_compiler* c, int until) {
+    static const char* const do_terms[]   = { "do", NULL };
+    static const char* const done_terms[] = { "done", NULL };
+
+    consume(c, strlen(until ? "until" : "while"));
+    uint32_t redir = emit_loop_redir(c);
+    uint32_t top = here(c);
+    compile_until(c, do_terms, "'do' expected");
+    if (c->error) return;
+    consume(c, strlen("do"));
+
+    uint32_t leave = emit(c, until ? OP_JZ : OP_JNZ, BC_NOARG);
+    if (push_loop(c, 0, top) == NULL) return;
+    compile_until(c, done_terms, "'done' expected");
+    emit(c, OP_JMP, top);
+
+    /* a loop exits with status 0 */
+    uint32_t end = here(c);
+    patch(c, leave, end);
+    pop_loop(c, end);
+    if (c->error) return;
+    int redirected = compile_done(c, redir);
+    emit(c, OP_STATUS, 0);
+    /* redirection failed: status 1 */
+    if (redirected) patch(c, redir + 1, here(c));
+}
+
+static int add_word(struct bc_compiler* c, const char* str, size_t len) {
+    struct bc_program* prog = c->prog;
+    if (grow((void**)&prog->words, &c->wordscap, prog->wordslen,
+             sizeof(struct string_view)) < 0) {
+        compile_error(c, "out of memory");
+        return -1;
+    }
+    prog->words[prog->wordslen].str = str;
+    prog->words[prog->wordslen].len = len;
+    prog->wordslen += 1;
+    return 0;
+}
+
+static void compile_for(struct bc_compiler* c) {
+    static const char* const do_terms[]   = { "do", NULL };
+    static const char* const done_terms[] = { "done", NULL };
+    struct bc_program* prog = c->prog;
+
+    consume(c, strlen("for"));
+    size_t namelen = first_word_len(&c->stmt);
+    if (!c->has_stmt || namelen == 0 || is_assignment(c->stmt.str) != 0) {
+        compile_error(c, "variable name expected after 'for'");
+        return;
+    }
+
+    struct bc_range wordlist;
+    wordlist.first = (uint32_t)prog->wordslen;
+    if (add_word(c, c->stmt.str, namelen) < 0) return;
+    consume(c, namelen);
+
+    if (stmt_keyword(c, "in")) {
+        consume(c, strlen("in"));
+        while (c->has_stmt) {
+            size_t len = first_word_len(&c->stmt);
+            if (add_word(c, c->stmt.str, len) < 0) return;
+            consume(c, len);
+        }
+    } else if (c->has_stmt) {
+        compile_error(c, "'in' expected");
+        return;
+    }
+    wordlist.count = (uint32_t)prog->wordslen - wordlist.first;
+
+    if (grow((void**)&prog->wordlists, &c->wordlistscap, prog->wordlistslen,
+             sizeof(struct bc_range)) < 0) {
+        compile_error(c, "out of memory");
+        return;
+    }
+    prog->wordlists[prog->wordlistslen] = wordlist;
+
+    uint32_t redir = emit_loop_redir(c);
+    emit(c, OP_STATUS, 0);
+    emit(c, OP_FOR_INIT, (uint32_t)prog->wordlistslen++);
+    uint32_t top = emit(c, OP_FOR_NEXT, BC_NOARG);
+
+    compile_until(c, do_terms, "'do' expected");
+    if (c->error) return;
+    consume(c, strlen("do"));
+    if (push_loop(c, 1, top) == NULL) return;
+    compile_until(c, done_terms, "'done' expected");
+    emit(c, OP_JMP, top);
+
+    uint32_t end = here(c);
+    patch(c, top, end);
+    pop_loop(c, end);
+    if (c->error) return;
+    if (compile_done(c, redir)) patch(c, redir + 1, here(c));
+}
+
+/*
+ * break [n] / continue [n]
+ */
+static void compile_loop_jump(struct bc_compiler* c, int is_break) {
+    consume(c, strlen(is_break ? "break" : "continue"));
+
+    int level = 1;
+    if (c->has_stmt) {
+        level = atoi(c->stmt.str);
+        c->has_stmt = 0;
+    }
+    if (c->loopdepth == 0) {
+        compile_error(c, "break or continue outside loop");
+        return;
+    }
+    if (level < 1) level = 1;
+    if (level > c->loopdepth) level = c->loopdepth;
+
+    /* leave frames of every for loop crossed */
+    int target = c->loopdepth - level;
+    for (int i = c->loopdepth - 1; i >= target; i--) {
+        if (i == target && !is_break) break;
+        if (c->loops[i].is_for) emit(c, OP_FOR_POP, 0);
+    }
+    /* and redirections of inner loops, whose done is not seen yet */
+    if (level > 1) emit(c, OP_UNREDIR, (uint32_t)target + 1);
+
+    struct bc_loop* loop = c->loops + target;
+    if (is_break) {
+        loop->breaks = emit(c, OP_JMP, loop->breaks);
+    } else {
+        emit(c, OP_JMP, loop->top);
+    }
+}
+
+static void compile_return(struct bc_compiler* c) {
+    consume(c, strlen("return"));
+
+    uint32_t status = BC_NOARG;
+    if (c->has_stmt) {
+        status = (uint32_t)(atoi(c->stmt.str) & 0xff);
+        c->has_stmt = 0;
+    }
+    /* loop frames are released when the vm returns */
+    emit(c, OP_RETURN, status);
+}
+
+/*
+ * name() {      or      function name {
+ * return length of the header or 0 if stmt is not a function definition
+ */
+static size_t function_header(const struct string_view* stmt,
+                              struct string_view* name) {
+    const char* str = stmt->str;
+    size_t len = stmt->len;
+    size_t rank = 0;
+
+    if (len > 9 && strncmp(str, "function", 8) == 0 && isblank(str[8])) {
+        rank = 8 + skip_whitespaces(str + 8, len - 8);
+    }
+
+    size_t namebeg = rank;
+    while (rank < len && (isalnum((unsigned char)str[rank]) || str[rank] == '_')) ++rank;
+    if (rank == namebeg) return 0;
+    name->str = str + namebeg;
+    name->len = rank - namebeg;
+
+    size_t parens = rank + skip_whitespaces(str + rank, len - rank);
+    if (parens + 1 < len && str[parens] == '(' && str[parens + 1] == ')') {
+        return parens + 2;
+    }
+    /* function name { */
+    if (namebeg > 0) return rank;
+
+    return 0;
+}
+
+static void compile_function(struct bc_compiler* c) {
+    static const char* const brace_terms[] = { "}", NULL };
+    struct bc_program* prog = c->prog;
+
+    struct string_view name;
+    size_t headerlen = function_header(&c->stmt, &name);
+    consume(c, headerlen);
+
+    /* { may be on the next line */
+    if (!c->has_stmt && next_statement(c) < 0) {
+        compile_error(c, "'{' expected");
+        return;
+    }
+    if (!stmt_keyword(c, "{")) {
+        compile_error(c, "'{' expected");
+        return;
+    }
+    consume(c, 1);
+
+    if (c->loopdepth > 0) {
+        compile_error(c, "function defined in a loop");
+        return;
+    }
+
+    uint32_t over = emit(c, OP_JMP, BC_NOARG);
+    if (grow((void**)&prog->funcs, &c->funcscap, prog->funcslen,
+             sizeof(struct bc_function)) < 0) {
+        compile_error(c, "out of memory");
+        return;
+    }
+    prog->funcs[prog->funcslen].name  = name;
+    prog->funcs[prog->funcslen].entry = here(c);
+    prog->funcslen += 1;
+
+    compile_until(c, brace_terms, "'}' expected");
+    emit(c, OP_RETURN, BC_NOARG);
+    patch(c, over, here(c));
+    if (c->error) return;
+    consume_closing(c, "}");
+}
+
+static void compile_statement(struct bc_compiler* c) {
+    static const char* const unexpected[] = {
+        "then", "elif", "else", "fi", "do", "done", "}", "in", NULL
+    };
+
+    for (size_t i = 0; unexpected[i]; i++) {
+        if (stmt_keyword(c, unexpected[i])) {
+            compile_error(c, "unexpected keyword");
+            return;
+        }
+    }
+
+    struct string_view name;
+    if (stmt_keyword(c, "if")) {
+        compile_if(c);
+    } else if (stmt_keyword(c, "while")) {
+        compile_while(c, 0);
+    } else if (stmt_keyword(c, "until")) {
+        compile_while(c, 1);
+    } else if (stmt_keyword(c, "for")) {
+        compile_for(c);
+    } else if (stmt_keyword(c, "break")) {
+        compile_loop_jump(c, 1);
+    } else if (stmt_keyword(c, "continue")) {
+        compile_loop_jump(c, 0);
+    } else if (stmt_keyword(c, "return")) {
+        compile_return(c);
+    } else if (function_header(&c->stmt, &name) > 0) {
+        compile_function(c);
+    } else {
+        compile_list(c);
+    }
+}
+
+/*
+ * compile statements until one starting with a keyword in terms,
+ * return index of the keyword found, or -1 at end of script
+ */
+static int compile_block(struct bc_compiler* c, const char* const* terms) {
+    while (!c->error) {
+        if (!c->has_stmt && next_statement(c) < 0) return -1;
+        for (int i = 0; terms && terms[i]; i++) {
+            if (stmt_keyword(c, terms[i])) return i;
+        }
+        compile_statement(c);
+    }
+    return -2;
+}
+
+void free_program(struct bc_program* prog) {
+    if (prog == NULL) return;
+    mem_free(prog->pool);
+    mem_free(prog->code);
+    mem_free(prog->pipes);
+    mem_free(prog->frags);
+    mem_free(prog->wordlists);
+    mem_free(prog->words);
+    mem_free(prog->funcs);
+    mem_free(prog);
+}
+
+/*
+ * compile source text, the program takes ownership of text
+ */
+struct bc_program* compile_program(char* text, size_t len, const char* name) {
+    struct bc_program* prog = (struct bc_program*)mem_calloc(1, sizeof(struct bc_program));
+    if (prog == NULL) {
+        mem_free(text);
+        return NULL;
+    }
+    prog->pool = text;
+    prog->poollen = len;
+
+    struct bc_compiler c;
+    bzero(&c, sizeof(c));
+    c.prog = prog;
+    c.name = name;
+    c.line = 1;
+
+    if (compile_block(&c, NULL) == -1) {
+        emit(&c, OP_HALT, 0);
+    }
+    if (c.error) {
+        free_program(prog);
+        return NULL;
+    }
+
+    return prog;
+}
+
+/*
+ * ----------------------------------------------------------------
+ * on-disk cache of compiled scripts
+ *
+ * cache file: header, script path, pool, then the arrays of the
+ * program; string views are stored as offset + 1 into pool, 0 for NULL
+ * ----------------------------------------------------------------
+ */
+
+typedef struct bc_cache_header bc_cache_header;
+struct bc_cache_header {
+    char     magic[4];
+    uint32_t fragsize;          /* layout of command_frag */
+    uint32_t format;            /* BC_FORMAT */
+    char     version[16];
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    int64_t  size;
+    uint64_t pathlen;
+    uint64_t poollen;
+    uint64_t codelen;
+    uint64_t pipeslen;
+    uint64_t fragslen;
+    uint64_t wordlistslen;
+    uint64_t wordslen;
+    uint64_t funcslen;
+};
+
+static void view_to_offset(struct string_view* sv, const char* pool) {
+    uintptr_t offset = sv->str ? (uintptr_t)(sv->str - pool) + 1 : 0;
+    sv->str = (const char*)offset;
+}
+
+static int view_from_offset(struct string_view* sv, const char* pool,
+                            size_t poollen) {
+    uintptr_t offset = (uintptr_t)sv->str;
+    if (offset == 0) {
+        sv->str = NULL;
+        return 0;
+    }
+    if (offset - 1 > poollen || sv->len > poollen - (offset - 1)) return -1;
+    sv->str = pool + offset - 1;
+    return 0;
+}
+
+static int cache_path(const char* scriptpath, char* buf, size_t buflen) {
+    char dir[PATH_MAX];
+    const char* cachedir = getenv("BSH_CACHE_DIR");
+    if (cachedir == NULL || cachedir[0] == '\0') {
+        const char* home = getenv("HOME");
+        if (home == NULL) return -1;
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/bsh", home);
+        cachedir = dir;
+    }
+    if (mkdir(cachedir, 0755) < 0 && errno != EEXIST) return -1;
+
+    /* FNV-1a of the script path */
+    uint64_t h = 14695981039346656037ULL;
+    for (const char* p = scriptpath; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
+    }
+    snprintf(buf, buflen, "%s/%016llx.bc", cachedir, (unsigned long long)h);
+    return 0;
+}
+
+static void fill_cache_key(struct bc_cache_header* header,
+                           const char* scriptpath, const struct stat* statbuf) {
+    bzero(header, sizeof(*header));
+    memcpy(header->magic, BC_MAGIC, sizeof(BC_MAGIC));
+    header->fragsize = sizeof(struct command_frag);
+    header->format   = BC_FORMAT;
+    snprintf(header->version, sizeof(header->version), "%s", BSH_VERSION);
+    header->mtime_sec  = statbuf->st_mtim.tv_sec;
+    header->mtime_nsec = statbuf->st_mtim.tv_nsec;
+    header->size       = statbuf->st_size;
+    header->pathlen    = strlen(scriptpath);
+}
+
+static int write_all(FILE* fp, const void* buf, size_t len) {
+    return (len == 0 || fwrite(buf, len, 1, fp) == 1) ? 0 : -1;
+}
+
+static void save_cache(const struct bc_program* prog, const char* scriptpath,
+                       const struct stat* statbuf) {
+    char path[PATH_MAX];
+    char tmppath[PATH_MAX + 16];
+    if (cache_path(scriptpath, path, sizeof(path)) < 0) return;
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", path, (int)getpid());
+
+    FILE* fp = fopen(tmppath, "w");
+    if (fp == NULL) return;
+
+    struct bc_cache_header header;
+    fill_cache_key(&header, scriptpath, statbuf);
+    header.poollen      = prog->poollen;
+    header.codelen      = prog->codelen;
+    header.pipeslen     = prog->pipeslen;
+    header.fragslen     = prog->fragslen;
+    header.wordlistslen = prog->wordlistslen;
+    header.wordslen     = prog->wordslen;
+    header.funcslen     = prog->funcslen;
+
+    int err = 0;
+    err |= write_all(fp, &header, sizeof(header));
+    err |= write_all(fp, scriptpath, header.pathlen);
+    err |= write_all(fp, prog->pool, prog->poollen);
+    err |= write_all(fp, prog->code, prog->codelen * sizeof(struct bc_insn));
+    err |= write_all(fp, prog->pipes, prog->pipeslen * sizeof(struct bc_range));
+    for (size_t i = 0; i < prog->fragslen && !err; i++) {
+        struct command_frag frag = prog->frags[i];
+        struct string_view* views[FRAGVIEWSMAX];
+        size_t count = frag_string_views(&frag, views);
+        for (size_t j = 0; j < count; j++) view_to_offset(views[j], prog->pool);
+        err |= write_all(fp, &frag, sizeof(frag));
+    }
+    err |= write_all(fp, prog->wordlists, prog->wordlistslen * sizeof(struct bc_range));
+    for (size_t i = 0; i < prog->wordslen && !err; i++) {
+        struct string_view word = prog->words[i];
+        view_to_offset(&word, prog->pool);
+        err |= write_all(fp, &word, sizeof(word));
+    }
+    for (size_t i = 0; i < prog->funcslen && !err; i++) {
+        struct bc_function func = prog->funcs[i];
+        view_to_offset(&func.name, prog->pool);
+        err |= write_all(fp, &func, sizeof(func));
+    }
+
+    if (fclose(fp) != 0) err = 1;
+    /* rename is atomic, concurrent runs never see a partial file */
+    if (err || rename(tmppath, path) < 0) unlink(tmppath);
+}
+
+/*
+ * copy count elements of size at *cursor into a new array
+ */
+static void* take(const char** cursor, const char* end, size_t count, size_t size) {
+    if (count > (size_t)(end - *cursor) / size) return NULL;
+    size_t len = count * size;
+    void* p = mem_alloc(len ? len : 1);
+    if (p) memcpy(p, *cursor, len);
+    *cursor += len;
+    return p;
+}
+
+static int check_range(const struct bc_range* range, size_t len) {
+    return (uint64_t)range->first + range->count <= len ? 0 : -1;
+}
+
+static int check_frag(const struct command_frag* frag) {
+    if (frag->stderr_to_stdout_flag != 0 && frag->stderr_to_stdout_flag != 1) return -1;
+    if (frag->split < 0 || frag->split > MAXSPLIT) return -1;
+    for (size_t i = 0; i < MAXFDREDIRS; i++) {
+        /* exec only takes the single digit fds */
+        if (frag->fdfile_fds[i] < 0 || frag->fdfile_fds[i] > 9) {
+            if (frag->fdfiles[i].str) return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * follow every path from entry: a pc is reached with the same number
+ * of for loop frames on each, FOR_NEXT and FOR_POP always find one
+ * and FOR_INIT never pushes more than MAXLOOPDEPTH; depths[pc] is -1
+ * for pcs not seen yet, todo has room for codelen + 1 pcs
+ */
+static int check_frames(const struct bc_program* prog, uint32_t entry,
+                        signed char* depths, uint32_t* todo) {
+    size_t todolen = 0;
+    depths[entry] = 0;
+    todo[todolen++] = entry;
+
+    while (todolen > 0) {
+        uint32_t pc = todo[--todolen];
+        int depth = depths[pc];
+        if (pc == prog->codelen) continue;
+
+        const struct bc_insn* insn = prog->code + pc;
+        uint32_t next[2];
+        int nextdepth[2];
+        size_t nextlen = 0;
+        switch (insn->op) {
+            case OP_JMP:
+                next[0] = insn->arg, nextdepth[0] = depth, nextlen = 1;
+                break;
+            case OP_JZ:
+            case OP_JNZ:
+                next[0] = insn->arg, nextdepth[0] = depth;
+                next[1] = pc + 1, nextdepth[1] = depth, nextlen = 2;
+                break;
+            case OP_FOR_INIT:
+                if (depth == MAXLOOPDEPTH) return -1;
+                next[0] = pc + 1, nextdepth[0] = depth + 1, nextlen = 1;
+                break;
+            case OP_FOR_NEXT:
+                if (depth == 0) return -1;
+                next[0] = insn->arg, nextdepth[0] = depth - 1;
+                next[1] = pc + 1, nextdepth[1] = depth, nextlen = 2;
+                break;
+            case OP_FOR_POP:
+                if (depth == 0) return -1;
+                next[0] = pc + 1, nextdepth[0] = depth - 1, nextlen = 1;
+                break;
+            case OP_RETURN:
+            case OP_HALT:
+                break;
+            default:
+                next[0] = pc + 1, nextdepth[0] = depth, nextlen = 1;
+                break;
+        }
+
+        for (size_t i = 0; i < nextlen; i++) {
+            if (depths[next[i]] < 0) {
+                depths[next[i]] = (signed char)nextdepth[i];
+                todo[todolen++] = next[i];
+            } else if (depths[next[i]] != nextdepth[i]) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * a cache file is only trusted as far as it is checked: every
+ * instruction and table index has to be in range before the vm runs it
+ */
+static int check_program(const struct bc_program* prog) {
+    if (prog->codelen >= UINT32_MAX) return -1;
+
+    for (size_t pc = 0; pc < prog->codelen; pc++) {
+        const struct bc_insn* insn = prog->code + pc;
+        switch (insn->op) {
+            case OP_PIPE:
+                if (insn->arg >= prog->pipeslen) return -1;
+                break;
+            case OP_JMP:
+            case OP_JZ:
+            case OP_JNZ:
+            case OP_FOR_NEXT:
+                if (insn->arg > prog->codelen) return -1;
+                break;
+            case OP_FOR_INIT:
+                if (insn->arg >= prog->wordlistslen) return -1;
+                break;
+            case OP_REDIR:
+                if (BC_REDIR_PIPE(insn->arg) >= prog->pipeslen) return -1;
+                if (prog->pipes[BC_REDIR_PIPE(insn->arg)].count != 1) return -1;
+                break;
+            case OP_FOR_POP:
+            case OP_STATUS:
+            case OP_RETURN:
+            case OP_HALT:
+            case OP_UNREDIR:
+            case OP_STMT:
+                break;
+            default:
+                return -1;
+        }
+    }
+    for (size_t i = 0; i < prog->pipeslen; i++) {
+        const struct bc_range* range = prog->pipes + i;
+        if (range->count == 0 || range->count > MAXPIPECOUNT + 1) return -1;
+        if (check_range(range, prog->fragslen) < 0) return -1;
+    }
+    for (size_t i = 0; i < prog->fragslen; i++) {
+        if (check_frag(prog->frags + i) < 0) return -1;
+    }
+    for (size_t i = 0; i < prog->wordlistslen; i++) {
+        /* words[first] is the variable */
+        if (prog->wordlists[i].count == 0) return -1;
+        if (check_range(prog->wordlists + i, prog->wordslen) < 0) return -1;
+    }
+    for (size_t i = 0; i < prog->funcslen; i++) {
+        if (prog->funcs[i].entry >= prog->codelen) return -1;
+    }
+
+    signed char* depths = (signed char*)mem_alloc(prog->codelen + 1);
+    uint32_t* todo = (uint32_t*)mem_alloc((prog->codelen + 1) * sizeof(uint32_t));
+    int err = (depths && todo) ? 0 : -1;
+    if (depths) memset(depths, -1, prog->codelen + 1);
+    /* the main program, then every function, which starts without frames */
+    if (!err) err = check_frames(prog, 0, depths, todo);
+    for (size_t i = 0; i < prog->funcslen && !err; i++) {
+        uint32_t entry = prog->funcs[i].entry;
+        if (depths[entry] < 0) err = check_frames(prog, entry, depths, todo);
+        else if (depths[entry] != 0) err = -1;
+    }
+    mem_free(depths);
+    mem_free(todo);
+    return err;
+}
+
+static struct bc_program* load_cache(const char* scriptpath,
+                                     const struct stat* statbuf) {
+    char path[PATH_MAX];
+    if (cache_path(scriptpath, path, sizeof(path)) < 0) return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat cachestat;
+    char* buf = NULL;
+    if (fstat(fd, &cachestat) == 0 && cachestat.st_size >= (off_t)sizeof(struct bc_cache_header)) {
+        buf = (char*)mem_alloc(cachestat.st_size);
+        if (buf && read(fd, buf, cachestat.st_size) != cachestat.st_size) {
+            mem_free(buf);
+            buf = NULL;
+        }
+    }
+    close(fd);
+    if (buf == NULL) return NULL;
+
+    struct bc_cache_header key, header;
+    fill_cache_key(&key, scriptpath, statbuf);
+    memcpy(&header, buf, sizeof(header));
+    const char* cursor = buf + sizeof(header);
+    const char* end = buf + cachestat.st_size;
+
+    /* stale: script changed, bsh upgraded or from another script */
+    if (memcmp(header.magic, key.magic, sizeof(key.magic)) != 0 ||
+        header.fragsize != key.fragsize ||
+        header.format != key.format ||
+        strncmp(header.version, key.version, sizeof(key.version)) != 0 ||
+        header.mtime_sec != key.mtime_sec ||
+        header.mtime_nsec != key.mtime_nsec ||
+        header.size != key.size ||
+        header.pathlen != key.pathlen ||
+        (size_t)(end - cursor) < header.pathlen ||
+        memcmp(cursor, scriptpath, header.pathlen) != 0) {
+        mem_free(buf);
+        return NULL;
+    }
+    cursor += header.pathlen;
+
+    struct bc_program* prog = (struct bc_program*)mem_calloc(1, sizeof(struct bc_program));
+    if (prog == NULL) {
+        mem_free(buf);
+        return NULL;
+    }
+    prog->poollen      = header.poollen;
+    prog->codelen      = header.codelen;
+    prog->pipeslen     = header.pipeslen;
+    prog->fragslen     = header.fragslen;
+    prog->wordlistslen = header.wordlistslen;
+    prog->wordslen     = header.wordslen;
+    prog->funcslen     = header.funcslen;
+
+    int err = 0;
+    if (prog->poollen <= (size_t)(end - cursor) &&
+        (prog->pool = (char*)mem_alloc(prog->poollen + 1)) != NULL) {
+        memcpy(prog->pool, cursor, prog->poollen);
+        prog->pool[prog->poollen] = '\0';
+        cursor += prog->poollen;
+    }
+    prog->code      = (struct bc_insn*)take(&cursor, end, prog->codelen, sizeof(struct bc_insn));
+    prog->pipes     = (struct bc_range*)take(&cursor, end, prog->pipeslen, sizeof(struct bc_range));
+    prog->frags     = (struct command_frag*)take(&cursor, end, prog->fragslen, sizeof(struct command_frag));
+    prog->wordlists = (struct bc_range*)take(&cursor, end, prog->wordlistslen, sizeof(struct bc_range));
+    prog->words     = (struct string_view*)take(&cursor, end, prog->wordslen, sizeof(struct string_view));
+    prog->funcs     = (struct bc_function*)take(&cursor, end, prog->funcslen, sizeof(struct bc_function));
+    mem_free(buf);
+
+    if (!prog->pool || !prog->code || !prog->pipes || !prog->frags ||
+        !prog->wordlists || !prog->words || !prog->funcs) {
+        free_program(prog);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < prog->fragslen && !err; i++) {
+        struct string_view* views[FRAGVIEWSMAX];
+        size_t count = frag_string_views(prog->frags + i, views);
+        for (size_t j = 0; j < count; j++) {
+            err |= view_from_offset(views[j], prog->pool, prog->poollen);
+        }
+    }
+    for (size_t i = 0; i < prog->wordslen && !err; i++) {
+        err |= view_from_offset(prog->words + i, prog->pool, prog->poollen);
+    }
+    for (size_t i = 0; i < prog->funcslen && !err; i++) {
+        err |= view_from_offset(&prog->funcs[i].name, prog->pool, prog->poollen);
+    }
+    /* a broken cache is dropped and the script compiled again */
+    if (err || cursor != end || check_program(prog) < 0) {
+        free_program(prog);
+        return NULL;
+    }
+
+    return prog;
+}
+
+/*
+ * ----------------------------------------------------------------
+ * virtual machine
+ * ----------------------------------------------------------------
+ */
+
+typedef struct bc_for_frame bc_for_frame;
+struct bc_for_frame {
+    char**             words;
+    size_t             count;
+    size_t             next;
+    struct string_view var;
+};
+
+static void free_for_frame(struct bc_for_frame* frame) {
+    for (size_t i = 0; i < frame->count; i++) mem_free(frame->words[i]);
+    mem_free(frame->words);
+}
+
+/*
+ * expand one word of a for loop, results are split at blanks
+ */
+static int for_add_words(struct bc_for_frame* frame, size_t* cap,
+                         const struct string_view* word) {
+    char* expanded = expand_arg(word);
+    if (expanded == NULL) return -1;
+
+    char* saveptr = NULL;
+    for (char* field = strtok_r(expanded, " \t\n", &saveptr); field;
+         field = strtok_r(NULL, " \t\n", &saveptr)) {
+        if (grow((void**)&frame->words, cap, frame->count, sizeof(char*)) < 0 ||
+            (frame->words[frame->count] = mem_strdup(field)) == NULL) {
+            mem_free(expanded);
+            return -1;
+        }
+        frame->count += 1;
+    }
+    mem_free(expanded);
+
+    return 0;
+}
+
+static int for_init(const struct bc_program* prog, uint32_t index,
+                    struct bc_for_frame* frame) {
+    static const struct string_view all_positional = { "$@", 2 };
+    const struct bc_range* wordlist = prog->wordlists + index;
+
+    frame->words = NULL;
+    frame->count = 0;
+    frame->next  = 0;
+    frame->var   = prog->words[wordlist->first];
+
+    size_t cap = 0;
+    /* for name; do ... iterates positional parameters */
+    if (wordlist->count == 1) {
+        return for_add_words(frame, &cap, &all_positional);
+    }
+    for (uint32_t i = 1; i < wordlist->count; i++) {
+        if (for_add_words(frame, &cap, prog->words + wordlist->first + i) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * the shell's own fds while a loop is redirected
+ */
+typedef struct bc_redir bc_redir;
+struct bc_redir {
+    uint32_t level;
+    int      moved[3];
+    int      saved[3];      /* -1 if the fd was closed before */
+    pid_t    substpids[MAXPROCSUBST];   /* done < <(list) */
+    size_t   substpidslen;
+};
+
+static void redir_pop(struct bc_redir* redir) {
+    for (int i = 2; i >= 0; i--) {
+        if (!redir->moved[i]) continue;
+        if (i == STDIN_FILENO) input_forget(STDIN_FILENO);
+        if (redir->saved[i] >= 0) {
+            dup2(redir->saved[i], i);
+            close(redir->saved[i]);
+            if (i == STDIN_FILENO) input_move(redir->saved[i], STDIN_FILENO);
+        } else {
+            close(i);
+        }
+    }
+    for (size_t i = 0; i < redir->substpidslen; i++) {
+        while (waitpid(redir->substpids[i], NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+}
+
+static int redir_push(const struct bc_program* prog, uint32_t arg,
+                      struct bc_redir* redir) {
+    const struct bc_range* range = prog->pipes + BC_REDIR_PIPE(arg);
+    struct pipe_command* pcmd = mk_pipecommand(prog->frags + range->first);
+    if (pcmd == NULL) return -1;
+
+    int fds[3] = { pcmd->stdinfd, pcmd->stdoutfd, pcmd->stderrfd };
+    int shellfds = pcmd->shellfds;
+    /* the lists of <(list) run as long as the loop */
+    redir->substpidslen = pcmd->substpidslen;
+    memcpy(redir->substpids, pcmd->substpids, pcmd->substpidslen * sizeof(pid_t));
+    pcmd->substpidslen = 0;
+    pcmd->substfdslen = 0;
+    pcmd->stdinfd = pcmd->stdoutfd = pcmd->stderrfd = -2;
+    free_memory(&pcmd, 1);
+
+    redir->level = BC_REDIR_LEVEL(arg);
+    for (int i = 0; i < 3; i++) {
+        redir->moved[i] = 0;
+        if (fds[i] < 0) continue;
+
+        /* keep the shell's fd, read-ahead of stdin goes with it */
+        redir->saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+        if (i == STDIN_FILENO && redir->saved[i] >= 0) {
+            input_move(STDIN_FILENO, redir->saved[i]);
+        }
+        redir->moved[i] = 1;
+        dup2(fds[i], i);
+        /* done >&3 2>&1: the shell's fds stay */
+        if (!(shellfds & (1 << i))) close(fds[i]);
+    }
+    /* the loop's own file or pipe, which goes away with the loop */
+    if (fds[STDIN_FILENO] >= 0 && !(shellfds & (1 << STDIN_FILENO)) &&
+        (arg & BC_REDIR_OWNSTDIN)) {
+        input_set_private(STDIN_FILENO);
+    }
+    return 0;
+}
+
+static int run_pipeline(const struct bc_program* prog, uint32_t index) {
+    const struct bc_range* range = prog->pipes + index;
+    struct command_frag fragarray[MAXPIPECOUNT + 2];
+
+    memcpy(fragarray, prog->frags + range->first,
+           range->count * sizeof(struct command_frag));
+    bzero(fragarray + range->count, sizeof(struct command_frag));
+    fragarray[range->count].stderr_to_stdout_flag = -1;
+
+    int err = execute_frags(fragarray);
+    if (err == -1) {
+        /* redirection failed, like a failed command */
+        last_exit_status = 1;
+        err = 0;
+    }
+    return err;
+}
+
+/* nothing runs after the instruction before pc */
+static int is_last(const struct bc_program* prog, uint32_t pc) {
+    for (size_t jumps = 0; pc < prog->codelen && jumps < prog->codelen; jumps++) {
+        if (prog->code[pc].op == OP_HALT) return 1;
+        if (prog->code[pc].op != OP_JMP) return 0;
+        pc = prog->code[pc].arg;
+    }
+    return pc >= prog->codelen;
+}
+
+/*
+ * run from pc until OP_HALT or OP_RETURN,
+ * return 0 or -2 if the exit built-in was executed
+ */
+static int bc_run(const struct bc_program* prog, uint32_t pc) {
+    struct bc_for_frame frames[MAXLOOPDEPTH];
+    int depth = 0;
+    struct bc_redir redirs[MAXLOOPDEPTH];
+    int redirdepth = 0;
+    int err = 0;
+
+    while (pc < prog->codelen) {
+        const struct bc_insn* insn = prog->code + pc++;
+        switch (insn->op) {
+            case OP_PIPE:
+                tail_exec = script_tail_exec && call_depth == 0 && depth == 0 &&
+                            redirdepth == 0 && is_last(prog, pc);
+                err = run_pipeline(prog, insn->arg);
+                tail_exec = 0;
+                break;
+
+            case OP_JMP:
+                pc = insn->arg;
+                break;
+
+            case OP_JZ:
+                if (last_exit_status == 0) pc = insn->arg;
+                break;
+
+            case OP_JNZ:
+                if (last_exit_status != 0) pc = insn->arg;
+                break;
+
+            case OP_FOR_INIT:
+                assert(depth < MAXLOOPDEPTH);
+                if (for_init(prog, insn->arg, frames + depth) < 0) {
+                    fprintf(stderr, "bsh: for: out of memory.\n");
+                    free_for_frame(frames + depth);
+                    err = -1;
+                    break;
+                }
+                depth += 1;
+                break;
+
+            case OP_FOR_NEXT:
+                {
+                    struct bc_for_frame* frame = frames + depth - 1;
+                    if (frame->next < frame->count) {
+                        var_set(frame->var.str, frame->var.len,
+                                frame->words[frame->next++]);
+                    } else {
+                        free_for_frame(frame);
+                        depth -= 1;
+                        pc = insn->arg;
+                    }
+                }
+                break;
+
+            case OP_FOR_POP:
+                free_for_frame(frames + --depth);
+                break;
+
+            case OP_STATUS:
+                last_exit_status = (int)insn->arg;
+                break;
+
+            case OP_RETURN:
+                if (insn->arg != BC_NOARG) last_exit_status = (int)insn->arg;
+                pc = (uint32_t)prog->codelen;
+                break;
+
+            case OP_REDIR:
+                if (redirdepth == MAXLOOPDEPTH) {
+                    fprintf(stderr, "bsh: loops nested too deep.\n");
+                    err = -1;
+                    break;
+                }
+                if (redir_push(prog, insn->arg, redirs + redirdepth) < 0) {
+                    last_exit_status = 1;
+                } else {
+                    redirdepth += 1;
+                    last_exit_status = 0;
+                }
+                break;
+
+            case OP_UNREDIR:
+                while (redirdepth > 0 && redirs[redirdepth - 1].level >= insn->arg) {
+                    redir_pop(redirs + --redirdepth);
+                }
+                break;
+
+            case OP_STMT:
+                test_stat_cache_clear();
+                break;
+
+            case OP_HALT:
+            default:
+                pc = (uint32_t)prog->codelen;
+                break;
+        }
+
+        if (err < 0) break;
+    }
+
+    while (depth > 0) free_for_frame(frames + --depth);
+    /* return or exit inside a redirected loop */
+    while (redirdepth > 0) redir_pop(redirs + --redirdepth);
+    return err;
+}
+
+/*
+ * keep programs defining functions alive, free others
+ */
+static int run_program(struct bc_program* prog) {
+    if (prog->funcslen > 0) {
+        prog->next = programs;
+        programs = prog;
+    }
+    if (script_owns_stdin && code_keeps_stdin(prog, 0, (uint32_t)prog->codelen)) {
+        input_set_private(STDIN_FILENO);
+    }
+
+    int err = bc_run(prog, 0);
+
+    if (prog->funcslen == 0) free_program(prog);
+    return err;
+}
+
+static const struct bc_function* find_function(const char* name,
+                                               const struct bc_program** owner) {
+    size_t namelen = strlen(name);
+    for (const struct bc_program* prog = programs; prog; prog = prog->next) {
+        /* the last definition wins */
+        for (size_t i = prog->funcslen; i > 0; i--) {
+            const struct bc_function* func = prog->funcs + i - 1;
+            if (func->name.len == namelen &&
+                strncmp(func->name.str, name, namelen) == 0) {
+                if (owner) *owner = prog;
+                return func;
+            }
+        }
+    }
+    return NULL;
+}
+
+int script_has_function(const char* name) {
+    return programs != NULL && find_function(name, NULL) != NULL;
+}
+
+int script_call_function(char** arglist) {
+    const struct bc_program* prog = NULL;
+    const struct bc_function* func = find_function(arglist[0], &prog);
+    assert(func);
+
+    if (call_depth >= MAXCALLDEPTH) {
+        fprintf(stderr, "bsh: %s: maximum function nesting exceeded.\n", arglist[0]);
+        last_exit_status = 1;
+        return 0;
+    }
+
+    int argc = 0;
+    while (arglist[argc]) ++argc;
+
+    struct positional saved;
+    positional_set(argc, arglist, &saved);
+    call_depth += 1;
+    int err = bc_run(prog, func->entry);
+    call_depth -= 1;
+    positional_restore(&saved);
+
+    return err;
+}
+
+int script_is_compound(const char* cmdline) {
+    static const char* const keywords[] = {
+        "if", "while", "until", "for", "function", NULL
+    };
+
+    struct string_view stmt;
+    stmt.str = cmdline + skip_whitespaces(cmdline, strlen(cmdline));
+    stmt.len = strlen(stmt.str);
+    size_t len = first_word_len(&stmt);
+    for (size_t i = 0; keywords[i]; i++) {
+        if (len == strlen(keywords[i]) && strncmp(stmt.str, keywords[i], len) == 0) {
+            return 1;
+        }
+    }
+
+    struct string_view name;
+    return function_header(&stmt, &name) > 0;
+}
+
+int script_run_text(const char* text) {
+    size_t len = strlen(text);
+    char* pool = mem_strdup(text);
+    if (pool == NULL) return -1;
+
+    struct bc_program* prog = compile_program(pool, len, "-c");
+    if (prog == NULL) {
+        last_exit_status = 2;
+        return -1;
+    }
+
+    return run_program(prog);
+}
+
+static char* read_script(int fd, size_t size) {
+    char* text = (char*)mem_alloc(size + 1);
+    if (text == NULL) return NULL;
+
+    size_t total = 0;
+    while (total < size) {
+        ssize_t rdcnt = read(fd, text + total, size - total);
+        if (rdcnt <= 0) {
+            mem_free(text);
+            return NULL;
+        }
+        total += rdcnt;
+    }
+    text[size] = '\0';
+    return text;
+}
+
+int script_run_file(int argc, char** argv) {
+    const char* path = argv[0];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "bsh: %s: %s.\n", path, strerror(errno));
+        last_exit_status = 127;
+        return -1;
+    }
+
+    struct stat statbuf;
+    char fullpath[PATH_MAX];
+    if (fstat(fd, &statbuf) < 0 || realpath(path, fullpath) == NULL) {
+        fprintf(stderr, "bsh: %s: %s.\n", path, strerror(errno));
+        close(fd);
+        last_exit_status = 127;
+        return -1;
+    }
+
+    struct bc_program* prog = load_cache(fullpath, &statbuf);
+    if (prog == NULL) {
+        char* text = read_script(fd, statbuf.st_size);
+        if (text == NULL) {
+            fprintf(stderr, "bsh: %s: read error.\n", path);
+            close(fd);
+            last_exit_status = 126;
+            return -1;
+        }
+        prog = compile_program(text, statbuf.st_size, path);
+        if (prog == NULL) {
+            close(fd);
+            last_exit_status = 2;
+            return -1;
+        }
+        save_cache(prog, fullpath, &statbuf);
+    }
+    close(fd);
+
+    positional_set(argc, argv, NULL);
+    return run_program(prog);
+}
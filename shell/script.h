@@ -0,0 +1,122 @@
+#ifndef BDU_SHELL_SCRIPT_H
+#define BDU_SHELL_SCRIPT_H
+
+#include <stdint.h>
+
+#include "parse.h"
+
+/*
+ * scripts are compiled into a compact bytecode over command_frag:
+ * every pipeline is parsed once at compile time, the vm only expands
+ * arguments and opens redirections when it runs a pipeline.
+ *
+ * supported compound commands:
+ * if list; then list; [elif list; then list;] [else list;] fi
+ * while list; do list; done
+ * until list; do list; done
+ * for name [in word...]; do list; done
+ * the done of a loop may redirect the loop: done < file
+ * name() { list; }
+ * break [n], continue [n], return [n]
+ */
+enum bc_opcode {
+    OP_PIPE = 1,    /* run pipeline arg */
+    OP_JMP,         /* jump to arg */
+    OP_JZ,          /* jump to arg if last exit status is 0 */
+    OP_JNZ,         /* jump to arg if last exit status is not 0 */
+    OP_FOR_INIT,    /* expand word list arg and push a loop frame */
+    OP_FOR_NEXT,    /* assign next word or pop frame and jump to arg */
+    OP_FOR_POP,     /* pop loop frame, used by break */
+    OP_STATUS,      /* set last exit status to arg */
+    OP_RETURN,      /* return from function, arg is status or BC_NOARG */
+    OP_HALT,
+    /* new opcodes go here, an opcode keeps its number */
+    OP_REDIR,       /* redirect the shell for a loop, arg is BC_REDIR_ARG */
+    OP_UNREDIR,     /* undo redirections of loops at level arg and deeper */
+    OP_STMT         /* a statement starts, stat(2) results of test are stale */
+};
+
+/*
+ * version of the instruction set in cached programs, bump it with
+ * every new opcode or change of what an instruction means
+ */
+#define BC_FORMAT       4
+
+#define BC_NOARG        UINT32_MAX
+
+/*
+ * OP_REDIR: redirections of pipe, loop nesting level, and
+ * BC_REDIR_OWNSTDIN if no command of the loop can read its stdin
+ */
+#define BC_REDIR_ARG(pipe, level)   ((uint32_t)(pipe) << 8 | (uint32_t)(level))
+#define BC_REDIR_PIPE(arg)          ((arg) >> 8)
+#define BC_REDIR_LEVEL(arg)         ((arg) & 0x7f)
+#define BC_REDIR_OWNSTDIN           0x80
+
+typedef struct bc_insn bc_insn;
+struct bc_insn {
+    uint32_t op;
+    uint32_t arg;
+};
+
+typedef struct bc_range bc_range;
+struct bc_range {
+    uint32_t first;
+    uint32_t count;
+};
+
+typedef struct bc_function bc_function;
+struct bc_function {
+    struct string_view name;
+    uint32_t           entry;
+};
+
+typedef struct bc_program bc_program;
+struct bc_program {
+    char*                 pool;         /* source text, views point into it */
+    size_t                poollen;
+    struct bc_insn*       code;
+    size_t                codelen;
+    struct bc_range*      pipes;        /* ranges of frags */
+    size_t                pipeslen;
+    struct command_frag*  frags;
+    size_t                fragslen;
+    struct bc_range*      wordlists;    /* for loops, words[first] is the variable */
+    size_t                wordlistslen;
+    struct string_view*   words;
+    size_t                wordslen;
+    struct bc_function*   funcs;
+    size_t                funcslen;
+    struct bc_program*    next;         /* programs defining functions */
+};
+
+/*
+ * return non-zero if cmdline starts with a compound command
+ * or a function definition
+ */
+int script_is_compound(const char* cmdline);
+
+/*
+ * run script file, using the on-disk compiled cache when it is fresh,
+ * argv[0] is the script path
+ */
+int script_run_file(int argc, char** argv);
+int script_run_text(const char* text);
+
+/*
+ * set by callers which exit right after script_run_text or
+ * script_run_file, the last pipeline then runs with tail_exec
+ */
+extern int script_tail_exec;
+
+/*
+ * set by bsh -c and bsh script, whose stdin nobody but the script
+ * reads: if none of its commands can hand stdin to a child, the
+ * shell reads a pipe there in blocks
+ */
+extern int script_owns_stdin;
+
+int script_has_function(const char* name);
+int script_call_function(char** arglist);
+
+#endif /* BDU_SHELL_SCRIPT_H */
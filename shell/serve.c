@@ -0,0 +1,261 @@
+#include "serve.h"
+#include "bsh.h"
+#include "script.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXWORKERS          256
+
+/*
+ * read exactly len bytes, fds sent with the first byte are
+ * stored in fds, return 0, or -1 on EOF or error
+ */
+static int recv_all(int sock, void* buf, size_t len, int* fds, int* nfds) {
+    char control[CMSG_SPACE(sizeof(int) * SERVE_MAXFDS)];
+    size_t done = 0;
+    while (done < len) {
+        struct iovec iov;
+        iov.iov_base = (char*)buf + done;
+        iov.iov_len  = len - done;
+        struct msghdr msg;
+        bzero(&msg, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (fds) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+        }
+
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+
+        for (struct cmsghdr* cmsg = fds ? CMSG_FIRSTHDR(&msg) : NULL; cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int* passed = (int*)CMSG_DATA(cmsg);
+            for (int i = 0; i < count; i++) {
+                if (*nfds < SERVE_MAXFDS) fds[(*nfds)++] = passed[i];
+                else close(passed[i]);
+            }
+        }
+        /* ancillary data only comes with the first byte */
+        fds = NULL;
+    }
+    return 0;
+}
+
+static int send_all(int sock, const void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = send(sock, (const char*)buf + done, len - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static void apply_env(char* env, size_t len) {
+    for (size_t i = 0; i < len; ) {
+        char* entry = env + i;
+        i += strlen(entry) + 1;
+        char* eq = strchr(entry, '=');
+        if (eq) {
+            *eq = '\0';
+            setenv(entry, eq + 1, 1);
+        } else if (entry[0]) {
+            unsetenv(entry);
+        }
+    }
+}
+
+/*
+ * the child of one request: fds become stdin, stdout and stderr,
+ * then the script runs like bsh -c
+ */
+static void run_request(char* script, const char* cwd, char* env, size_t envlen,
+                        int* fds, int nfds) {
+    for (int i = 0; i < SERVE_MAXFDS; i++) {
+        int fd = i < nfds ? fds[i] : open("/dev/null", i == 0 ? O_RDONLY : O_WRONLY);
+        if (fd < 0 || dup2(fd, i) < 0) exit(126);
+        if (fd != i) close(fd);
+    }
+    if (cwd[0] && chdir(cwd) < 0) {
+        fprintf(stderr, "bsh: cd %s: %s.\n", cwd, strerror(errno));
+        exit(1);
+    }
+    apply_env(env, envlen);
+
+    script_tail_exec = 1;
+    script_run_text(script);
+    exit(last_exit_status);
+}
+
+static int64_t timeval_us(const struct timeval* tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/*
+ * serve the requests of one connection, return when it is closed
+ * or a request is malformed
+ */
+static void serve_connection(int sock, int listenfd) {
+    while (1) {
+        struct serve_request req;
+        int fds[SERVE_MAXFDS];
+        int nfds = 0;
+        if (recv_all(sock, &req, sizeof(req), fds, &nfds) < 0) return;
+
+        /* script, cwd and env, each followed by a NUL */
+        char* buf = NULL;
+        if (req.magic == SERVE_REQUEST_MAGIC &&
+            req.scriptlen <= SERVE_MAXSCRIPT &&
+            req.cwdlen < PATH_MAX &&
+            req.envlen <= SERVE_MAXENV) {
+            buf = (char*)mem_alloc((size_t)req.scriptlen + req.cwdlen + req.envlen + 3);
+        }
+        char* script = buf;
+        char* cwd = buf ? script + req.scriptlen + 1 : NULL;
+        char* env = buf ? cwd + req.cwdlen + 1 : NULL;
+        if (buf == NULL ||
+            recv_all(sock, script, req.scriptlen, NULL, NULL) < 0 ||
+            recv_all(sock, cwd, req.cwdlen, NULL, NULL) < 0 ||
+            recv_all(sock, env, req.envlen, NULL, NULL) < 0) {
+            mem_free(buf);
+            for (int i = 0; i < nfds; i++) close(fds[i]);
+            return;
+        }
+        script[req.scriptlen] = '\0';
+        cwd[req.cwdlen] = '\0';
+        env[req.envlen] = '\0';
+
+        struct serve_reply reply;
+        bzero(&reply, sizeof(reply));
+        reply.magic = SERVE_REPLY_MAGIC;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(sock);
+            close(listenfd);
+            run_request(script, cwd, env, req.envlen, fds, nfds);
+        }
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        mem_free(buf);
+
+        int status = 0;
+        struct rusage ru;
+        bzero(&ru, sizeof(ru));
+        if (pid < 0) {
+            reply.status = 127;
+        } else {
+            while (wait4(pid, &status, 0, &ru) < 0 && errno == EINTR) {}
+            reply.status = exit_status(status);
+        }
+        reply.utime_us  = timeval_us(&ru.ru_utime);
+        reply.stime_us  = timeval_us(&ru.ru_stime);
+        reply.maxrss_kb = ru.ru_maxrss;
+        reply.minflt    = ru.ru_minflt;
+        reply.majflt    = ru.ru_majflt;
+        reply.nvcsw     = ru.ru_nvcsw;
+        reply.nivcsw    = ru.ru_nivcsw;
+        if (send_all(sock, &reply, sizeof(reply)) < 0) return;
+    }
+}
+
+static void worker_loop(int listenfd) {
+    /* a worker does not outlive the server */
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    while (1) {
+        int sock = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "bsh: accept error for %s.\n", strerror(errno));
+            exit(1);
+        }
+        serve_connection(sock, listenfd);
+        close(sock);
+    }
+}
+
+static pid_t start_worker(int listenfd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        worker_loop(listenfd);
+        exit(0);
+    }
+    if (pid < 0) fprintf(stderr, "bsh: fork error for %s.\n", strerror(errno));
+    return pid;
+}
+
+int serve(const char* path, int workers) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "bsh: %s: socket path too long.\n", path);
+        return -1;
+    }
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0) workers = 1;
+    if (workers > MAXWORKERS) workers = MAXWORKERS;
+
+    int listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenfd < 0) {
+        fprintf(stderr, "bsh: socket error for %s.\n", strerror(errno));
+        return -1;
+    }
+    bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* a socket left by an earlier server is replaced */
+    struct stat statbuf;
+    if (lstat(path, &statbuf) == 0 && S_ISSOCK(statbuf.st_mode)) unlink(path);
+
+    mode_t mask = umask(077);
+    int err = bind(listenfd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (err < 0 || listen(listenfd, SOMAXCONN) < 0) {
+        fprintf(stderr, "bsh: %s: %s.\n", path, strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+
+    pid_t pids[MAXWORKERS];
+    for (int i = 0; i < workers; i++) {
+        pids[i] = start_worker(listenfd);
+    }
+
+    /* keep the pool full */
+    while (1) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] == pid) pids[i] = start_worker(listenfd);
+        }
+    }
+
+    close(listenfd);
+    return -1;
+}
@@ -0,0 +1,56 @@
+#ifndef BDU_SHELL_SERVE_H
+#define BDU_SHELL_SERVE_H
+
+#include <stdint.h>
+
+/*
+ * bsh --serve socket [workers]
+ *
+ * a pool of pre-forked workers accepts connections on a unix stream
+ * socket; each request is run in a fresh child of its worker, so cwd,
+ * environment and shell variables never leak between requests, and
+ * the reply carries the exit status and rusage of that child.
+ *
+ * request: struct serve_request, then script, cwd and env bytes;
+ * up to 3 fds sent with SCM_RIGHTS along with the header become
+ * stdin, stdout and stderr of the script, missing ones /dev/null.
+ * env is a list of NUL terminated "name=value" to set or "name" to
+ * unset, an empty cwd keeps the server's.
+ *
+ * a connection may carry any number of requests one after another.
+ */
+
+#define SERVE_REQUEST_MAGIC     0x51485342  /* "BSHQ" */
+#define SERVE_REPLY_MAGIC       0x52485342  /* "BSHR" */
+#define SERVE_MAXSCRIPT         (1024 * 1024)
+#define SERVE_MAXENV            (64 * 1024)
+#define SERVE_MAXFDS            3
+
+typedef struct serve_request serve_request;
+struct serve_request {
+    uint32_t magic;
+    uint32_t scriptlen;
+    uint32_t cwdlen;
+    uint32_t envlen;
+};
+
+typedef struct serve_reply serve_reply;
+struct serve_reply {
+    uint32_t magic;
+    int32_t  status;        /* exit status like $? */
+    int64_t  utime_us;
+    int64_t  stime_us;
+    int64_t  maxrss_kb;
+    int64_t  minflt;
+    int64_t  majflt;
+    int64_t  nvcsw;
+    int64_t  nivcsw;
+};
+
+/*
+ * serve requests until killed, return only if the socket cannot
+ * be set up
+ */
+int serve(const char* path, int workers);
+
+#endif /* BDU_SHELL_SERVE_H */
@@ -0,0 +1,422 @@
+#include "split.h"
+#include "bsh.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define SPLITREADLEN        (64 * 1024)
+/* an ordered chunk stops being read with this much output buffered */
+#define SPLITBUFMAX         (4 * SPLITCHUNK)
+
+/*
+ * one chunk of input and the copy of the filter working on it
+ */
+typedef struct split_chunk split_chunk;
+struct split_chunk {
+    int    used;
+    size_t seq;
+    pid_t  pid;
+    int    infd;        /* its stdin, -1 once everything is written */
+    int    outfd;       /* its stdout, -1 at EOF */
+    char*  in;
+    size_t inlen;
+    size_t inoff;
+    char*  out;         /* output not passed on yet */
+    size_t outlen;
+    size_t outcap;
+};
+
+typedef struct split_state split_state;
+struct split_state {
+    struct pipe_command* filter;
+    int                  copies;
+    int                  ordered;
+    int                  infd;      /* output of the producers, -1 at EOF */
+    char*                buf;       /* input not cut into a chunk yet */
+    size_t               len;
+    size_t               cap;
+    int                  outfd;
+    int                  outclosed; /* downstream is gone */
+    int                  nosplice;
+    size_t               nextseq;   /* of the next chunk started */
+    size_t               emitseq;   /* of the chunk whose output is due */
+    int                  status;    /* of the first copy which failed */
+    struct split_chunk   chunks[2 * MAXSPLIT];
+    size_t               maxchunks;
+};
+
+static void emit(struct split_state* st, const char* data, size_t len) {
+    while (len > 0 && !st->outclosed) {
+        ssize_t n = write(st->outfd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            st->outclosed = 1;
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static size_t running(const struct split_state* st) {
+    size_t count = 0;
+    for (size_t i = 0; i < st->maxchunks; i++) {
+        if (st->chunks[i].used && st->chunks[i].outfd >= 0) count += 1;
+    }
+    return count;
+}
+
+static struct split_chunk* free_chunk(struct split_state* st) {
+    if (running(st) >= (size_t)st->copies) return NULL;
+    for (size_t i = 0; i < st->maxchunks; i++) {
+        if (!st->chunks[i].used) return st->chunks + i;
+    }
+    return NULL;
+}
+
+static void close_input(struct split_chunk* c) {
+    if (c->infd >= 0) close(c->infd);
+    c->infd = -1;
+    mem_free(c->in);
+    c->in = NULL;
+}
+
+static void release(struct split_chunk* c) {
+    close_input(c);
+    mem_free(c->out);
+    c->out = NULL;
+    c->used = 0;
+}
+
+/*
+ * run a copy of the filter on data[0, len), the chunk owns data
+ */
+static int start_chunk(struct split_state* st, struct split_chunk* c,
+                       char* data, size_t len) {
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0) {
+        mem_free(data);
+        return -1;
+    }
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        close(in[0]);
+        close(in[1]);
+        mem_free(data);
+        return -1;
+    }
+
+    c->pid = spawn_command(st->filter->arglist, in[0], out[1], st->filter->stderrfd);
+    close(in[0]);
+    close(out[1]);
+    if (c->pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        mem_free(data);
+        return -1;
+    }
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+    c->used   = 1;
+    c->seq    = st->nextseq++;
+    c->infd   = in[1];
+    c->outfd  = out[0];
+    c->in     = data;
+    c->inlen  = len;
+    c->inoff  = 0;
+    c->out    = NULL;
+    c->outlen = 0;
+    c->outcap = 0;
+    return 0;
+}
+
+/*
+ * start chunks while copies are free and the input holds a complete
+ * one, or the rest of it at EOF
+ */
+static int cut_chunks(struct split_state* st) {
+    while (st->len > 0 && (st->len >= SPLITCHUNK || st->infd < 0)) {
+        size_t cut = st->len;
+        if (st->infd >= 0) {
+            const char* newline = memrchr(st->buf, '\n', st->len);
+            /* a line longer than the buffer, read on */
+            if (newline == NULL) return 0;
+            cut = newline - st->buf + 1;
+        }
+        struct split_chunk* c = free_chunk(st);
+        if (c == NULL) return 0;
+
+        /* the chunk takes the buffer, the rest of the line moves */
+        size_t rest = st->len - cut;
+        char* buf = (char*)mem_alloc(st->cap);
+        if (buf == NULL) return -1;
+        memcpy(buf, st->buf + cut, rest);
+        char* data = st->buf;
+        st->buf = buf;
+        st->len = rest;
+        if (start_chunk(st, c, data, cut) < 0) return -1;
+    }
+    return 0;
+}
+
+static void read_input(struct split_state* st) {
+    if (st->len == st->cap) {
+        char* p = (char*)mem_realloc(st->buf, st->cap * 2);
+        if (p == NULL) return;
+        st->buf = p;
+        st->cap *= 2;
+    }
+    ssize_t n = read(st->infd, st->buf + st->len, st->cap - st->len);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+    if (n <= 0) {
+        close(st->infd);
+        st->infd = -1;
+        return;
+    }
+    st->len += n;
+}
+
+static void write_input(struct split_chunk* c) {
+    ssize_t n = write(c->infd, c->in + c->inoff, c->inlen - c->inoff);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+    /* a filter like head may stop reading early */
+    if (n < 0) {
+        close_input(c);
+        return;
+    }
+    c->inoff += n;
+    if (c->inoff == c->inlen) close_input(c);
+}
+
+/* pass on the output of finished chunks and of the oldest running one */
+static void emit_ordered(struct split_state* st) {
+    while (1) {
+        struct split_chunk* c = NULL;
+        for (size_t i = 0; i < st->maxchunks && c == NULL; i++) {
+            if (st->chunks[i].used && st->chunks[i].seq == st->emitseq) c = st->chunks + i;
+        }
+        if (c == NULL) return;
+
+        emit(st, c->out, c->outlen);
+        c->outlen = 0;
+        if (c->outfd >= 0) return;
+        release(c);
+        st->emitseq += 1;
+    }
+}
+
+static void finish_chunk(struct split_state* st, struct split_chunk* c) {
+    close(c->outfd);
+    c->outfd = -1;
+    close_input(c);
+
+    int status = 0;
+    while (waitpid(c->pid, &status, 0) < 0 && errno == EINTR) {}
+    if (exit_status(status) != 0 && st->status == 0) st->status = exit_status(status);
+
+    if (!st->ordered) {
+        /* the last line may lack its newline */
+        emit(st, c->out, c->outlen);
+        release(c);
+    }
+}
+
+static void read_output(struct split_state* st, struct split_chunk* c) {
+    int due = st->ordered && c->seq == st->emitseq && c->outlen == 0;
+    if (due && !st->nosplice && !st->outclosed) {
+        /* the oldest chunk goes straight through */
+        ssize_t n = splice(c->outfd, NULL, st->outfd, NULL, SPLITCHUNK, SPLICE_F_MOVE);
+        if (n > 0) return;
+        if (n == 0) {
+            finish_chunk(st, c);
+            return;
+        }
+        if (errno == EINTR || errno == EAGAIN) return;
+        if (errno != EINVAL) {
+            st->outclosed = 1;
+            return;
+        }
+        /* not into a tty */
+        st->nosplice = 1;
+    }
+
+    if (c->outcap - c->outlen < SPLITREADLEN) {
+        size_t cap = c->outcap ? c->outcap * 2 : 4 * SPLITREADLEN;
+        char* p = (char*)mem_realloc(c->out, cap);
+        if (p == NULL) return;
+        c->out = p;
+        c->outcap = cap;
+    }
+    ssize_t n = read(c->outfd, c->out + c->outlen, c->outcap - c->outlen);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+    if (n <= 0) {
+        finish_chunk(st, c);
+        return;
+    }
+    c->outlen += n;
+
+    if (st->ordered) {
+        if (due) {
+            emit(st, c->out, c->outlen);
+            c->outlen = 0;
+        }
+        return;
+    }
+    /* whole lines only, so copies never mix inside a line */
+    const char* newline = memrchr(c->out, '\n', c->outlen);
+    if (newline) {
+        size_t len = newline - c->out + 1;
+        emit(st, c->out, len);
+        memmove(c->out, c->out + len, c->outlen - len);
+        c->outlen -= len;
+    }
+}
+
+static int split_loop(struct split_state* st) {
+    while (1) {
+        if (st->outclosed) {
+            /* nobody reads the output, stop feeding the copies */
+            if (st->infd >= 0) close(st->infd);
+            st->infd = -1;
+            st->len = 0;
+            for (size_t i = 0; i < st->maxchunks; i++) close_input(st->chunks + i);
+        }
+        if (cut_chunks(st) < 0) return -1;
+        if (st->ordered) emit_ordered(st);
+
+        struct pollfd pfds[4 * MAXSPLIT + 1];
+        struct split_chunk* owners[4 * MAXSPLIT + 1];
+        nfds_t nfds = 0;
+        /* more input only while it can become a chunk */
+        if (st->infd >= 0 && (st->len < SPLITCHUNK || memrchr(st->buf, '\n', st->len) == NULL)) {
+            pfds[nfds].fd = st->infd;
+            pfds[nfds].events = POLLIN;
+            owners[nfds++] = NULL;
+        }
+        for (size_t i = 0; i < st->maxchunks; i++) {
+            struct split_chunk* c = st->chunks + i;
+            if (!c->used) continue;
+            if (c->infd >= 0) {
+                pfds[nfds].fd = c->infd;
+                pfds[nfds].events = POLLOUT;
+                owners[nfds++] = c;
+            }
+            if (c->outfd >= 0 && c->outlen < SPLITBUFMAX) {
+                pfds[nfds].fd = c->outfd;
+                pfds[nfds].events = POLLIN;
+                owners[nfds++] = c;
+            }
+        }
+        if (nfds == 0) break;
+
+        if (poll(pfds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        for (nfds_t i = 0; i < nfds; i++) {
+            if (pfds[i].revents == 0) continue;
+            struct split_chunk* c = owners[i];
+            if (c == NULL) {
+                read_input(st);
+            } else if (pfds[i].events == POLLOUT) {
+                if (c->infd == pfds[i].fd) write_input(c);
+            } else if (c->outfd == pfds[i].fd) {
+                read_output(st, c);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * spawn cmds[first, last) connected by pipes, reading infd and
+ * writing outfd; return the pid of the last one or -1
+ */
+static pid_t spawn_stages(struct pipe_command** cmds, size_t first, size_t last,
+                          int infd, int outfd, pid_t* pids) {
+    pid_t pid = -1;
+    int readfd = infd;
+    for (size_t i = first; i < last; i++) {
+        int pipefd[2] = { -1, outfd };
+        if (i + 1 < last && pipe2(pipefd, O_CLOEXEC) < 0) break;
+        pid = spawn_command(cmds[i]->arglist, readfd, pipefd[1], cmds[i]->stderrfd);
+        pids[i] = pid;
+        if (readfd != infd) close(readfd);
+        if (i + 1 < last) close(pipefd[1]);
+        readfd = pipefd[0];
+        if (pid < 0) break;
+    }
+    if (readfd != infd && readfd >= 0) close(readfd);
+    return pid;
+}
+
+int execute_split(struct pipe_command** pipe_commands, size_t commands_len) {
+    size_t k = 0;
+    while (k < commands_len && pipe_commands[k]->split == 0) ++k;
+
+    struct split_state st;
+    bzero(&st, sizeof(st));
+    st.filter    = pipe_commands[k];
+    st.copies    = st.filter->split;
+    st.ordered   = st.filter->splitordered;
+    st.maxchunks = st.ordered ? 2 * (size_t)st.copies : (size_t)st.copies;
+    st.cap       = 2 * SPLITCHUNK;
+    st.buf       = (char*)mem_alloc(st.cap);
+    if (st.buf == NULL) return -1;
+
+    pid_t pids[MAXPIPECOUNT + 2];
+    for (size_t i = 0; i < commands_len; i++) pids[i] = -1;
+
+    /* producers into the shell */
+    int inpipe[2];
+    if (pipe2(inpipe, O_CLOEXEC) < 0) {
+        mem_free(st.buf);
+        return -1;
+    }
+    spawn_stages(pipe_commands, 0, k, pipe_commands[0]->stdinfd, inpipe[1], pids);
+    close(inpipe[1]);
+    st.infd = inpipe[0];
+    fcntl(st.infd, F_SETFL, O_NONBLOCK);
+
+    /* the shell into the consumers */
+    int outpipe[2] = { -1, -1 };
+    if (k + 1 < commands_len) {
+        if (pipe2(outpipe, O_CLOEXEC) == 0) {
+            struct pipe_command* last = pipe_commands[commands_len - 1];
+            spawn_stages(pipe_commands, k + 1, commands_len, outpipe[0], last->stdoutfd, pids);
+            close(outpipe[0]);
+        }
+        st.outfd = outpipe[1];
+    } else {
+        st.outfd = st.filter->stdoutfd >= 0 ? st.filter->stdoutfd : STDOUT_FILENO;
+    }
+
+    int err = st.outfd < 0 ? -1 : split_loop(&st);
+    if (err < 0) fprintf(stderr, "bsh: |%d|: %s.\n", st.copies, strerror(errno));
+
+    if (st.infd >= 0) close(st.infd);
+    for (size_t i = 0; i < st.maxchunks; i++) {
+        struct split_chunk* c = st.chunks + i;
+        if (!c->used) continue;
+        if (c->outfd >= 0) finish_chunk(&st, c);
+        release(c);
+    }
+    if (outpipe[1] >= 0) close(outpipe[1]);
+    mem_free(st.buf);
+
+    int status = st.status;
+    for (size_t i = 0; i < commands_len; i++) {
+        if (pids[i] <= 0) continue;
+        int wstatus = 0;
+        while (waitpid(pids[i], &wstatus, 0) < 0 && errno == EINTR) {}
+        if (i == commands_len - 1) status = exit_status(wstatus);
+    }
+    return err < 0 ? -1 : status;
+}
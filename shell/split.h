@@ -0,0 +1,23 @@
+#ifndef BDU_SHELL_SPLIT_H
+#define BDU_SHELL_SPLIT_H
+
+#include "parse.h"
+
+#define MAXSPLIT            64      /* copies of a |N| stage */
+#define SPLITCHUNK          (1024 * 1024)
+
+/*
+ * producer |N| filter | consumer
+ *
+ * the shell reads the output of the producer in large blocks, cuts it
+ * into chunks of about SPLITCHUNK bytes at line ends and runs every
+ * chunk through its own copy of filter, N copies at a time. |N| passes
+ * their output on line by line as it comes, |Nk| keeps it in the
+ * order of the chunks, splicing the oldest chunk's output straight
+ * through while later ones are buffered.
+ *
+ * return exit status of the last stage, or -1 on error
+ */
+int execute_split(struct pipe_command** pipe_commands, size_t commands_len);
+
+#endif /* BDU_SHELL_SPLIT_H */
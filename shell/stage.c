@@ -0,0 +1,461 @@
+#include "stage.h"
+#include "bsh.h"
+#include "read.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct stage_builtin stage_builtins[] = {
+    { "cat",    filter_cat_can_run,  filter_cat,     0 },
+    { "echo",   builtin_can_run,     builtin_echo,   0 },
+    { "grep",   filter_grep_can_run, filter_grep,    0 },
+    { "head",   filter_head_can_run, filter_head,    0 },
+    { "printf", builtin_can_run,     builtin_printf, 0 },
+    { "pwd",    builtin_can_run,     builtin_pwd,    0 },
+    { "wc",     filter_wc_can_run,   filter_wc,      0 },
+    { "xargs",  xargs_can_run,       xargs_run,      1 },
+};
+
+/*
+ * Ctrl-C while in-process stages run: the shell ignores SIGINT, so
+ * the stages read EOF and their writes fail instead of being killed
+ */
+static volatile sig_atomic_t stage_interrupted;
+
+#define STAGE_WAKESIG       SIGUSR2     /* breaks a stage out of read/write */
+#define STAGE_POLLNS        (100 * 1000 * 1000)
+
+const struct stage_builtin* find_stage_builtin(char** arglist) {
+    for (size_t i = 0; i < sizeof(stage_builtins) / sizeof(stage_builtins[0]); i++) {
+        if (strcmp(arglist[0], stage_builtins[i].name) == 0) {
+            return stage_builtins[i].can_run(arglist) ? stage_builtins + i : NULL;
+        }
+    }
+    return NULL;
+}
+
+int reader_init(struct stage_reader* r, int fd, int ownfd, struct ring* ring) {
+    r->fd    = fd;
+    r->ownfd = ownfd;
+    r->shellfd = 0;
+    r->ring  = ring;
+    r->cap   = STAGEBUFLEN;
+    r->start = 0;
+    r->end   = 0;
+    r->eof   = 0;
+    r->buf   = (char*)mem_alloc(r->cap);
+    return r->buf ? 0 : -1;
+}
+
+void reader_close(struct stage_reader* r) {
+    if (r->ring) {
+        /* tell the producer nobody is listening any more */
+        ring_close_read(r->ring);
+        r->ring = NULL;
+    } else if (r->ownfd && r->fd >= 0) {
+        close(r->fd);
+    } else if (r->shellfd) {
+        /* head stopped early, the rest is for whoever reads next */
+        input_give_back(r->fd, r->buf + r->start, r->end - r->start);
+    }
+    r->fd = -1;
+    mem_free(r->buf);
+    r->buf = NULL;
+}
+
+/*
+ * append more input at buf + end
+ */
+static ssize_t reader_fill(struct stage_reader* r) {
+    if (r->eof) return 0;
+
+    ssize_t rdcnt;
+    if (stage_interrupted) {
+        rdcnt = 0;
+    } else if (r->shellfd
+               && (rdcnt = input_take(r->fd, r->buf + r->end, r->cap - r->end)) > 0) {
+        /* what read x has read ahead comes first */
+    } else if (r->ring) {
+        rdcnt = ring_read(r->ring, r->buf + r->end, r->cap - r->end);
+    } else {
+        do {
+            rdcnt = read(r->fd, r->buf + r->end, r->cap - r->end);
+        } while (rdcnt < 0 && errno == EINTR && !stage_interrupted);
+        if (rdcnt < 0 && stage_interrupted) rdcnt = 0;
+    }
+
+    if (rdcnt == 0) r->eof = 1;
+    if (rdcnt > 0) r->end += rdcnt;
+    return rdcnt;
+}
+
+ssize_t reader_getline(struct stage_reader* r, const char** line) {
+    size_t scanned = r->start;
+    while (1) {
+        char* newline = memchr(r->buf + scanned, '\n', r->end - scanned);
+        if (newline) {
+            size_t len = newline - (r->buf + r->start) + 1;
+            *line = r->buf + r->start;
+            r->start += len;
+            return (ssize_t)len;
+        }
+
+        if (r->eof) {
+            /* last line without '\n' */
+            size_t len = r->end - r->start;
+            *line = r->buf + r->start;
+            r->start = r->end;
+            return (ssize_t)len;
+        }
+
+        /* make room for more input */
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == r->cap) {
+            char* p = (char*)mem_realloc(r->buf, r->cap * 2);
+            if (p == NULL) return -1;
+            r->buf = p;
+            r->cap *= 2;
+        }
+        scanned = r->end;
+        if (reader_fill(r) < 0) return -1;
+    }
+}
+
+ssize_t reader_getblock(struct stage_reader* r, const char** data) {
+    if (r->start == r->end) {
+        r->start = r->end = 0;
+        ssize_t rdcnt = reader_fill(r);
+        if (rdcnt <= 0) return rdcnt;
+    }
+
+    size_t len = r->end - r->start;
+    *data = r->buf + r->start;
+    r->start = r->end;
+    return (ssize_t)len;
+}
+
+ssize_t reader_read(struct stage_reader* r, void* buf, size_t len) {
+    if (r->start < r->end) {
+        size_t n = r->end - r->start < len ? r->end - r->start : len;
+        memcpy(buf, r->buf + r->start, n);
+        r->start += n;
+        return (ssize_t)n;
+    }
+    if (r->eof) return 0;
+
+    /* straight into the caller's buffer */
+    ssize_t rdcnt;
+    if (stage_interrupted) {
+        rdcnt = 0;
+    } else if (r->shellfd && (rdcnt = input_take(r->fd, buf, len)) > 0) {
+        /* what read x has read ahead comes first */
+    } else if (r->ring) {
+        rdcnt = ring_read(r->ring, buf, len);
+    } else {
+        do {
+            rdcnt = read(r->fd, buf, len);
+        } while (rdcnt < 0 && errno == EINTR && !stage_interrupted);
+        if (rdcnt < 0 && stage_interrupted) rdcnt = 0;
+    }
+    if (rdcnt == 0) r->eof = 1;
+    return rdcnt;
+}
+
+int writer_init(struct stage_writer* w, int fd, int ownfd, struct ring* ring) {
+    w->fd     = fd;
+    w->ownfd  = ownfd;
+    w->ring   = ring;
+    w->len    = 0;
+    w->closed = 0;
+    w->buf    = (char*)mem_alloc(STAGEBUFLEN);
+    return w->buf ? 0 : -1;
+}
+
+static int writer_put(struct stage_writer* w, const char* data, size_t len) {
+    if (stage_interrupted) {
+        w->closed = 1;
+        return -1;
+    }
+    if (w->ring) {
+        if (ring_write(w->ring, data, len) < 0) w->closed = 1;
+        return w->closed ? -1 : 0;
+    }
+
+    while (len > 0) {
+        ssize_t wrcnt = write(w->fd, data, len);
+        if (wrcnt < 0) {
+            if (errno == EINTR && !stage_interrupted) continue;
+            /* EPIPE: SIGPIPE is ignored in the shell */
+            w->closed = 1;
+            return -1;
+        }
+        data += wrcnt;
+        len -= wrcnt;
+    }
+    return 0;
+}
+
+int writer_flush(struct stage_writer* w) {
+    if (w->closed) return -1;
+    if (w->len == 0) return 0;
+
+    size_t len = w->len;
+    w->len = 0;
+    return writer_put(w, w->buf, len);
+}
+
+int writer_write(struct stage_writer* w, const void* data, size_t len) {
+    if (w->closed) return -1;
+
+    if (w->len + len > STAGEBUFLEN) {
+        if (writer_flush(w) < 0) return -1;
+        /* large blocks skip the batch buffer */
+        if (len >= STAGEBUFLEN) return writer_put(w, (const char*)data, len);
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    return 0;
+}
+
+void writer_close(struct stage_writer* w) {
+    writer_flush(w);
+    if (w->ring) {
+        ring_close_write(w->ring);
+        w->ring = NULL;
+    } else if (w->ownfd && w->fd >= 0) {
+        close(w->fd);
+    }
+    w->fd = -1;
+    mem_free(w->buf);
+    w->buf = NULL;
+}
+
+typedef struct stage_thread stage_thread;
+struct stage_thread {
+    const struct stage_builtin* builtin;
+    char**                      arglist;
+    struct stage_io             io;
+    pthread_t                   thread;
+    int                         started;
+    int                         status;
+};
+
+static void* stage_main(void* arg) {
+    struct stage_thread* st = (struct stage_thread*)arg;
+
+    st->status = st->builtin->run(st->arglist, &st->io);
+    /* EOF downstream, early termination upstream */
+    writer_close(&st->io.out);
+    reader_close(&st->io.in);
+    return NULL;
+}
+
+static void stage_sigint(int sig) {
+    (void)sig;
+    stage_interrupted = 1;
+}
+
+static void stage_wake(int sig) {
+    (void)sig;
+}
+
+/*
+ * stop every stage which has not returned yet: rings report EOF to
+ * readers and failure to writers, a signal without SA_RESTART
+ * breaks a blocking read or write on an fd
+ */
+static void interrupt_stages(struct stage_thread* threads, size_t n,
+                             struct ring* rings, const int* is_ring) {
+    for (size_t i = 0; i + 1 < n; i++) {
+        if (!is_ring[i]) continue;
+        ring_close_read(rings + i);
+        ring_close_write(rings + i);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (threads[i].started) pthread_kill(threads[i].thread, STAGE_WAKESIG);
+    }
+}
+
+/*
+ * join a stage, waking all of them again and again once Ctrl-C came:
+ * a stage may have checked stage_interrupted just before blocking
+ */
+static void join_stage(struct stage_thread* threads, size_t i, size_t n,
+                       struct ring* rings, const int* is_ring) {
+    while (1) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += STAGE_POLLNS;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+        if (pthread_timedjoin_np(threads[i].thread, NULL, &deadline) != ETIMEDOUT) break;
+        if (stage_interrupted) interrupt_stages(threads, n, rings, is_ring);
+    }
+    threads[i].started = 0;
+}
+
+int execute_fused_pipe(struct pipe_command** pipe_commands, size_t commands_len) {
+    assert(commands_len > 0 && commands_len <= MAXPIPECOUNT + 1);
+
+    const struct stage_builtin* builtins[MAXPIPECOUNT + 1];
+    struct stage_thread threads[MAXPIPECOUNT + 1];
+    pid_t pids[MAXPIPECOUNT + 1];
+    /* edge i connects stage i and stage i + 1 */
+    struct ring rings[MAXPIPECOUNT];
+    int is_ring[MAXPIPECOUNT];
+    int pipefds[MAXPIPECOUNT][2];
+
+    size_t n = commands_len;
+    for (size_t i = 0; i < n; i++) {
+        builtins[i] = find_stage_builtin(pipe_commands[i]->arglist);
+        pids[i] = -1;
+        threads[i].started = 0;
+        threads[i].status = 127;
+    }
+
+    /* rings between two in-process stages, pipes at the boundaries */
+    size_t edges = 0;
+    for (; edges + 1 < n; edges++) {
+        is_ring[edges] = builtins[edges] && builtins[edges + 1] &&
+                         !builtins[edges]->forks;
+        int err = is_ring[edges] ?
+            ring_init(rings + edges, RINGSIZE) :
+            pipe2(pipefds[edges], O_CLOEXEC);
+        if (err < 0) {
+            fprintf(stderr, "bsh: pipe error for %s.\n", strerror(errno));
+            break;
+        }
+    }
+    if (edges + 1 < n) {
+        for (size_t i = 0; i < edges; i++) {
+            if (is_ring[i]) {
+                ring_destroy(rings + i);
+            } else {
+                close(pipefds[i][0]);
+                close(pipefds[i][1]);
+            }
+        }
+        return -1;
+    }
+
+    /* fork external commands before any thread exists */
+    for (size_t i = 0; i < n; i++) {
+        if (builtins[i]) continue;
+
+        struct pipe_command* command = pipe_commands[i];
+        if (i > 0) command->stdinfd = pipefds[i - 1][0];
+        if (i + 1 < n) command->stdoutfd = pipefds[i][1];
+        pids[i] = fork_and_execute(command);
+
+        if (i > 0) {
+            close(pipefds[i - 1][0]);
+            command->stdinfd = -2;
+        }
+        if (i + 1 < n) {
+            close(pipefds[i][1]);
+            command->stdoutfd = -2;
+        }
+    }
+
+    /* only this thread takes SIGINT, stages get STAGE_WAKESIG */
+    struct sigaction sa;
+    struct sigaction oldint;
+    struct sigaction oldwake;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = stage_wake;
+    sigaction(STAGE_WAKESIG, &sa, &oldwake);
+    sa.sa_handler = stage_sigint;
+    sigaction(SIGINT, &sa, &oldint);
+    stage_interrupted = 0;
+
+    sigset_t intset;
+    sigset_t oldset;
+    sigemptyset(&intset);
+    sigaddset(&intset, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &intset, &oldset);
+
+    for (size_t i = 0; i < n; i++) {
+        if (builtins[i] == NULL) continue;
+
+        struct pipe_command* command = pipe_commands[i];
+        struct stage_thread* st = threads + i;
+        st->builtin = builtins[i];
+        st->arglist = command->arglist;
+        st->io.errfd = command->stderrfd >= 0 ? command->stderrfd : STDERR_FILENO;
+
+        int err = 0;
+        if (i == 0) {
+            int fd = command->stdinfd >= 0 ? command->stdinfd : STDIN_FILENO;
+            err |= reader_init(&st->io.in, fd, 0, NULL);
+            st->io.in.shellfd = command->stdinfd < 0;
+        } else if (is_ring[i - 1]) {
+            err |= reader_init(&st->io.in, -1, 0, rings + i - 1);
+        } else {
+            err |= reader_init(&st->io.in, pipefds[i - 1][0], 1, NULL);
+        }
+
+        if (i + 1 == n) {
+            int fd = command->stdoutfd >= 0 ? command->stdoutfd : STDOUT_FILENO;
+            err |= writer_init(&st->io.out, fd, 0, NULL);
+        } else if (is_ring[i]) {
+            err |= writer_init(&st->io.out, -1, 0, rings + i);
+        } else {
+            err |= writer_init(&st->io.out, pipefds[i][1], 1, NULL);
+        }
+
+        if (err == 0 && pthread_create(&st->thread, NULL, stage_main, st) == 0) {
+            st->started = 1;
+        } else {
+            fprintf(stderr, "bsh: %s: cannot start stage.\n", st->arglist[0]);
+            st->status = 1;
+            writer_close(&st->io.out);
+            reader_close(&st->io.in);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+    int status = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (threads[i].started) {
+            join_stage(threads, i, n, rings, is_ring);
+            status = threads[i].status;
+        } else if (pids[i] > 0) {
+            int wstatus = 0;
+            waitpid(pids[i], &wstatus, 0);
+            status = exit_status(wstatus);
+        } else {
+            status = threads[i].status;
+        }
+    }
+
+    for (size_t i = 0; i + 1 < n; i++) {
+        if (is_ring[i]) ring_destroy(rings + i);
+    }
+
+    sigaction(SIGINT, &oldint, NULL);
+    sigaction(STAGE_WAKESIG, &oldwake, NULL);
+    if (stage_interrupted) {
+        stage_interrupted = 0;
+        return 128 + SIGINT;
+    }
+    return status;
+}
@@ -0,0 +1,113 @@
+#ifndef BDU_SHELL_STAGE_H
+#define BDU_SHELL_STAGE_H
+
+#include <sys/types.h>
+
+#include "parse.h"
+#include "ring.h"
+
+#define STAGEBUFLEN         (64 * 1024)
+
+/*
+ * input of an in-process pipeline stage: a file descriptor or
+ * the ring written by the previous stage
+ */
+typedef struct stage_reader stage_reader;
+struct stage_reader {
+    int          fd;
+    int          ownfd;     /* close fd when the stage is done */
+    int          shellfd;   /* fd of the shell, shares its read lookahead */
+    struct ring* ring;
+    char*        buf;
+    size_t       cap;
+    size_t       start;
+    size_t       end;
+    int          eof;
+};
+
+/*
+ * output of an in-process pipeline stage, small writes are
+ * batched before they reach the fd or the ring
+ */
+typedef struct stage_writer stage_writer;
+struct stage_writer {
+    int          fd;
+    int          ownfd;
+    struct ring* ring;
+    char*        buf;
+    size_t       len;
+    int          closed;    /* downstream is gone */
+};
+
+typedef struct stage_io stage_io;
+struct stage_io {
+    struct stage_reader in;
+    struct stage_writer out;
+    int                 errfd;
+};
+
+int reader_init(struct stage_reader* r, int fd, int ownfd, struct ring* ring);
+void reader_close(struct stage_reader* r);
+/*
+ * return length of next line including '\n', 0 at EOF, -1 on error,
+ * *line stays valid until the next call
+ */
+ssize_t reader_getline(struct stage_reader* r, const char** line);
+/*
+ * return next block of input, 0 at EOF, -1 on error
+ */
+ssize_t reader_getblock(struct stage_reader* r, const char** data);
+/*
+ * read at most len bytes into buf, 0 at EOF, -1 on error
+ */
+ssize_t reader_read(struct stage_reader* r, void* buf, size_t len);
+
+int writer_init(struct stage_writer* w, int fd, int ownfd, struct ring* ring);
+/* return -1 if downstream is gone */
+int writer_write(struct stage_writer* w, const void* data, size_t len);
+int writer_flush(struct stage_writer* w);
+void writer_close(struct stage_writer* w);
+
+/*
+ * a built-in which can run as a thread inside a pipeline
+ */
+typedef struct stage_builtin stage_builtin;
+struct stage_builtin {
+    const char* name;
+    /* return 0 if arguments need the external command */
+    int (*can_run)(char** arglist);
+    int (*run)(char** arglist, struct stage_io* io);
+    int forks;      /* output comes from child processes: never a ring */
+};
+
+const struct stage_builtin* find_stage_builtin(char** arglist);
+
+/*
+ * run a pipeline which contains in-process stages:
+ * consecutive in-process stages are threads connected by rings,
+ * external commands are forked and connected by real pipes.
+ * return exit status of the last stage, or -1 on error
+ */
+int execute_fused_pipe(struct pipe_command** pipe_commands, size_t commands_len);
+
+/* filters.c */
+int filter_cat_can_run(char** arglist);
+int filter_cat(char** arglist, struct stage_io* io);
+int filter_head_can_run(char** arglist);
+int filter_head(char** arglist, struct stage_io* io);
+int filter_grep_can_run(char** arglist);
+int filter_grep(char** arglist, struct stage_io* io);
+int filter_wc_can_run(char** arglist);
+int filter_wc(char** arglist, struct stage_io* io);
+
+/* builtins.c */
+int builtin_can_run(char** arglist);
+int builtin_echo(char** arglist, struct stage_io* io);
+int builtin_printf(char** arglist, struct stage_io* io);
+int builtin_pwd(char** arglist, struct stage_io* io);
+
+/* xargs.c */
+int xargs_can_run(char** arglist);
+int xargs_run(char** arglist, struct stage_io* io);
+
+#endif /* BDU_SHELL_STAGE_H */
@@ -0,0 +1,295 @@
+#include "test.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATCACHESIZE       8
+#define STATCACHEPATHLEN    256
+
+/*
+ * cached result of stat(2) or lstat(2) for one path,
+ * a failed call is cached as well (err != 0)
+ */
+struct stat_cache_entry {
+    char        path[STATCACHEPATHLEN];
+    int         is_lstat;
+    int         err;
+    struct stat statbuf;
+};
+
+static struct stat_cache_entry stat_cache[STATCACHESIZE];
+static size_t stat_cache_len  = 0;
+static size_t stat_cache_next = 0;   /* slot replaced when cache is full */
+
+void test_stat_cache_clear() {
+    stat_cache_len = 0;
+    stat_cache_next = 0;
+}
+
+/*
+ * return 0 and fill statbuf if path exists
+ */
+static int cached_stat(const char* path, int is_lstat, struct stat* statbuf) {
+    size_t pathlen = strlen(path);
+
+    for (size_t i = 0; i < stat_cache_len; i++) {
+        struct stat_cache_entry* entry = stat_cache + i;
+        if (entry->is_lstat == is_lstat && strcmp(entry->path, path) == 0) {
+            if (entry->err) return -1;
+            *statbuf = entry->statbuf;
+            return 0;
+        }
+    }
+
+    int err = is_lstat ? lstat(path, statbuf) : stat(path, statbuf);
+    if (pathlen < STATCACHEPATHLEN) {
+        struct stat_cache_entry* entry;
+        if (stat_cache_len < STATCACHESIZE) {
+            entry = stat_cache + stat_cache_len++;
+        } else {
+            entry = stat_cache + stat_cache_next;
+            stat_cache_next = (stat_cache_next + 1) % STATCACHESIZE;
+        }
+        memcpy(entry->path, path, pathlen + 1);
+        entry->is_lstat = is_lstat;
+        entry->err = err < 0 ? errno : 0;
+        if (err == 0) entry->statbuf = *statbuf;
+    }
+
+    return err;
+}
+
+static int parse_integer(const char* str, long long* value) {
+    char* end = NULL;
+    errno = 0;
+    *value = strtoll(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0') {
+        fprintf(stderr, "test: %s: integer expression expected.\n", str);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * recursive descent over the argument list:
+ *   expr    := and_expr [ -o expr ]
+ *   and_expr:= not_expr [ -a and_expr ]
+ *   not_expr:= ! not_expr | primary
+ *   primary := ( expr ) | unary-op arg | arg binary-op arg | arg
+ */
+struct test_parser {
+    char** args;
+    int    argc;
+    int    rank;
+    int    error;
+};
+
+static int test_expr(struct test_parser* tp);
+
+static int is_unary_op(const char* op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+           strchr("bcdefghLnprsSwxz", op[1]) != NULL;
+}
+
+static int unary_test(char op, const char* arg) {
+    struct stat statbuf;
+
+    switch (op) {
+        case 'z':
+            return arg[0] == '\0';
+        case 'n':
+            return arg[0] != '\0';
+        case 'r':
+            return access(arg, R_OK) == 0;
+        case 'w':
+            return access(arg, W_OK) == 0;
+        case 'x':
+            return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L':
+            return cached_stat(arg, 1, &statbuf) == 0 && S_ISLNK(statbuf.st_mode);
+        default:
+            break;
+    }
+
+    if (cached_stat(arg, 0, &statbuf) < 0) return 0;
+    switch (op) {
+        case 'e':
+            return 1;
+        case 'f':
+            return S_ISREG(statbuf.st_mode);
+        case 'd':
+            return S_ISDIR(statbuf.st_mode);
+        case 'b':
+            return S_ISBLK(statbuf.st_mode);
+        case 'c':
+            return S_ISCHR(statbuf.st_mode);
+        case 'p':
+            return S_ISFIFO(statbuf.st_mode);
+        case 'S':
+            return S_ISSOCK(statbuf.st_mode);
+        case 's':
+            return statbuf.st_size > 0;
+        case 'g':
+            return (statbuf.st_mode & S_ISGID) != 0;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+/*
+ * return -1 if op is not a binary operator
+ */
+static int binary_test(struct test_parser* tp,
+                       const char* lhs, const char* op, const char* rhs) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(lhs, rhs) == 0;
+    } else if (strcmp(op, "!=") == 0) {
+        return strcmp(lhs, rhs) != 0;
+    } else if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0) {
+        struct stat lstatbuf, rstatbuf;
+        int lok = cached_stat(lhs, 0, &lstatbuf) == 0;
+        int rok = cached_stat(rhs, 0, &rstatbuf) == 0;
+        if (op[1] == 'n') {
+            return lok && (!rok || lstatbuf.st_mtime > rstatbuf.st_mtime);
+        }
+        return rok && (!lok || lstatbuf.st_mtime < rstatbuf.st_mtime);
+    } else if (strcmp(op, "-ef") == 0) {
+        struct stat lstatbuf, rstatbuf;
+        return cached_stat(lhs, 0, &lstatbuf) == 0 &&
+               cached_stat(rhs, 0, &rstatbuf) == 0 &&
+               lstatbuf.st_dev == rstatbuf.st_dev &&
+               lstatbuf.st_ino == rstatbuf.st_ino;
+    }
+
+    static const char* intops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    for (size_t i = 0; i < sizeof(intops) / sizeof(intops[0]); i++) {
+        if (strcmp(op, intops[i]) != 0) continue;
+
+        long long lval, rval;
+        if (parse_integer(lhs, &lval) < 0 || parse_integer(rhs, &rval) < 0) {
+            tp->error = 1;
+            return 0;
+        }
+        switch (i) {
+            case 0: return lval == rval;
+            case 1: return lval != rval;
+            case 2: return lval <  rval;
+            case 3: return lval <= rval;
+            case 4: return lval >  rval;
+            default: return lval >= rval;
+        }
+    }
+
+    return -1;
+}
+
+static int test_primary(struct test_parser* tp) {
+    if (tp->rank >= tp->argc) {
+        fprintf(stderr, "test: argument expected.\n");
+        tp->error = 1;
+        return 0;
+    }
+
+    const char* arg = tp->args[tp->rank];
+    int remain = tp->argc - tp->rank;
+
+    if (strcmp(arg, "(") == 0 && remain >= 3) {
+        tp->rank += 1;
+        int result = test_expr(tp);
+        if (tp->rank >= tp->argc || strcmp(tp->args[tp->rank], ")") != 0) {
+            fprintf(stderr, "test: ')' expected.\n");
+            tp->error = 1;
+            return 0;
+        }
+        tp->rank += 1;
+        return result;
+    }
+
+    /* binary operator has priority: [ -f = -f ] compares strings */
+    if (remain >= 3) {
+        int result = binary_test(tp, arg, tp->args[tp->rank + 1],
+                                 tp->args[tp->rank + 2]);
+        if (result >= 0) {
+            tp->rank += 3;
+            return result;
+        }
+    }
+
+    if (remain >= 2 && is_unary_op(arg)) {
+        tp->rank += 2;
+        return unary_test(arg[1], tp->args[tp->rank - 1]);
+    }
+
+    /* single string: true if not empty */
+    tp->rank += 1;
+    return arg[0] != '\0';
+}
+
+static int test_not(struct test_parser* tp) {
+    if (tp->rank < tp->argc - 1 && strcmp(tp->args[tp->rank], "!") == 0) {
+        tp->rank += 1;
+        return !test_not(tp);
+    }
+    return test_primary(tp);
+}
+
+static int test_and(struct test_parser* tp) {
+    int result = test_not(tp);
+    while (!tp->error &&
+           tp->rank < tp->argc && strcmp(tp->args[tp->rank], "-a") == 0) {
+        tp->rank += 1;
+        int rhs = test_not(tp);
+        result = result && rhs;
+    }
+    return result;
+}
+
+static int test_expr(struct test_parser* tp) {
+    int result = test_and(tp);
+    while (!tp->error &&
+           tp->rank < tp->argc && strcmp(tp->args[tp->rank], "-o") == 0) {
+        tp->rank += 1;
+        int rhs = test_and(tp);
+        result = result || rhs;
+    }
+    return result;
+}
+
+int do_test(char** arglist) {
+    int argc = 0;
+    while (arglist[argc] != NULL) ++argc;
+
+    if (strcmp(arglist[0], "[") == 0) {
+        if (strcmp(arglist[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'.\n");
+            return 2;
+        }
+        argc -= 1;
+    }
+
+    /* no expression: false */
+    if (argc == 1) return 1;
+
+    struct test_parser tp;
+    tp.args  = arglist + 1;
+    tp.argc  = argc - 1;
+    tp.rank  = 0;
+    tp.error = 0;
+
+    int result = test_expr(&tp);
+    if (!tp.error && tp.rank != tp.argc) {
+        fprintf(stderr, "test: %s: unexpected operator.\n", tp.args[tp.rank]);
+        tp.error = 1;
+    }
+    if (tp.error) return 2;
+
+    return result ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#ifndef BDU_SHELL_TEST_H
+#define BDU_SHELL_TEST_H
+
+/*
+ * test / [ built-in command
+ *
+ * return 0 if expression is true, 1 if false, 2 on syntax error
+ */
+int do_test(char** arglist);
+
+/*
+ * stat(2) results gathered by test are kept within one command line
+ * or script statement, until a command or redirection may change the
+ * file system, so a chain like [ -e f ] && [ -f f ] && [ -r f ]
+ * stats the file only once.
+ */
+void test_stat_cache_clear();
+
+#endif /* BDU_SHELL_TEST_H */
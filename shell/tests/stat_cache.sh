@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# test must not reuse a stat(2) result after the file changed
+#
+# usage: tests/stat_cache.sh    (run from the shell directory)
+
+BSH=${BSH:-./bsh}
+DIR=${TMPDIR:-/tmp}/bsh-stat-cache-test.$$
+FAILED=0
+
+mkdir -p "$DIR"
+trap 'rm -rf "$DIR"' EXIT
+
+# check name expected command...
+check() {
+    name=$1
+    expected=$2
+    shift 2
+    rm -f "$DIR/f"
+    actual=$(cd "$DIR" && "$@" 2>&1)
+    if [ "$actual" = "$expected" ]; then
+        echo "ok     $name"
+    else
+        echo "FAILED $name: expected '$expected', got '$actual'"
+        FAILED=1
+    fi
+}
+
+BSH=$(cd "$(dirname "$BSH")" && pwd)/$(basename "$BSH")
+
+check "redirection on one line" ok \
+    "$BSH" -c '[ -e f ] || echo hi > f; [ -e f ] && echo ok'
+
+# echo writes through an fd the shell already holds, nothing is opened
+check "built-in output redirection" ok \
+    "$BSH" -c ': > f; exec 3>>f; [ -s f ] || echo hi >&3; [ -s f ] && echo ok'
+
+cat > "$DIR/create.bsh" <<'SCRIPT'
+test -e f
+echo hi > f
+test -e f && echo ok
+SCRIPT
+check "script statements" ok "$BSH" create.bsh
+
+cat > "$DIR/append.bsh" <<'SCRIPT'
+n=0
+while test $n -lt 3; do
+    n=$((n + 1))
+    test -s f && echo $n
+    echo data >> f
+done
+SCRIPT
+check "append in a loop" "2
+3" "$BSH" append.bsh
+
+exit $FAILED
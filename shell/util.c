@@ -1,4 +1,5 @@
 #include "util.h"
+#include "mem.h"
 
 #include <assert.h>
 #include <string.h>
@@ -20,7 +21,7 @@ char* make_arg(const struct string_view* sv) {
     /* not null or empty string */
     assert(sv && sv->str && sv->str[0] != '\0');
 
-    char* cp = (char*)malloc(sv->len + 1);
+    char* cp = (char*)mem_alloc(sv->len + 1);
     if (cp) {
         cp[0] = 0;
         strncpy(cp, sv->str, sv->len);
@@ -35,7 +36,7 @@ char* make_arg(const struct string_view* sv) {
  */
 void freearglist(const char* arglist[]) {
     for (size_t i = 0; arglist[i] != 0; i++) {
-        free((char*)arglist[i]);
+        mem_free((char*)arglist[i]);
     }
 }
 
@@ -0,0 +1,304 @@
+#include "vars.h"
+#include "bsh.h"
+#include "arith.h"
+#include "mem.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define VARBUCKETS      64
+
+typedef struct var_entry var_entry;
+struct var_entry {
+    char*             name;
+    char*             value;
+    struct var_entry* next;
+};
+
+static struct var_entry* var_table[VARBUCKETS];
+
+static struct positional positional_params = { NULL, 0 };
+
+static size_t var_hash(const char* name, size_t namelen) {
+    size_t h = 5381;
+    for (size_t i = 0; i < namelen; i++) {
+        h = h * 33 + (unsigned char)name[i];
+    }
+    return h % VARBUCKETS;
+}
+
+static struct var_entry** var_find(const char* name, size_t namelen) {
+    struct var_entry** link = var_table + var_hash(name, namelen);
+    while (*link) {
+        if (strncmp((*link)->name, name, namelen) == 0 &&
+            (*link)->name[namelen] == '\0') {
+            break;
+        }
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+const char* var_get(const char* name, size_t namelen) {
+    struct var_entry** link = var_find(name, namelen);
+    if (*link) return (*link)->value;
+
+    char buf[256];
+    if (namelen >= sizeof(buf)) return NULL;
+    memcpy(buf, name, namelen);
+    buf[namelen] = '\0';
+    return getenv(buf);
+}
+
+int var_set(const char* name, size_t namelen, const char* value) {
+    return var_set_len(name, namelen, value, strlen(value));
+}
+
+int var_set_len(const char* name, size_t namelen,
+                const char* value, size_t valuelen) {
+    char* cpvalue = (char*)mem_alloc(valuelen + 1);
+    if (cpvalue == NULL) return -1;
+    memcpy(cpvalue, value, valuelen);
+    cpvalue[valuelen] = '\0';
+
+    struct var_entry** link = var_find(name, namelen);
+    if (*link) {
+        mem_free((*link)->value);
+        (*link)->value = cpvalue;
+        return 0;
+    }
+
+    struct var_entry* entry = (struct var_entry*)mem_alloc(sizeof(struct var_entry));
+    char* cpname = (char*)mem_alloc(namelen + 1);
+    if (entry == NULL || cpname == NULL) {
+        mem_free(entry);
+        mem_free(cpname);
+        mem_free(cpvalue);
+        return -1;
+    }
+    memcpy(cpname, name, namelen);
+    cpname[namelen] = '\0';
+    entry->name  = cpname;
+    entry->value = cpvalue;
+    entry->next  = NULL;
+    *link = entry;
+
+    return 0;
+}
+
+void var_unset(const char* name, size_t namelen) {
+    struct var_entry** link = var_find(name, namelen);
+    struct var_entry* entry = *link;
+    if (entry) {
+        *link = entry->next;
+        mem_free(entry->name);
+        mem_free(entry->value);
+        mem_free(entry);
+    }
+}
+
+static int is_name_start(char ch) {
+    return isalpha((unsigned char)ch) || ch == '_';
+}
+
+static int is_name_char(char ch) {
+    return isalnum((unsigned char)ch) || ch == '_';
+}
+
+size_t is_assignment(const char* arg) {
+    if (!is_name_start(arg[0])) return 0;
+
+    size_t i = 1;
+    while (is_name_char(arg[i])) ++i;
+    return arg[i] == '=' ? i : 0;
+}
+
+void positional_set(int argc, char** argv, struct positional* saved) {
+    if (saved) *saved = positional_params;
+
+    char** cpargv = (char**)mem_alloc(sizeof(char*) * (argc + 1));
+    if (cpargv == NULL) {
+        positional_params.argv = NULL;
+        positional_params.argc = 0;
+        return;
+    }
+    for (int i = 0; i < argc; i++) {
+        cpargv[i] = mem_strdup(argv[i]);
+    }
+    cpargv[argc] = NULL;
+    positional_params.argv = cpargv;
+    positional_params.argc = argc;
+}
+
+void positional_restore(struct positional* saved) {
+    if (positional_params.argv) {
+        freearglist((const char**)positional_params.argv);
+        mem_free(positional_params.argv);
+    }
+    positional_params = *saved;
+}
+
+/*
+ * value of $?, $# or $0-$9, return NULL if unset
+ */
+static const char* var_special(char ch, char* numbuf, size_t buflen) {
+    if (ch == '?') {
+        snprintf(numbuf, buflen, "%d", last_exit_status);
+        return numbuf;
+    } else if (ch == '#') {
+        int count = positional_params.argc > 0 ? positional_params.argc - 1 : 0;
+        snprintf(numbuf, buflen, "%d", count);
+        return numbuf;
+    } else if (isdigit((unsigned char)ch)) {
+        int index = ch - '0';
+        return index < positional_params.argc ? positional_params.argv[index] : NULL;
+    }
+    return NULL;
+}
+
+/*
+ * growable output buffer of expand_arg
+ */
+struct expand_buf {
+    char*  str;
+    size_t len;
+    size_t cap;
+};
+
+static int expand_append(struct expand_buf* eb, const char* str, size_t len) {
+    if (eb->len + len + 1 > eb->cap) {
+        size_t cap = eb->cap * 2;
+        while (cap < eb->len + len + 1) cap *= 2;
+        char* p = (char*)mem_realloc(eb->str, cap);
+        if (p == NULL) return -1;
+        eb->str = p;
+        eb->cap = cap;
+    }
+    memcpy(eb->str + eb->len, str, len);
+    eb->len += len;
+    eb->str[eb->len] = '\0';
+    return 0;
+}
+
+static int expand_positional_all(struct expand_buf* eb) {
+    for (int i = 1; i < positional_params.argc; i++) {
+        if (i > 1 && expand_append(eb, " ", 1) < 0) return -1;
+        const char* arg = positional_params.argv[i];
+        if (expand_append(eb, arg, strlen(arg)) < 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * expand one $-expression at str[0] == '$',
+ * return length consumed from str
+ */
+static size_t expand_dollar(const char* str, size_t len, struct expand_buf* eb,
+                            int* err) {
+    char numbuf[32];
+    const char* value = NULL;
+    size_t consumed = 1;
+
+    if (len < 2) {
+        *err = expand_append(eb, "$", 1);
+        return 1;
+    }
+
+    char ch = str[1];
+    if (ch == '?' || ch == '#' || isdigit((unsigned char)ch)) {
+        value = var_special(ch, numbuf, sizeof(numbuf));
+        consumed = 2;
+    } else if (ch == '@' || ch == '*') {
+        *err = expand_positional_all(eb);
+        return 2;
+    } else if (ch == '(' && (consumed = arith_span(str, len)) > 0) {
+        /* $(( expression )), evaluated in place unless it holds $ */
+        struct string_view expr;
+        expr.str = str + 3;
+        expr.len = consumed - 5;
+        char* text = NULL;
+        if (memchr(expr.str, '$', expr.len)) {
+            text = expand_arg(&expr);
+            if (text == NULL) {
+                *err = -1;
+                return consumed;
+            }
+            expr.str = text;
+            expr.len = strlen(text);
+        }
+        int64_t result;
+        int evalerr = arith_eval(expr.str, expr.len, &result);
+        mem_free(text);
+        if (evalerr < 0) {
+            *err = -1;
+            return consumed;
+        }
+        snprintf(numbuf, sizeof(numbuf), "%" PRId64, result);
+        value = numbuf;
+    } else if (ch == '{') {
+        const char* close = memchr(str + 2, '}', len - 2);
+        if (close == NULL) {
+            *err = expand_append(eb, str, len);
+            return len;
+        }
+        value = var_get(str + 2, close - (str + 2));
+        consumed = close - str + 1;
+    } else if (is_name_start(ch)) {
+        size_t namelen = 1;
+        while (1 + namelen < len && is_name_char(str[1 + namelen])) ++namelen;
+        value = var_get(str + 1, namelen);
+        consumed = 1 + namelen;
+    } else {
+        /* lonely $ */
+        *err = expand_append(eb, "$", 1);
+        return 1;
+    }
+
+    if (value) *err = expand_append(eb, value, strlen(value));
+    return consumed;
+}
+
+char* expand_arg(const struct string_view* sv) {
+    assert(sv && sv->str);
+
+    if (memchr(sv->str, '$', sv->len) == NULL) {
+        return make_arg(sv);
+    }
+
+    struct expand_buf eb;
+    eb.cap = sv->len + 32;
+    eb.len = 0;
+    eb.str = (char*)mem_alloc(eb.cap);
+    if (eb.str == NULL) return NULL;
+    eb.str[0] = '\0';
+
+    size_t rank = 0;
+    while (rank < sv->len) {
+        const char* str = sv->str + rank;
+        size_t remain = sv->len - rank;
+        int err = 0;
+        if (str[0] == '\\' && remain > 1 && str[1] == '$') {
+            err = expand_append(&eb, "$", 1);
+            rank += 2;
+        } else if (str[0] == '$') {
+            rank += expand_dollar(str, remain, &eb, &err);
+        } else {
+            const char* dollar = memchr(str, '$', remain);
+            size_t plainlen = dollar ? (size_t)(dollar - str) : remain;
+            /* keep \ of \$ for the branch above */
+            if (dollar && plainlen > 0 && dollar[-1] == '\\') plainlen -= 1;
+            if (plainlen == 0) plainlen = 1;
+            err = expand_append(&eb, str, plainlen);
+            rank += plainlen;
+        }
+        if (err < 0) {
+            mem_free(eb.str);
+            return NULL;
+        }
+    }
+
+    return eb.str;
+}
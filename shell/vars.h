@@ -0,0 +1,42 @@
+#ifndef BDU_SHELL_VARS_H
+#define BDU_SHELL_VARS_H
+
+#include "util.h"
+
+/*
+ * shell variables and positional parameters
+ *
+ * variables not set in the shell fall back to the environment.
+ */
+const char* var_get(const char* name, size_t namelen);
+int var_set(const char* name, size_t namelen, const char* value);
+/* value is value[0, valuelen), need not be terminated */
+int var_set_len(const char* name, size_t namelen,
+                const char* value, size_t valuelen);
+void var_unset(const char* name, size_t namelen);
+
+/*
+ * name=value, return length of name or 0 if arg is not an assignment
+ */
+size_t is_assignment(const char* arg);
+
+/*
+ * positional parameters $0 $1 ... $#, $@
+ */
+typedef struct positional positional;
+struct positional {
+    char** argv;    /* argv[0] is $0 */
+    int    argc;
+};
+
+/* replace positional parameters, old ones are returned in saved */
+void positional_set(int argc, char** argv, struct positional* saved);
+void positional_restore(struct positional* saved);
+
+/*
+ * expand $name, ${name}, $?, $#, $0-$9, $@, $* and $(( expression ))
+ * in a string fragment, return a malloc'ed string or NULL on error
+ */
+char* expand_arg(const struct string_view* sv);
+
+#endif /* BDU_SHELL_VARS_H */
@@ -0,0 +1,357 @@
+/*
+ * xargs [-0] [-r] [-n max-args] [-s max-chars] [-P max-procs]
+ *       [command [initial-arguments]]
+ *
+ * items are newline or NUL delimited; they are split in place in one
+ * arena and every batch is packed up to the real exec limit. batches
+ * run on up to max-procs child processes, or are called directly
+ * when command is an in-process stage.
+ */
+#include "stage.h"
+#include "bsh.h"
+#include "mem.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XARGSBUFLEN         (64 * 1024)
+#define XARGSMAXPROCS       256
+#define XARGSMAXARGLEN      (32 * 4096)     /* MAX_ARG_STRLEN of linux */
+
+extern char** environ;
+
+typedef struct xargs_opts xargs_opts;
+struct xargs_opts {
+    char   delim;
+    int    noempty;         /* -r */
+    long   maxargs;         /* -n, 0 for no limit */
+    long   maxchars;        /* -s, 0 for the exec limit */
+    long   maxprocs;        /* -P */
+    int    first;           /* index of command */
+};
+
+typedef struct xargs xargs;
+struct xargs {
+    struct xargs_opts opts;
+    struct stage_io*  io;
+    char**            initial;      /* command and initial arguments */
+    size_t            initlen;
+    size_t            limit;        /* bytes of argv and strings */
+    size_t            initsize;
+
+    char*             arena;        /* items, delimiters replaced by '\0' */
+    size_t            arenalen;
+    size_t            arenacap;
+    size_t*           items;        /* offsets into arena */
+    size_t            count;
+    size_t            itemscap;
+    size_t            size;         /* bytes the items take in exec */
+    char**            argv;
+    size_t            argvcap;
+
+    int               nullfd;       /* stdin of the commands */
+    pid_t             pids[XARGSMAXPROCS];
+    int               pidfds[XARGSMAXPROCS];
+    size_t            running;
+    int               batches;
+    int               status;
+    int               stop;         /* a command exited with 255 */
+};
+
+static int parse_long(const char* str, long* value) {
+    char* end = NULL;
+    if (str == NULL || *str == '\0') return -1;
+    *value = strtol(str, &end, 10);
+    return (*end == '\0' && *value >= 0) ? 0 : -1;
+}
+
+static int xargs_options(char** arglist, struct xargs_opts* opts) {
+    opts->delim    = '\n';
+    opts->noempty  = 0;
+    opts->maxargs  = 0;
+    opts->maxchars = 0;
+    opts->maxprocs = 1;
+
+    int i = 1;
+    for (; arglist[i] && arglist[i][0] == '-' && arglist[i][1] != '\0'; i++) {
+        const char* arg = arglist[i];
+        if (strcmp(arg, "--") == 0) {
+            i += 1;
+            break;
+        }
+        for (size_t j = 1; arg[j] != '\0'; j++) {
+            long* value = NULL;
+            switch (arg[j]) {
+                case '0': opts->delim = '\0'; continue;
+                case 'r': opts->noempty = 1; continue;
+                case 'n': value = &opts->maxargs; break;
+                case 's': value = &opts->maxchars; break;
+                case 'P': value = &opts->maxprocs; break;
+                default:  return -1;
+            }
+            /* -n5 or -n 5 */
+            const char* str = arg[j + 1] ? arg + j + 1 : arglist[++i];
+            if (parse_long(str, value) < 0) return -1;
+            break;
+        }
+    }
+    opts->first = i;
+
+    if (opts->maxprocs == 0) opts->maxprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts->maxprocs < 1) opts->maxprocs = 1;
+    if (opts->maxprocs > XARGSMAXPROCS) opts->maxprocs = XARGSMAXPROCS;
+    return 0;
+}
+
+int xargs_can_run(char** arglist) {
+    struct xargs_opts opts;
+    return xargs_options(arglist, &opts) == 0;
+}
+
+/*
+ * room for argv pointers and strings, like the kernel counts it
+ */
+static size_t exec_limit(const struct xargs_opts* opts) {
+    long argmax = sysconf(_SC_ARG_MAX);
+    if (argmax <= 0) argmax = 128 * 1024;
+
+    size_t envsize = 0;
+    for (char** env = environ; env && *env; env++) {
+        envsize += strlen(*env) + 1 + sizeof(char*);
+    }
+    /* headroom, as GNU xargs keeps */
+    size_t limit = (size_t)argmax > envsize + 4096 ? argmax - envsize - 4096 : 4096;
+    if (opts->maxchars > 0 && (size_t)opts->maxchars < limit) limit = opts->maxchars;
+    return limit;
+}
+
+static int grow_array(void** array, size_t* cap, size_t len, size_t elemsize) {
+    if (len < *cap) return 0;
+    size_t newcap = *cap ? *cap * 2 : 1024;
+    while (newcap <= len) newcap *= 2;
+    void* p = mem_realloc(*array, newcap * elemsize);
+    if (p == NULL) return -1;
+    *array = p;
+    *cap = newcap;
+    return 0;
+}
+
+static void xargs_status(struct xargs* xa, int status) {
+    /* like GNU xargs */
+    int mapped = 0;
+    if (status == 255) {
+        mapped = 124;
+        xa->stop = 1;
+    } else if (status > 128) {
+        mapped = 125;
+    } else if (status == 126 || status == 127) {
+        mapped = status;
+    } else if (status != 0) {
+        mapped = 123;
+    }
+    if (mapped > xa->status) xa->status = mapped;
+}
+
+/*
+ * wait for one of the running commands
+ */
+static void reap_one(struct xargs* xa) {
+    size_t done = 0;
+    int wstatus = 0;
+
+    int usepidfd = 1;
+    for (size_t i = 0; i < xa->running; i++) {
+        if (xa->pidfds[i] < 0) usepidfd = 0;
+    }
+    if (usepidfd) {
+        struct pollfd pfds[XARGSMAXPROCS];
+        for (size_t i = 0; i < xa->running; i++) {
+            pfds[i].fd = xa->pidfds[i];
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+        while (poll(pfds, xa->running, -1) < 0 && errno == EINTR) {}
+        while (done + 1 < xa->running && pfds[done].revents == 0) ++done;
+    }
+    /* without pidfds: the oldest one */
+    while (waitpid(xa->pids[done], &wstatus, 0) < 0 && errno == EINTR) {}
+    xargs_status(xa, exit_status(wstatus));
+
+    if (xa->pidfds[done] >= 0) close(xa->pidfds[done]);
+    xa->running -= 1;
+    xa->pids[done]   = xa->pids[xa->running];
+    xa->pidfds[done] = xa->pidfds[xa->running];
+}
+
+static int run_batch(struct xargs* xa) {
+    size_t argc = xa->initlen + xa->count;
+    if (grow_array((void**)&xa->argv, &xa->argvcap, argc + 1, sizeof(char*)) < 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < xa->initlen; i++) xa->argv[i] = xa->initial[i];
+    for (size_t i = 0; i < xa->count; i++) {
+        xa->argv[xa->initlen + i] = xa->arena + xa->items[i];
+    }
+    xa->argv[argc] = NULL;
+    xa->batches += 1;
+
+    struct stage_io* io = xa->io;
+    const struct stage_builtin* builtin = find_stage_builtin(xa->argv);
+    if (builtin && !builtin->forks) {
+        /* an in-process command is called directly, in order */
+        struct stage_io sub;
+        sub.out   = io->out;
+        sub.errfd = io->errfd;
+        if (reader_init(&sub.in, xa->nullfd, 0, NULL) < 0) return -1;
+        int status = builtin->run(xa->argv, &sub);
+        reader_close(&sub.in);
+        io->out = sub.out;
+        xargs_status(xa, status);
+        return io->out.closed ? -1 : 0;
+    }
+
+    /* output of the children follows what is written so far */
+    if (writer_flush(&io->out) < 0) return -1;
+    while (xa->running >= (size_t)xa->opts.maxprocs) reap_one(xa);
+
+    int outfd = io->out.fd == STDOUT_FILENO ? -1 : io->out.fd;
+    int errfd = io->errfd == STDERR_FILENO ? -1 : io->errfd;
+    pid_t pid = spawn_command(xa->argv, xa->nullfd, outfd, errfd);
+    if (pid < 0) return -1;
+
+    size_t slot = xa->running++;
+    xa->pids[slot] = pid;
+    xa->pidfds[slot] = (int)syscall(SYS_pidfd_open, pid, 0);
+    return 0;
+}
+
+/*
+ * add item arena[start, end), running a batch first when it is full
+ */
+static int add_item(struct xargs* xa, size_t start, size_t end) {
+    size_t len = end - start;
+    size_t cost = len + 1 + sizeof(char*);
+    if (len + 1 > XARGSMAXARGLEN || xa->initsize + cost > xa->limit) {
+        dprintf(xa->io->errfd, "xargs: argument line too long\n");
+        xa->status = 1;
+        return -1;
+    }
+
+    if (xa->count > 0 &&
+        (xa->size + cost > xa->limit ||
+         (xa->opts.maxargs > 0 && xa->count == (size_t)xa->opts.maxargs))) {
+        if (run_batch(xa) < 0) return -1;
+        xa->count = 0;
+        xa->size  = xa->initsize;
+    }
+
+    if (grow_array((void**)&xa->items, &xa->itemscap, xa->count, sizeof(size_t)) < 0) {
+        return -1;
+    }
+    xa->arena[end] = '\0';
+    xa->items[xa->count++] = start;
+    xa->size += cost;
+    return 0;
+}
+
+/*
+ * drop the items of finished batches, the unscanned tail moves to
+ * the front of the arena
+ */
+static void compact(struct xargs* xa, size_t* scan, size_t* itemstart) {
+    size_t keep = xa->count > 0 ? xa->items[0] : *itemstart;
+    if (keep == 0) return;
+
+    memmove(xa->arena, xa->arena + keep, xa->arenalen - keep);
+    xa->arenalen -= keep;
+    *scan -= keep;
+    *itemstart -= keep;
+    for (size_t i = 0; i < xa->count; i++) xa->items[i] -= keep;
+}
+
+static int xargs_loop(struct xargs* xa) {
+    size_t scan = 0;
+    size_t itemstart = 0;
+
+    while (!xa->stop) {
+        compact(xa, &scan, &itemstart);
+        if (xa->arenacap - xa->arenalen < XARGSBUFLEN) {
+            size_t cap = xa->arenacap * 2;
+            char* p = (char*)mem_realloc(xa->arena, cap + 1);
+            if (p == NULL) return -1;
+            xa->arena = p;
+            xa->arenacap = cap;
+        }
+
+        ssize_t rdcnt = reader_read(&xa->io->in, xa->arena + xa->arenalen,
+                                    xa->arenacap - xa->arenalen);
+        if (rdcnt < 0) {
+            dprintf(xa->io->errfd, "xargs: read error: %s\n", strerror(errno));
+            return -1;
+        }
+        if (rdcnt == 0) break;
+        xa->arenalen += rdcnt;
+
+        /* split in place, no copy of the items */
+        char* delim;
+        while ((delim = memchr(xa->arena + scan, xa->opts.delim,
+                               xa->arenalen - scan)) != NULL) {
+            size_t end = delim - xa->arena;
+            if (end > itemstart && add_item(xa, itemstart, end) < 0) return -1;
+            itemstart = scan = end + 1;
+        }
+        scan = xa->arenalen;
+    }
+
+    /* last item without delimiter */
+    if (!xa->stop && xa->arenalen > itemstart &&
+        add_item(xa, itemstart, xa->arenalen) < 0) {
+        return -1;
+    }
+    if (!xa->stop && (xa->count > 0 || (xa->batches == 0 && !xa->opts.noempty))) {
+        if (run_batch(xa) < 0) return -1;
+    }
+    return 0;
+}
+
+int xargs_run(char** arglist, struct stage_io* io) {
+    static char* echo[] = { "echo", NULL };
+
+    struct xargs xa;
+    memset(&xa, 0, sizeof(xa));
+    xargs_options(arglist, &xa.opts);
+    xa.io = io;
+    xa.initial = arglist[xa.opts.first] ? arglist + xa.opts.first : echo;
+    xa.limit = exec_limit(&xa.opts);
+    for (; xa.initial[xa.initlen]; xa.initlen++) {
+        xa.initsize += strlen(xa.initial[xa.initlen]) + 1 + sizeof(char*);
+    }
+    xa.size = xa.initsize;
+
+    xa.arenacap = XARGSBUFLEN * 2;
+    xa.arena = (char*)mem_alloc(xa.arenacap + 1);
+    xa.nullfd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (xa.arena == NULL || xa.nullfd < 0) {
+        dprintf(io->errfd, "xargs: %s\n", strerror(errno));
+        mem_free(xa.arena);
+        if (xa.nullfd >= 0) close(xa.nullfd);
+        return 1;
+    }
+
+    if (xargs_loop(&xa) < 0 && xa.status == 0) xa.status = 1;
+    while (xa.running > 0) reap_one(&xa);
+
+    close(xa.nullfd);
+    mem_free(xa.arena);
+    mem_free(xa.items);
+    mem_free(xa.argv);
+    return xa.status;
+}